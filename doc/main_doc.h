@@ -57,6 +57,7 @@ the desired character sequences. The @c name argument must be one of:
 - kp_plus: Keypad +
 - tab: Tab
 - backspace: Backspace
+- enter: Enter (only from the terminfo database)
 - f&lt;num&gt;: Function key &lt;num&gt;
 
 optionally combined with a plus symbol and one or more of the modifier letters
@@ -68,8 +69,87 @@ the keypad and regular cursor keys, it is a very bad idea to distinghuish
 between them. They should be treated as if they are the same keys as far as the
 behavior of the program is concerned.
 
+Programs which need more than one piece of information from the database, for
+example to let the user pick one of the maps listed by ::t3_key_db_get_map_names,
+should open the database once with ::t3_key_db_open and use the @c t3_key_db_
+functions on the returned handle. This avoids reading the database for each
+query.
+
 Each key may have multiple character sequences associated with it. By calling
 ::t3_key_get_named_node multiple times, the second and later times with @c NULL
 as the @c name argument @b and the returned value as the first argument, all
-character sequences can be retrieved.
+character sequences can be retrieved. ::t3_key_get_named_node only accepts maps
+returned by ::t3_key_load_map. Lists of nodes constructed by the program can be
+searched in the same way with ::t3_key_find_named_node.
+
+Programs which handle keys by number rather than by name can use
+::t3_key_lookup instead of ::t3_key_get_named_node. Each key name above has a
+::t3_key_id_t identifier (@c T3_KEY_ID_INSERT, @c T3_KEY_ID_KP_HOME,
+::T3_KEY_ID_F(num), etc.), and the modifiers are passed as a combination of
+::T3_KEY_MOD_CTRL, ::T3_KEY_MOD_META and ::T3_KEY_MOD_SHIFT. The identifier
+and modifiers of a node are returned by ::t3_key_get_node_id, or by
+::t3_key_get_name_id for a node which was not loaded by the library.
+
+To convert the input read from the terminal back into keys, a program can create
+a ::t3_key_decoder_t for the loaded map with ::t3_key_decoder_new (declared in
+@c t3key/decoder.h). Each block of input is passed to ::t3_key_decoder_feed,
+after which ::t3_key_decoder_next returns the keys and runs of plain text in the
+input. When the input ends with a sequence which may be incomplete, such as a
+lone escape character, the decoder keeps it until more input is passed, or until
+the program calls ::t3_key_decoder_flush. Input which can not be the start of a
+longer sequence is never kept, so the program only has to wait when
+::t3_key_decoder_get_pending reports kept bytes. In that case,
+::t3_key_decoder_get_timeout returns the time to wait for more input before
+flushing, which can be passed directly to @c poll. Programs which handle all
+input at once after each wake up can use ::t3_key_decoder_decode instead, which
+passes the input and stores the events in an array in a single call. Programs
+which read a non-blocking file descriptor can leave the reading to
+::t3_key_decoder_read, which reads into a ring buffer of the decoder and returns
+events pointing into it, without copying the input.
+
+Runs of plain text are split only at control characters and at bytes which
+start a sequence. On x86 processors, such runs are scanned with SSE2 or AVX2
+instructions when available, which can be disabled by passing
+::T3_KEY_DECODER_NO_SIMD to ::t3_key_decoder_set_flags.
+
+The decoder also understands the modifier parameters which xterm and many
+compatible terminals add to the sequences of the cursor, editing and function
+keys, such as @c 5 for control in <tt>ESC [ 1 ; 5 A</tt>. Combinations of keys
+and modifiers which are not listed in the map are therefore still reported with
+the correct ::t3_key_id_t and modifiers, but with a @c NULL node.
+
+For terminals with the @c xterm_mouse flag, the decoder returns mouse reports
+as ::T3_KEY_EVENT_MOUSE events, with the button, position and modifiers stored
+in a ::t3_key_mouse_t. The X10, UTF-8, URXVT and SGR encodings are all
+recognized. Programs which read the reports themselves can use
+::t3_key_parse_mouse, which does not allocate any memory. When all motion is
+tracked, a program which redraws slowly may fall behind on the motion reports.
+With ::T3_KEY_DECODER_COALESCE_MOTION, the decoder skips motion reports which
+are followed in the input by another motion report with the same buttons, so
+only the latest position is handled.
+
+Text pasted while bracketed paste mode is enabled is returned between a
+::T3_KEY_EVENT_PASTE_START and a ::T3_KEY_EVENT_PASTE_END event, as
+::T3_KEY_EVENT_PASTE events. These are large runs which point into the input
+buffer, and no sequences are matched inside the pasted text, such that escape
+characters in the pasted text are not mistaken for keys.
+
+Replies which the terminal sends to queries from the program arrive mixed with
+the keys. The decoder returns cursor position reports, device attribute
+replies, focus changes and operating system command replies as separate event
+types, with their parameters in a ::t3_key_reply_t, so the program does not need
+a second parser for its input. Because a cursor position report for the first
+row looks like a function key with modifiers, the program should set
+::T3_KEY_DECODER_CURSOR_REPORT while it waits for such a report. The length
+and number of parameters of all sequences can be limited with
+::t3_key_decoder_set_limits, which bounds the memory the decoder uses and the
+time it spends on each byte of input from an untrusted source.
+
+Programs which should not block on the terminal can leave the reading and
+decoding to a ::t3_key_reader_t (declared in @c t3key/reader.h). The reader
+thread reads from the terminal, handles the timeout of incomplete sequences and
+passes the events through a lock-free queue. The file descriptor returned by
+::t3_key_reader_get_fd becomes readable when events are available, after which
+::t3_key_reader_next retrieves them. Each event records the time at which its
+input was read.
 */
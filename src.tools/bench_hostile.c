@@ -0,0 +1,229 @@
+/* Copyright (C) 2018 G.P. Halkes
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#define _POSIX_C_SOURCE 200809L
+#include <curses.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <term.h>
+
+#include "bench_util.h"
+#include "t3key/decoder.h"
+
+/* Stress benchmark for the decoder, with input designed to make it wait for
+   the end of sequences which never end: long parameter lists, parameters and
+   mouse reports with long runs of leading zeros, unterminated replies and a
+   random mix of the bytes which make up sequences. The mouse streams are only
+   decoded as mouse reports for maps with the _xterm_mouse node, such as the
+   default xterm map. Each stream
+   is decoded at several sizes and in chunks of several sizes. The decoding
+   time must grow linearly with the size of the input, so the throughput for
+   the largest size is compared against the throughput for the smallest size.
+   All bytes of the input must be returned in the events. */
+
+typedef struct {
+  const char *name;
+  void (*fill)(char *buffer, size_t length);
+} stream_t;
+
+/** Fill @p buffer with copies of @p pattern. */
+static void repeat(char *buffer, size_t length, const char *pattern) {
+  size_t pattern_length = strlen(pattern), i;
+
+  for (i = 0; i < length; i++) {
+    buffer[i] = pattern[i % pattern_length];
+  }
+}
+
+/* A single CSI introducer, followed by digits until the end. */
+static void fill_digits(char *buffer, size_t length) {
+  repeat(buffer, length, "0123456789");
+  memcpy(buffer, "\033[", 2);
+}
+
+/* CSI introducers, each followed by more parameters than a reply may have. */
+static void fill_params(char *buffer, size_t length) {
+  char pattern[2 + 2 * 300 + 1];
+
+  memset(pattern, ';', sizeof(pattern) - 1);
+  memcpy(pattern, "\033[", 2);
+  pattern[sizeof(pattern) - 1] = 0;
+  repeat(buffer, length, pattern);
+}
+
+/* Fill @p buffer with copies of @p format, with %s replaced by 300 zeros. */
+static void repeat_zeros(char *buffer, size_t length, const char *format) {
+  char zeros[301], pattern[320];
+
+  memset(zeros, '0', sizeof(zeros) - 1);
+  zeros[sizeof(zeros) - 1] = 0;
+  sprintf(pattern, format, zeros);
+  repeat(buffer, length, pattern);
+}
+
+/* Keys with modifier parameters, with leading zeros in the first parameter. */
+static void fill_zeros(char *buffer, size_t length) { repeat_zeros(buffer, length, "\033[%s1;5A"); }
+
+/* SGR mouse reports, with leading zeros in the first parameter. */
+static void fill_mouse(char *buffer, size_t length) {
+  repeat_zeros(buffer, length, "\033[<%s0;1;1M");
+}
+
+/* A single SGR mouse report introducer, followed by zeros until the end. */
+static void fill_mouse_zeros(char *buffer, size_t length) {
+  memset(buffer, '0', length);
+  memcpy(buffer, "\033[<", 3);
+}
+
+/* OSC introducers, each followed by more text than a reply may have. */
+static void fill_osc(char *buffer, size_t length) {
+  char pattern[2 + 300 + 1];
+
+  memset(pattern, 'x', sizeof(pattern) - 1);
+  memcpy(pattern, "\033]", 2);
+  pattern[sizeof(pattern) - 1] = 0;
+  repeat(buffer, length, pattern);
+}
+
+/* The starts of replies, mouse reports and keys with modifiers, each
+   interrupted by the next. */
+static void fill_unterminated(char *buffer, size_t length) {
+  repeat(buffer, length, "\033[1;5\033[<0;12;\033]11;rgb:\033[?64;1\033[M \033O\033[200\033");
+}
+
+/* Random bytes from the sequences above. */
+static void fill_random(char *buffer, size_t length) {
+  static const char bytes[] = "\033\033\033[[]];;?<>0123456789MmRc~~\a\\ x";
+  size_t i;
+
+  for (i = 0; i < length; i++) {
+    buffer[i] = bytes[rand() % (sizeof(bytes) - 1)];
+  }
+}
+
+/** Decode @p length bytes of @p buffer in chunks of @p chunk bytes.
+    @return The number of bytes decoded per second.
+*/
+static double bench(t3_key_decoder_t *decoder, const char *buffer, size_t length, size_t chunk) {
+  t3_key_event_t event;
+  size_t pos, decoded = 0;
+  double start, elapsed;
+
+  start = bench_now();
+  for (pos = 0; pos < length; pos += chunk) {
+    t3_key_decoder_feed(decoder, buffer + pos, pos + chunk > length ? length - pos : chunk);
+    while (t3_key_decoder_next(decoder, &event)) {
+      decoded += event.length;
+    }
+  }
+  while (t3_key_decoder_flush(decoder, &event)) {
+    decoded += event.length;
+  }
+  elapsed = bench_now() - start;
+
+  if (decoded != length) {
+    fprintf(stderr, "Decoded %zu bytes instead of %zu\n", decoded, length);
+    exit(EXIT_FAILURE);
+  }
+  return length / elapsed;
+}
+
+int main(int argc, char *argv[]) {
+  static const stream_t streams[] = {
+      {"digits", fill_digits},
+      {"params", fill_params},
+      {"zeros", fill_zeros},
+      {"mouse", fill_mouse},
+      {"mouse-zeros", fill_mouse_zeros},
+      {"osc", fill_osc},
+      {"unterminated", fill_unterminated},
+      {"random", fill_random},
+  };
+  static const size_t sizes[] = {256, 1024, 4096};
+  static const size_t chunks[] = {1, 16, 4096};
+  const t3_key_node_t *map;
+  t3_key_decoder_t *decoder;
+  const char *term = "xterm";
+  size_t max_length = SIZE_MAX, i, j, k;
+  int max_params = 0, error, failed = 0;
+  char *buffer;
+
+  while (argc > 2 && argv[1][0] == '-') {
+    if (strcmp(argv[1], "-l") == 0) {
+      max_length = atoi(argv[2]);
+    } else if (strcmp(argv[1], "-p") == 0) {
+      max_params = atoi(argv[2]);
+    } else {
+      break;
+    }
+    argc -= 2;
+    argv += 2;
+  }
+  if (argc > 2 || (argc > 1 && argv[1][0] == '-')) {
+    printf("Usage: bench_hostile [-l <max length>] [-p <max params>] [<terminal name>]\n");
+    exit(EXIT_SUCCESS);
+  }
+  if (argc > 1) {
+    term = argv[1];
+  }
+
+  setupterm(term, 1, &error);
+  if ((map = t3_key_load_map(term, NULL, &error)) == NULL) {
+    fprintf(stderr, "Could not load map for %s: %s\n", term, t3_key_strerror(error));
+    exit(EXIT_FAILURE);
+  }
+  if ((decoder = t3_key_decoder_new(map, &error)) == NULL) {
+    fprintf(stderr, "Could not create decoder: %s\n", t3_key_strerror(error));
+    exit(EXIT_FAILURE);
+  }
+  t3_key_decoder_set_limits(decoder, max_length, max_params);
+  if ((buffer = malloc(sizes[sizeof(sizes) / sizeof(sizes[0]) - 1] * 1024)) == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+
+  printf("Terminal %s, throughput in MB/s for input of", term);
+  for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    printf(" %zu KiB%s", sizes[i], i + 1 < sizeof(sizes) / sizeof(sizes[0]) ? "," : "\n");
+  }
+  for (i = 0; i < sizeof(streams) / sizeof(streams[0]); i++) {
+    for (j = 0; j < sizeof(chunks) / sizeof(chunks[0]); j++) {
+      double first = 0, rate = 0;
+
+      printf("  %-12s %4zu byte chunks", streams[i].name, chunks[j]);
+      for (k = 0; k < sizeof(sizes) / sizeof(sizes[0]); k++) {
+        srand(1);
+        streams[i].fill(buffer, sizes[k] * 1024);
+        rate = bench(decoder, buffer, sizes[k] * 1024, chunks[j]);
+        if (k == 0) {
+          first = rate;
+        }
+        printf(" %9.1f", rate / 1e6);
+      }
+      /* Quadratic behavior would reduce the throughput by a factor 16 for
+         each stream. Allow for a factor 2 of noise. */
+      if (rate < first / 2) {
+        printf("  NOT LINEAR");
+        failed = 1;
+      }
+      printf("\n");
+    }
+  }
+
+  free(buffer);
+  t3_key_decoder_free(decoder);
+  t3_key_free_map(map);
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
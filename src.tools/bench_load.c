@@ -0,0 +1,138 @@
+/* Copyright (C) 2018 G.P. Halkes
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#define _POSIX_C_SOURCE 200809L
+#include <curses.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <term.h>
+
+#include "bench_util.h"
+#include "t3key/key.h"
+
+/* Benchmark for the functions which read the key database. The first call of
+   each function is reported separately, as it includes one-time
+   initialisation such as parsing the database schema. */
+
+static const char *term;
+
+static void fail(const char *what, int error) {
+  fprintf(stderr, "%s failed: %s\n", what, t3_key_strerror(error));
+  exit(EXIT_FAILURE);
+}
+
+static void run_get_map_names(void) {
+  int error;
+  const t3_key_string_list_t *names = t3_key_get_map_names(term, &error);
+  if (names == NULL) {
+    fail("t3_key_get_map_names", error);
+  }
+  t3_key_free_names(names);
+}
+
+static void run_get_best_map_name(void) {
+  int error;
+  char *best = t3_key_get_best_map_name(term, &error);
+  if (best == NULL) {
+    fail("t3_key_get_best_map_name", error);
+  }
+  free(best);
+}
+
+static void run_load_map(void) {
+  int error;
+  const t3_key_node_t *map = t3_key_load_map(term, NULL, &error);
+  if (map == NULL) {
+    fail("t3_key_load_map", error);
+  }
+  t3_key_free_map(map);
+}
+
+static void run_startup(void) {
+  run_get_map_names();
+  run_get_best_map_name();
+  run_load_map();
+}
+
+static void run_startup_db(void) {
+  int error;
+  const t3_key_string_list_t *names;
+  const t3_key_node_t *map;
+  t3_key_db_t *db;
+  char *best;
+
+  if ((db = t3_key_db_open(term, &error)) == NULL) {
+    fail("t3_key_db_open", error);
+  }
+  if ((names = t3_key_db_get_map_names(db, &error)) == NULL) {
+    fail("t3_key_db_get_map_names", error);
+  }
+  t3_key_free_names(names);
+  if ((best = t3_key_db_get_best_map_name(db, &error)) == NULL) {
+    fail("t3_key_db_get_best_map_name", error);
+  }
+  free(best);
+  if ((map = t3_key_db_load_map(db, NULL, &error)) == NULL) {
+    fail("t3_key_db_load_map", error);
+  }
+  t3_key_free_map(map);
+  t3_key_db_close(db);
+}
+
+static void bench(const char *name, void (*func)(void), int iterations) {
+  double start, first, rest;
+  int i;
+
+  start = bench_now();
+  func();
+  first = bench_now() - start;
+
+  start = bench_now();
+  for (i = 1; i < iterations; i++) {
+    func();
+  }
+  rest = iterations > 1 ? (bench_now() - start) / (iterations - 1) : 0.0;
+  printf("%-26s first: %10.1f us  later: %10.1f us/call\n", name, first * 1e6, rest * 1e6);
+}
+
+int main(int argc, char *argv[]) {
+  int iterations = 1000, error;
+
+  if (argc > 1 && strcmp(argv[1], "-n") == 0 && argc > 2) {
+    iterations = atoi(argv[2]);
+    argc -= 2;
+    argv += 2;
+  }
+
+  if (argc > 2 || (argc == 2 && strcmp(argv[1], "-h") == 0) || iterations < 1) {
+    printf("Usage: bench_load [-n <iterations>] [<terminal name>]\n");
+    exit(EXIT_SUCCESS);
+  }
+
+  term = argc == 2 ? argv[1] : getenv("TERM");
+  if (term == NULL) {
+    fail("Determining terminal", T3_ERR_NO_TERM);
+  }
+  if (setupterm(term, 1, &error) == ERR) {
+    fprintf(stderr, "Could not find terminfo for %s\n", term);
+  }
+
+  printf("Terminal %s, %d iterations\n", term, iterations);
+  bench("t3_key_get_map_names", run_get_map_names, iterations);
+  bench("t3_key_get_best_map_name", run_get_best_map_name, iterations);
+  bench("t3_key_load_map", run_load_map, iterations);
+  bench("names + best + load", run_startup, iterations);
+  bench("db open + names/best/load", run_startup_db, iterations);
+  return 0;
+}
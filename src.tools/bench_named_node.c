@@ -0,0 +1,182 @@
+/* Copyright (C) 2018 G.P. Halkes
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#define _POSIX_C_SOURCE 200809L
+#include <curses.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <term.h>
+
+#include "bench_util.h"
+#include "t3key/key.h"
+
+/* Benchmark for t3_key_get_named_node, compared to the linear walk of
+   t3_key_find_named_node. Each iteration looks up every node of the map by
+   name, and iterates over all nodes with that name, as an application binding
+   all keys would. The lookup by key identifier through t3_key_lookup is
+   measured as well. */
+
+/* The lookup as it was implemented before the map was indexed. */
+static const t3_key_node_t *walk_named_node(const t3_key_node_t *map, const char *name) {
+  return t3_key_find_named_node(map, name);
+}
+
+static size_t lookup_all(const t3_key_node_t *map,
+                         const t3_key_node_t *(*lookup)(const t3_key_node_t *, const char *)) {
+  const t3_key_node_t *node, *found;
+  size_t total = 0;
+
+  for (node = map; node != NULL; node = node->next) {
+    for (found = lookup(map, node->key); found != NULL; found = lookup(found, NULL)) {
+      total++;
+    }
+  }
+  return total;
+}
+
+static const t3_key_node_t *indexed_named_node(const t3_key_node_t *map, const char *name) {
+  return t3_key_get_named_node(map, name);
+}
+
+/* Look up by key identifier. The identifiers are not part of the timed loop,
+   such that only the lookups themselves are measured. */
+static t3_key_id_t *node_ids;
+static int *node_modifiers;
+static size_t node_count;
+
+static size_t lookup_all_ids(const t3_key_node_t *map) {
+  const t3_key_node_t *found;
+  size_t total = 0, i;
+
+  for (i = 0; i < node_count; i++) {
+    for (found = t3_key_lookup(map, node_ids[i], node_modifiers[i]); found != NULL;
+         found = t3_key_get_named_node(found, NULL)) {
+      total++;
+    }
+  }
+  return total;
+}
+
+/* Check that both lookups return the same nodes, also when starting a search in
+   the middle of the map. */
+static int check(const t3_key_node_t *map) {
+  const t3_key_node_t *start, *node, *a, *b;
+
+  for (start = map; start != NULL; start = start->next) {
+    for (node = map; node != NULL; node = node->next) {
+      a = walk_named_node(start, node->key);
+      b = t3_key_get_named_node(start, node->key);
+      for (; a != NULL || b != NULL;
+           a = walk_named_node(a, NULL), b = t3_key_get_named_node(b, NULL)) {
+        if (a != b) {
+          fprintf(stderr, "Mismatch for key %s\n", node->key);
+          return 0;
+        }
+      }
+    }
+    if (t3_key_get_named_node(start, "no-such-key") != NULL) {
+      fprintf(stderr, "Found non-existent key\n");
+      return 0;
+    }
+  }
+
+  /* All key names in the database use the canonical modifier order, so the
+     lookup by identifier must find the same node as the lookup by name. */
+  for (node = map; node != NULL; node = node->next) {
+    int modifiers;
+    t3_key_id_t id = t3_key_get_node_id(node, &modifiers);
+
+    if (id == T3_KEY_ID_NONE) {
+      if (node->key[0] != '_') {
+        fprintf(stderr, "No key identifier for %s\n", node->key);
+        return 0;
+      }
+      continue;
+    }
+    if (t3_key_lookup(map, id, modifiers) != t3_key_get_named_node(map, node->key)) {
+      fprintf(stderr, "Lookup by key identifier failed for %s\n", node->key);
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static void bench(const char *name, const t3_key_node_t *map,
+                  const t3_key_node_t *(*lookup)(const t3_key_node_t *, const char *),
+                  int iterations) {
+  size_t lookups = 0;
+  double start;
+  int i;
+
+  start = bench_now();
+  for (i = 0; i < iterations; i++) {
+    lookups += lookup == NULL ? lookup_all_ids(map) : lookup_all(map, lookup);
+  }
+  printf("  %-8s %10.1f us/map  %8.1f ns/lookup\n", name, (bench_now() - start) / iterations * 1e6,
+         (bench_now() - start) / lookups * 1e9);
+}
+
+int main(int argc, char *argv[]) {
+  static const char *default_terms[] = {"xterm", "rxvt"};
+  const char **terms = default_terms;
+  int term_count = 2, iterations = 1000, i, error;
+
+  if (argc > 2 && strcmp(argv[1], "-n") == 0) {
+    iterations = atoi(argv[2]);
+    argc -= 2;
+    argv += 2;
+  }
+  if ((argc > 1 && strcmp(argv[1], "-h") == 0) || iterations < 1) {
+    printf("Usage: bench_named_node [-n <iterations>] [<terminal name>...]\n");
+    exit(EXIT_SUCCESS);
+  }
+  if (argc > 1) {
+    terms = (const char **)argv + 1;
+    term_count = argc - 1;
+  }
+
+  for (i = 0; i < term_count; i++) {
+    const t3_key_node_t *map, *node;
+    size_t count = 0;
+
+    setupterm(terms[i], 1, &error);
+    if ((map = t3_key_load_map(terms[i], NULL, &error)) == NULL) {
+      fprintf(stderr, "Could not load map for %s: %s\n", terms[i], t3_key_strerror(error));
+      exit(EXIT_FAILURE);
+    }
+    for (node = map; node != NULL; node = node->next) {
+      count++;
+    }
+    node_ids = malloc(count * sizeof(t3_key_id_t));
+    node_modifiers = malloc(count * sizeof(int));
+    if (node_ids == NULL || node_modifiers == NULL) {
+      fprintf(stderr, "Out of memory\n");
+      exit(EXIT_FAILURE);
+    }
+    for (node = map, node_count = 0; node != NULL; node = node->next, node_count++) {
+      node_ids[node_count] = t3_key_get_node_id(node, &node_modifiers[node_count]);
+    }
+    printf("Terminal %s, %zu keys, %d iterations\n", terms[i], count, iterations);
+    if (!check(map)) {
+      exit(EXIT_FAILURE);
+    }
+    bench("walk", map, walk_named_node, iterations);
+    bench("indexed", map, indexed_named_node, iterations);
+    bench("key id", map, NULL, iterations);
+    free(node_ids);
+    free(node_modifiers);
+    t3_key_free_map(map);
+  }
+  return 0;
+}
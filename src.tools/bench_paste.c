@@ -0,0 +1,218 @@
+/* Copyright (C) 2018 G.P. Halkes
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#define _POSIX_C_SOURCE 200809L
+#include <curses.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <term.h>
+#include <unistd.h>
+
+#include "bench_util.h"
+#include "t3key/decoder.h"
+
+/* Benchmark for the decoding of large pastes. The pasted text resembles
+   source code: lines of ASCII text with tabs, some UTF-8 characters and the
+   occasional escape character. It is decoded once with the bracketed paste
+   markers around it and once without, passing the input to the decoder in
+   chunks of the size of a typical read from the terminal. For the bracketed
+   paste, the pasted bytes returned by the decoder are compared against the
+   input. The bracketed paste is then also written to a pipe by a child
+   process, and read by copying it into a buffer which is passed to the
+   decoder, and by reading it into the ring buffer of the decoder. */
+
+#define READ_SIZE 4096
+
+static void fill_paste(char *buffer, size_t length) {
+  size_t i, next_break = 0;
+  for (i = 0; i < length; i++) {
+    int kind = rand() % 1000;
+    if (i == next_break) {
+      buffer[i] = '\r';
+      next_break = i + 1 + rand() % 100;
+    } else if (kind < 50) {
+      buffer[i] = '\t';
+    } else if (kind < 52 && i + 2 < next_break) {
+      buffer[i++] = '\xc3';
+      buffer[i] = '\xa9';
+    } else if (kind < 53) {
+      buffer[i] = '\033';
+    } else {
+      buffer[i] = ' ' + rand() % 0x5f;
+    }
+  }
+}
+
+static void bench(t3_key_decoder_t *decoder, const char *name, const char *buffer,
+                  size_t length, const char *paste, size_t paste_length, int iterations) {
+  t3_key_event_t event;
+  size_t events = 0, pasted = 0, pos;
+  double start, elapsed;
+  int i, mismatch = 0;
+
+  start = bench_now();
+  for (i = 0; i < iterations; i++) {
+    pasted = 0;
+    for (pos = 0; pos < length; pos += READ_SIZE) {
+      t3_key_decoder_feed(decoder, buffer + pos,
+                          pos + READ_SIZE > length ? length - pos : READ_SIZE);
+      while (t3_key_decoder_next(decoder, &event)) {
+        events++;
+        if (event.type == T3_KEY_EVENT_PASTE && paste != NULL) {
+          mismatch |= pasted + event.length > paste_length ||
+                      memcmp(paste + pasted, event.data, event.length) != 0;
+          pasted += event.length;
+        }
+      }
+    }
+    while (t3_key_decoder_flush(decoder, &event)) {
+      events++;
+    }
+  }
+  elapsed = bench_now() - start;
+  printf("  %-11s %8.2f GB/s  %10zu events\n", name, (double)length * iterations / elapsed / 1e9,
+         events / iterations);
+  if (paste != NULL && (mismatch || pasted != paste_length)) {
+    fprintf(stderr, "Pasted text not returned correctly\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+static void bench_pipe(const t3_key_node_t *map, const char *name, const char *buffer,
+                       size_t length, size_t paste_length, int iterations, int ring) {
+  static char input[65536];
+  t3_key_decoder_t *decoder;
+  t3_key_event_t event;
+  size_t events = 0, pasted = 0;
+  double start, elapsed;
+  ssize_t result;
+  int fds[2], i, error;
+  pid_t pid;
+
+  if ((decoder = t3_key_decoder_new(map, &error)) == NULL) {
+    fprintf(stderr, "Could not create decoder: %s\n", t3_key_strerror(error));
+    exit(EXIT_FAILURE);
+  }
+  if (pipe(fds) < 0 || (pid = fork()) < 0) {
+    perror("Could not start writer");
+    exit(EXIT_FAILURE);
+  }
+  if (pid == 0) {
+    close(fds[0]);
+    for (i = 0; i < iterations; i++) {
+      size_t pos;
+      for (pos = 0; pos < length; pos += result) {
+        if ((result = write(fds[1], buffer + pos, length - pos)) < 0) {
+          _exit(EXIT_FAILURE);
+        }
+      }
+    }
+    _exit(EXIT_SUCCESS);
+  }
+  close(fds[1]);
+
+  start = bench_now();
+  if (ring) {
+    /* The pipe is blocking, so this only returns 0 when bytes are kept. */
+    while ((result = t3_key_decoder_read(decoder, fds[0], &event)) >= 0) {
+      if (result > 0) {
+        events++;
+        pasted += event.type == T3_KEY_EVENT_PASTE ? event.length : 0;
+      }
+    }
+  } else {
+    while ((result = read(fds[0], input, sizeof(input))) > 0) {
+      t3_key_decoder_feed(decoder, input, result);
+      while (t3_key_decoder_next(decoder, &event)) {
+        events++;
+        pasted += event.type == T3_KEY_EVENT_PASTE ? event.length : 0;
+      }
+    }
+  }
+  while (t3_key_decoder_flush(decoder, &event)) {
+    events++;
+  }
+  elapsed = bench_now() - start;
+  printf("  %-11s %8.2f GB/s  %10zu events\n", name, (double)length * iterations / elapsed / 1e9,
+         events / iterations);
+
+  close(fds[0]);
+  waitpid(pid, NULL, 0);
+  t3_key_decoder_free(decoder);
+  if (pasted != paste_length * iterations) {
+    fprintf(stderr, "Pasted text not returned completely\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  static const size_t sizes[] = {1, 4, 16};
+  static const char start_marker[] = "\033[200~", end_marker[] = "\033[201~";
+  const t3_key_node_t *map;
+  t3_key_decoder_t *decoder;
+  const char *term = "xterm";
+  int iterations = 5, error;
+  char *buffer;
+  size_t i, marker_length = strlen(start_marker);
+
+  if (argc > 2 && strcmp(argv[1], "-n") == 0) {
+    iterations = atoi(argv[2]);
+    argc -= 2;
+    argv += 2;
+  }
+  if (argc > 2 || (argc > 1 && strcmp(argv[1], "-h") == 0) || iterations < 1) {
+    printf("Usage: bench_paste [-n <iterations>] [<terminal name>]\n");
+    exit(EXIT_SUCCESS);
+  }
+  if (argc > 1) {
+    term = argv[1];
+  }
+
+  setupterm(term, 1, &error);
+  if ((map = t3_key_load_map(term, NULL, &error)) == NULL) {
+    fprintf(stderr, "Could not load map for %s: %s\n", term, t3_key_strerror(error));
+    exit(EXIT_FAILURE);
+  }
+  if ((decoder = t3_key_decoder_new(map, &error)) == NULL) {
+    fprintf(stderr, "Could not create decoder: %s\n", t3_key_strerror(error));
+    exit(EXIT_FAILURE);
+  }
+
+  printf("Terminal %s, %d byte reads, %d iterations\n", term, READ_SIZE, iterations);
+  for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    size_t size = sizes[i] * 1024 * 1024;
+
+    if ((buffer = malloc(size + 2 * marker_length)) == NULL) {
+      fprintf(stderr, "Out of memory\n");
+      exit(EXIT_FAILURE);
+    }
+    srand(1);
+    memcpy(buffer, start_marker, marker_length);
+    fill_paste(buffer + marker_length, size);
+    memcpy(buffer + marker_length + size, end_marker, marker_length);
+
+    printf("%zu MiB paste\n", sizes[i]);
+    bench(decoder, "bracketed", buffer, size + 2 * marker_length, buffer + marker_length, size,
+          iterations);
+    bench(decoder, "unbracketed", buffer + marker_length, size, NULL, 0, iterations);
+    bench_pipe(map, "pipe copy", buffer, size + 2 * marker_length, size, iterations, 0);
+    bench_pipe(map, "pipe ring", buffer, size + 2 * marker_length, size, iterations, 1);
+    free(buffer);
+  }
+
+  t3_key_decoder_free(decoder);
+  t3_key_free_map(map);
+  return 0;
+}
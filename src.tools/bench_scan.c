@@ -0,0 +1,145 @@
+/* Copyright (C) 2018 G.P. Halkes
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#define _POSIX_C_SOURCE 200809L
+#include <curses.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <term.h>
+
+#include "bench_util.h"
+#include "t3key/decoder.h"
+
+/* Benchmark for the decoding of large amounts of text, as produced when text
+   is pasted into the terminal. Each input is decoded with and without the
+   vector versions of the text scanner. */
+
+#define INPUT_SIZE (8 * 1024 * 1024)
+
+/* Plain ASCII text, without any line breaks. */
+static void fill_ascii(char *buffer, size_t length) {
+  size_t i;
+  for (i = 0; i < length; i++) {
+    buffer[i] = ' ' + rand() % 0x5f;
+  }
+}
+
+/* ASCII text with lines of 20 to 100 characters, terminated by a carriage
+   return as sent by the terminal for the enter key. */
+static void fill_lines(char *buffer, size_t length) {
+  size_t i, next_break = 0;
+  for (i = 0; i < length; i++) {
+    if (i == next_break) {
+      buffer[i] = '\r';
+      next_break = i + 21 + rand() % 80;
+    } else {
+      buffer[i] = ' ' + rand() % 0x5f;
+    }
+  }
+}
+
+/* UTF-8 text, consisting of two and three byte characters. */
+static void fill_utf8(char *buffer, size_t length) {
+  static const char *characters[] = {"\xc3\xa9", "\xce\xbb", "\xd0\x96", "\xe2\x82\xac",
+                                     "\xe3\x81\x82", "\xe4\xb8\xad"};
+  size_t i = 0;
+  while (i < length) {
+    const char *c = characters[rand() % 6];
+    size_t c_length = strlen(c);
+    if (i + c_length > length) {
+      buffer[i++] = 'a';
+    } else {
+      memcpy(buffer + i, c, c_length);
+      i += c_length;
+    }
+  }
+}
+
+static void bench(t3_key_decoder_t *decoder, const char *name, const char *buffer,
+                  size_t length, int flags, int iterations) {
+  t3_key_event_t event;
+  size_t events = 0;
+  double start, elapsed;
+  int i;
+
+  t3_key_decoder_set_flags(decoder, flags);
+  start = bench_now();
+  for (i = 0; i < iterations; i++) {
+    t3_key_decoder_feed(decoder, buffer, length);
+    while (t3_key_decoder_next(decoder, &event)) {
+      events++;
+    }
+    while (t3_key_decoder_flush(decoder, &event)) {
+      events++;
+    }
+  }
+  elapsed = bench_now() - start;
+  printf("  %-6s %-7s %8.2f GB/s  %10zu events\n", name,
+         flags & T3_KEY_DECODER_NO_SIMD ? "scalar" : "vector",
+         (double)length * iterations / elapsed / 1e9, events / iterations);
+}
+
+int main(int argc, char *argv[]) {
+  static const struct {
+    const char *name;
+    void (*fill)(char *buffer, size_t length);
+  } inputs[] = {{"ascii", fill_ascii}, {"lines", fill_lines}, {"utf8", fill_utf8}};
+  const t3_key_node_t *map;
+  t3_key_decoder_t *decoder;
+  const char *term = "xterm";
+  int iterations = 20, error;
+  char *buffer;
+  size_t i;
+
+  if (argc > 2 && strcmp(argv[1], "-n") == 0) {
+    iterations = atoi(argv[2]);
+    argc -= 2;
+    argv += 2;
+  }
+  if (argc > 2 || (argc > 1 && strcmp(argv[1], "-h") == 0) || iterations < 1) {
+    printf("Usage: bench_scan [-n <iterations>] [<terminal name>]\n");
+    exit(EXIT_SUCCESS);
+  }
+  if (argc > 1) {
+    term = argv[1];
+  }
+
+  setupterm(term, 1, &error);
+  if ((map = t3_key_load_map(term, NULL, &error)) == NULL) {
+    fprintf(stderr, "Could not load map for %s: %s\n", term, t3_key_strerror(error));
+    exit(EXIT_FAILURE);
+  }
+  if ((decoder = t3_key_decoder_new(map, &error)) == NULL) {
+    fprintf(stderr, "Could not create decoder: %s\n", t3_key_strerror(error));
+    exit(EXIT_FAILURE);
+  }
+  if ((buffer = malloc(INPUT_SIZE)) == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+
+  printf("Terminal %s, %d MiB input, %d iterations\n", term, INPUT_SIZE / (1024 * 1024),
+         iterations);
+  for (i = 0; i < sizeof(inputs) / sizeof(inputs[0]); i++) {
+    srand(1);
+    inputs[i].fill(buffer, INPUT_SIZE);
+    bench(decoder, inputs[i].name, buffer, INPUT_SIZE, T3_KEY_DECODER_NO_SIMD, iterations);
+    bench(decoder, inputs[i].name, buffer, INPUT_SIZE, 0, iterations);
+  }
+
+  free(buffer);
+  t3_key_decoder_free(decoder);
+  t3_key_free_map(map);
+  return 0;
+}
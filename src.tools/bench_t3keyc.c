@@ -0,0 +1,172 @@
+/* Copyright (C) 2018 G.P. Halkes
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "bench_util.h"
+
+/* Benchmark for validating large databases with t3keyc. A synthetic database
+   is written to a temporary directory, with a single map which includes
+   internal maps holding the given number of entries. The internal maps use
+   the same key names, but all sequences are different, except for the last
+   entry of each internal map, which repeats the sequence of its first entry.
+   The validation time must grow linearly with the number of entries, and
+   t3keyc must report exactly one repeated sequence per internal map. */
+
+#define TERM_NAME "bench-t3keyc"
+#define KEYS_PER_MAP 500
+
+static const char *modifiers[] = {"", "-s", "-m", "-ms", "-c", "-cs", "-cm", "-cms"};
+
+static char *path;
+static char *errors_path;
+
+/** Write a database with @p count entries.
+    @return The number of internal maps.
+*/
+static int write_database(int count) {
+  FILE *output;
+  int maps = (count + KEYS_PER_MAP - 1) / KEYS_PER_MAP, i, k;
+
+  output = bench_create_file(path);
+  fprintf(output, "format = 1\nbest = \"bench\"\nmaps {\n\tbench {\n");
+  for (i = 0; i < maps; i++) {
+    fprintf(output, "\t\t%%_use = \"_m%d\"\n", i);
+  }
+  fprintf(output, "\t}\n");
+  for (i = 0; i < maps; i++) {
+    int keys = i + 1 < maps ? KEYS_PER_MAP : count - i * KEYS_PER_MAP;
+
+    fprintf(output, "\t_m%d {\n", i);
+    for (k = 0; k < keys; k++) {
+      /* Function keys f1 up to f99, with all combinations of modifiers. */
+      fprintf(output, "\t\tf%d%s = \"\\e[%d;%d~\"\n", k / 8 + 1, modifiers[k % 8], i,
+              k + 1 < keys ? k : 0);
+    }
+    fprintf(output, "\t}\n");
+  }
+  fprintf(output, "}\n");
+  fclose(output);
+  return maps;
+}
+
+/** Count the lines in the error output of t3keyc reporting a repeated sequence. */
+static int count_repeated(void) {
+  char line[1024];
+  FILE *errors;
+  int count = 0;
+
+  if ((errors = fopen(errors_path, "r")) == NULL) {
+    perror("Could not read error output");
+    exit(EXIT_FAILURE);
+  }
+  while (fgets(line, sizeof(line), errors) != NULL) {
+    if (strstr(line, "has the same sequence as") != NULL) {
+      count++;
+    }
+  }
+  fclose(errors);
+  return count;
+}
+
+/** Run @p t3keyc on the database, with its output redirected to the errors file. */
+static void run(const char *t3keyc) {
+  pid_t pid;
+  int status, fd;
+
+  if ((pid = fork()) < 0) {
+    perror("fork");
+    exit(EXIT_FAILURE);
+  } else if (pid == 0) {
+    if ((fd = open(errors_path, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0) {
+      _exit(127);
+    }
+    dup2(fd, STDOUT_FILENO);
+    dup2(fd, STDERR_FILENO);
+    execl(t3keyc, t3keyc, path, (char *)NULL);
+    _exit(127);
+  }
+  if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    fprintf(stderr, "Running %s failed\n", t3keyc);
+    exit(EXIT_FAILURE);
+  }
+}
+
+/** Validate a database with @p count entries.
+    @return The time per entry in seconds.
+*/
+static double bench(const char *t3keyc, int count, int *failed) {
+  double start, elapsed;
+  int maps, repeated;
+
+  maps = write_database(count);
+  start = bench_now();
+  run(t3keyc);
+  elapsed = bench_now() - start;
+  if ((repeated = count_repeated()) != maps) {
+    fprintf(stderr, "Found %d repeated sequences instead of %d\n", repeated, maps);
+    *failed = 1;
+  }
+  printf("  %7d entries  %10.1f ms  %8.3f us/entry\n", count, elapsed * 1e3,
+         elapsed * 1e6 / count);
+  return elapsed / count;
+}
+
+int main(int argc, char *argv[]) {
+  static const int counts[] = {1000, 10000, 100000};
+  const char *t3keyc = "../src.util/t3keyc/t3keyc";
+  double first = 0, rate = 0;
+  char *directory;
+  int failed = 0;
+  size_t i;
+
+  if (argc > 2 || (argc == 2 && argv[1][0] == '-')) {
+    printf("Usage: bench_t3keyc [<path to t3keyc>]\n");
+    exit(EXIT_SUCCESS);
+  }
+  if (argc == 2) {
+    t3keyc = argv[1];
+  }
+
+  directory = bench_make_directory("bench_t3keyc");
+  path = bench_path(directory, TERM_NAME);
+  errors_path = bench_path(directory, "errors");
+
+  printf("%d keys per internal map\n", KEYS_PER_MAP);
+  for (i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+    rate = bench(t3keyc, counts[i], &failed);
+    if (i == 0) {
+      first = rate;
+    }
+  }
+  /* Quadratic behavior would increase the time per entry by a factor 100.
+     Allow for a factor 2 of noise. */
+  if (rate > 2 * first) {
+    printf("NOT LINEAR\n");
+    failed = 1;
+  }
+
+  bench_remove_directory(directory);
+  free(directory);
+  free(path);
+  free(errors_path);
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
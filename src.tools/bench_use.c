@@ -0,0 +1,142 @@
+/* Copyright (C) 2018 G.P. Halkes
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "bench_util.h"
+#include "t3key/key.h"
+
+/* Benchmark for loading maps with many _use inclusions from the text
+   database. A synthetic database is written to a temporary directory, which
+   is used as the user's XDG data directory, such that it takes precedence
+   over the installed databases. Three shapes of inclusion graphs are
+   generated at several sizes:
+   - deep: each map includes the next one, forming a single long chain.
+   - wide: the loaded map includes all other maps directly.
+   - dense: each map includes the next few maps, such that most inclusions
+     refer to maps which are already included.
+   Each map has a few keys, and the number of keys in the loaded map is
+   checked. */
+
+#define TERM_NAME "bench-use"
+#define KEYS_PER_MAP 4
+#define DENSE_USES 8
+
+typedef enum { DEEP, WIDE, DENSE } shape_t;
+
+static char *path;
+
+/** Write a database with @p count maps, included as described by @p shape. */
+static void write_database(shape_t shape, int count) {
+  FILE *output;
+  int i, j, k;
+
+  output = bench_create_file(path);
+  fprintf(output, "format = 1\nbest = \"m0\"\nmaps {\n");
+  for (i = 0; i < count; i++) {
+    fprintf(output, "\tm%d {\n", i);
+    for (k = 0; k < KEYS_PER_MAP; k++) {
+      fprintf(output, "\t\tf%d = \"\\e[%d;%d~\"\n", k + 1, i, k);
+    }
+    switch (shape) {
+      case DEEP:
+        if (i + 1 < count) {
+          fprintf(output, "\t\t%%_use = \"m%d\"\n", i + 1);
+        }
+        break;
+      case WIDE:
+        for (j = 1; i == 0 && j < count; j++) {
+          fprintf(output, "\t\t%%_use = \"m%d\"\n", j);
+        }
+        break;
+      case DENSE:
+        for (j = i + 1; j < count && j <= i + DENSE_USES; j++) {
+          fprintf(output, "\t\t%%_use = \"m%d\"\n", j);
+        }
+        break;
+    }
+    fprintf(output, "\t}\n");
+  }
+  fprintf(output, "}\n");
+  fclose(output);
+}
+
+static void bench(const char *name, shape_t shape, int count, int iterations) {
+  const t3_key_node_t *map, *node;
+  double start, elapsed;
+  int i, error, keys;
+
+  write_database(shape, count);
+  start = bench_now();
+  for (i = 0; i < iterations; i++) {
+    if ((map = t3_key_load_map(TERM_NAME, NULL, &error)) == NULL) {
+      fprintf(stderr, "Could not load map: %s\n", t3_key_strerror(error));
+      exit(EXIT_FAILURE);
+    }
+    for (node = map, keys = 0; node != NULL; node = node->next) {
+      keys++;
+    }
+    t3_key_free_map(map);
+    if (keys != count * KEYS_PER_MAP) {
+      fprintf(stderr, "Loaded %d keys instead of %d\n", keys, count * KEYS_PER_MAP);
+      exit(EXIT_FAILURE);
+    }
+  }
+  elapsed = (bench_now() - start) / iterations;
+  printf("  %-6s %6d maps  %10.1f us/load  %8.3f us/map\n", name, count, elapsed * 1e6,
+         elapsed * 1e6 / count);
+}
+
+int main(int argc, char *argv[]) {
+  static const int counts[] = {10, 100, 1000, 10000};
+  char *directory, *data_directory;
+  int iterations = 10;
+  size_t i;
+
+  if (argc > 2 && strcmp(argv[1], "-n") == 0) {
+    iterations = atoi(argv[2]);
+    argc -= 2;
+    argv += 2;
+  }
+  if (argc > 1 || iterations < 1) {
+    printf("Usage: bench_use [-n <iterations>]\n");
+    exit(EXIT_SUCCESS);
+  }
+
+  directory = bench_make_directory("bench_use");
+  data_directory = bench_path(directory, "libt3key");
+  if (mkdir(data_directory, 0700) != 0) {
+    perror("Could not create temporary directory");
+    exit(EXIT_FAILURE);
+  }
+  path = bench_path(data_directory, TERM_NAME);
+  setenv("XDG_DATA_HOME", directory, 1);
+
+  printf("%d iterations, %d keys per map\n", iterations, KEYS_PER_MAP);
+  for (i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+    bench("deep", DEEP, counts[i], iterations);
+    bench("wide", WIDE, counts[i], iterations);
+    bench("dense", DENSE, counts[i], iterations);
+  }
+
+  bench_remove_directory(directory);
+  free(directory);
+  free(data_directory);
+  free(path);
+  return 0;
+}
@@ -0,0 +1,77 @@
+/* Copyright (C) 2018 G.P. Halkes
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#define _XOPEN_SOURCE 700
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bench_util.h"
+
+double bench_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+char *bench_make_directory(const char *name) {
+  char *directory = bench_path("/tmp", name);
+
+  if ((directory = realloc(directory, strlen(directory) + sizeof(".XXXXXX"))) == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  strcat(directory, ".XXXXXX");
+  if (mkdtemp(directory) == NULL) {
+    perror("Could not create temporary directory");
+    exit(EXIT_FAILURE);
+  }
+  return directory;
+}
+
+static int remove_entry(const char *path, const struct stat *statbuf, int type, struct FTW *ftw) {
+  (void)statbuf;
+  (void)type;
+  (void)ftw;
+  if (remove(path) != 0) {
+    perror(path);
+  }
+  return 0;
+}
+
+void bench_remove_directory(const char *directory) {
+  nftw(directory, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+char *bench_path(const char *directory, const char *name) {
+  char *path;
+
+  if ((path = malloc(strlen(directory) + strlen(name) + 2)) == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  sprintf(path, "%s/%s", directory, name);
+  return path;
+}
+
+FILE *bench_create_file(const char *path) {
+  FILE *file;
+
+  if ((file = fopen(path, "w")) == NULL) {
+    perror(path);
+    exit(EXIT_FAILURE);
+  }
+  return file;
+}
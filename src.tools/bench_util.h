@@ -0,0 +1,42 @@
+/* Copyright (C) 2018 G.P. Halkes
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef BENCH_UTIL_H
+#define BENCH_UTIL_H
+
+#include <stdio.h>
+
+/* Helpers shared by the benchmarks. All functions which can fail print a
+   message and exit. */
+
+/** Get the time of the monotonic clock, in seconds. */
+double bench_now(void);
+
+/** Create a temporary directory for the files of a benchmark.
+    @param name The name of the benchmark, which is included in the name of the directory.
+    @return The name of the directory, allocated using @c malloc.
+*/
+char *bench_make_directory(const char *name);
+
+/** Remove a directory created by ::bench_make_directory, including all files in it. */
+void bench_remove_directory(const char *directory);
+
+/** Get the name of a file in a directory.
+    @return The name, allocated using @c malloc.
+*/
+char *bench_path(const char *directory, const char *name);
+
+/** Open a file for writing. */
+FILE *bench_create_file(const char *path);
+
+#endif
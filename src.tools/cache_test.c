@@ -0,0 +1,130 @@
+/* Copyright (C) 2018 G.P. Halkes
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <curses.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <term.h>
+
+#include "t3key/key.h"
+
+/* Test for the map cache: many threads load the same maps at the same time,
+   and must all receive the same shared map. */
+
+#define THREADS 16
+#define ITERATIONS 1000
+
+#define MAX_MAPS 16
+
+static const char *term;
+/* The best map (NULL), followed by all named maps. */
+static const char *map_names[MAX_MAPS] = {NULL};
+static size_t map_count = 1;
+
+static const t3_key_node_t *first_maps[THREADS][MAX_MAPS];
+static pthread_barrier_t barrier;
+static int failed;
+
+static void *load_maps(void *arg) {
+  size_t id = (size_t)arg, i;
+  int j, error;
+
+  pthread_barrier_wait(&barrier);
+  for (j = 0; j < ITERATIONS; j++) {
+    for (i = 0; i < map_count; i++) {
+      const t3_key_node_t *map = t3_key_load_map(term, map_names[i], &error);
+
+      if (map == NULL) {
+        fprintf(stderr, "Thread %zu: could not load map %s: %s\n", id,
+                map_names[i] == NULL ? "(best)" : map_names[i], t3_key_strerror(error));
+        failed = 1;
+        continue;
+      }
+      if (j == 0) {
+        first_maps[id][i] = map;
+        continue;
+      }
+      if (map != first_maps[id][i]) {
+        fprintf(stderr, "Thread %zu: map %s not shared\n", id,
+                map_names[i] == NULL ? "(best)" : map_names[i]);
+        failed = 1;
+      }
+      t3_key_free_map(map);
+    }
+  }
+  return NULL;
+}
+
+int main(int argc, char *argv[]) {
+  pthread_t threads[THREADS];
+  const t3_key_string_list_t *names, *name;
+  unsigned long hits, misses, expected_hits;
+  size_t i, j;
+  int error;
+
+  if (argc > 2 || (argc == 2 && strcmp(argv[1], "-h") == 0)) {
+    printf("Usage: cache_test [<terminal name>]\n");
+    exit(EXIT_SUCCESS);
+  }
+
+  term = argc == 2 ? argv[1] : "xterm";
+  setupterm(term, 1, &error);
+
+  names = t3_key_get_map_names(term, &error);
+  for (name = names; name != NULL && map_count < MAX_MAPS; name = name->next) {
+    map_names[map_count++] = name->string;
+  }
+
+  t3_key_set_map_cache(1);
+
+  pthread_barrier_init(&barrier, NULL, THREADS);
+  for (i = 0; i < THREADS; i++) {
+    if (pthread_create(&threads[i], NULL, load_maps, (void *)i) != 0) {
+      fprintf(stderr, "Could not create thread\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  for (i = 0; i < THREADS; i++) {
+    pthread_join(threads[i], NULL);
+  }
+
+  for (j = 0; j < map_count; j++) {
+    for (i = 1; i < THREADS; i++) {
+      if (first_maps[i][j] != first_maps[0][j]) {
+        fprintf(stderr, "Threads 0 and %zu received different maps\n", i);
+        failed = 1;
+      }
+    }
+  }
+
+  t3_key_get_map_cache_stats(&hits, &misses);
+  expected_hits = (unsigned long)THREADS * ITERATIONS * map_count - map_count;
+  printf("%s: %zu maps, hits %lu, misses %lu\n", term, map_count, hits, misses);
+  if (misses != map_count || hits != expected_hits) {
+    fprintf(stderr, "Unexpected number of hits/misses\n");
+    failed = 1;
+  }
+
+  t3_key_clear_map_cache();
+  for (i = 0; i < THREADS; i++) {
+    for (j = 0; j < map_count; j++) {
+      t3_key_free_map(first_maps[i][j]);
+    }
+  }
+  t3_key_free_names(names);
+
+  printf("%s\n", failed ? "FAILED" : "PASSED");
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,992 @@
+/* Copyright (C) 2018 G.P. Halkes
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <curses.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <term.h>
+#include <unistd.h>
+
+#include "t3key/decoder.h"
+
+/* Test for the input decoder. All sequences of a map are decoded one at a
+   time, and all together in a single buffer, which is also passed to the
+   decoder in chunks of different sizes. A long input with all sequences is
+   also read from a pipe. Then, random input is decoded with and without the
+   vector versions of the text scanner. Finally, all
+   sequences with xterm-style modifier parameters, mouse reports, pasted text
+   and replies from the terminal are checked. */
+
+/* A decoded event, with adjacent text events merged. */
+typedef struct {
+  const t3_key_node_t *node; /* NULL for text. */
+  char *text;
+  size_t length;
+} result_t;
+
+typedef struct {
+  result_t *results;
+  size_t used, allocated;
+} result_list_t;
+
+static const t3_key_node_t *map;
+static int failed;
+
+static void *safe_realloc(void *ptr, size_t size) {
+  if ((ptr = realloc(ptr, size)) == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  return ptr;
+}
+
+static void add_result(result_list_t *list, const t3_key_event_t *event) {
+  result_t *last = list->used > 0 ? &list->results[list->used - 1] : NULL;
+
+  if (event->type == T3_KEY_EVENT_TEXT && last != NULL && last->node == NULL) {
+    last->text = safe_realloc(last->text, last->length + event->length);
+    memcpy(last->text + last->length, event->data, event->length);
+    last->length += event->length;
+    return;
+  }
+  if (list->used == list->allocated) {
+    list->allocated = list->allocated == 0 ? 64 : list->allocated * 2;
+    list->results = safe_realloc(list->results, list->allocated * sizeof(result_t));
+  }
+  last = &list->results[list->used++];
+  last->node = event->type == T3_KEY_EVENT_KEY ? event->node : NULL;
+  last->text = safe_realloc(NULL, event->length);
+  memcpy(last->text, event->data, event->length);
+  last->length = event->length;
+}
+
+static void free_results(result_list_t *list) {
+  size_t i;
+  for (i = 0; i < list->used; i++) {
+    free(list->results[i].text);
+  }
+  free(list->results);
+  list->results = NULL;
+  list->used = list->allocated = 0;
+}
+
+/** Decode @p length bytes of @p data, passing them to the decoder in chunks of @p chunk bytes. */
+static void decode(t3_key_decoder_t *decoder, const char *data, size_t length, size_t chunk,
+                   result_list_t *list) {
+  t3_key_event_t event;
+  size_t pos;
+
+  for (pos = 0; pos < length; pos += chunk) {
+    t3_key_decoder_feed(decoder, data + pos, pos + chunk > length ? length - pos : chunk);
+    while (t3_key_decoder_next(decoder, &event)) {
+      add_result(list, &event);
+    }
+  }
+  while (t3_key_decoder_flush(decoder, &event)) {
+    add_result(list, &event);
+  }
+}
+
+/** Decode like decode, but retrieve the events with t3_key_decoder_decode in
+    batches of at most @p batch events. */
+static void decode_batch(t3_key_decoder_t *decoder, const char *data, size_t length, size_t chunk,
+                         size_t batch, result_list_t *list) {
+  t3_key_event_t events[256], event;
+  size_t pos, count, i;
+
+  for (pos = 0; pos < length; pos += chunk) {
+    const char *input = data + pos;
+
+    while ((count = t3_key_decoder_decode(decoder, input,
+                                          pos + chunk > length ? length - pos : chunk, events,
+                                          batch)) > 0) {
+      for (i = 0; i < count; i++) {
+        add_result(list, &events[i]);
+      }
+      input = NULL;
+    }
+  }
+  while (t3_key_decoder_flush(decoder, &event)) {
+    add_result(list, &event);
+  }
+}
+
+/** Decode like decode, but write the input to a pipe in chunks of @p chunk bytes, and read it with
+    t3_key_decoder_read using a new decoder. */
+static void decode_read(const char *data, size_t length, size_t chunk, result_list_t *list) {
+  t3_key_decoder_t *decoder;
+  t3_key_event_t event;
+  size_t pos;
+  int fds[2], error, result;
+
+  if ((decoder = t3_key_decoder_new(map, &error)) == NULL) {
+    fprintf(stderr, "Could not create decoder: %s\n", t3_key_strerror(error));
+    exit(EXIT_FAILURE);
+  }
+  if (pipe(fds) < 0 || fcntl(fds[0], F_SETFL, O_NONBLOCK) < 0) {
+    perror("pipe");
+    exit(EXIT_FAILURE);
+  }
+
+  for (pos = 0; pos < length; pos += chunk) {
+    if (write(fds[1], data + pos, pos + chunk > length ? length - pos : chunk) < 0) {
+      perror("write");
+      exit(EXIT_FAILURE);
+    }
+    while ((result = t3_key_decoder_read(decoder, fds[0], &event)) > 0) {
+      add_result(list, &event);
+    }
+    if (result < 0) {
+      fprintf(stderr, "Could not read input: %s\n", t3_key_strerror(result));
+      failed = 1;
+    }
+  }
+  close(fds[1]);
+  while ((result = t3_key_decoder_read(decoder, fds[0], &event)) > 0) {
+    add_result(list, &event);
+  }
+  if (result != T3_ERR_EOF) {
+    fprintf(stderr, "End of input not reported\n");
+    failed = 1;
+  }
+  while (t3_key_decoder_flush(decoder, &event)) {
+    add_result(list, &event);
+  }
+  close(fds[0]);
+  t3_key_decoder_free(decoder);
+}
+
+/* Get the first node with sequence @p string, or NULL if there is none. */
+static const t3_key_node_t *find_sequence(const char *string, size_t length) {
+  const t3_key_node_t *ptr;
+
+  for (ptr = map; ptr != NULL; ptr = ptr->next) {
+    if (ptr->key[0] != '_' && ptr->string_length == length &&
+        memcmp(ptr->string, string, length) == 0) {
+      return ptr;
+    }
+  }
+  return NULL;
+}
+
+/* Get the node which should be reported for the sequence of @p node. */
+static const t3_key_node_t *first_with_sequence(const t3_key_node_t *node) {
+  return find_sequence(node->string, node->string_length);
+}
+
+static void check_single(t3_key_decoder_t *decoder) {
+  result_list_t list = {NULL, 0, 0};
+  const t3_key_node_t *node;
+  t3_key_event_t event;
+
+  for (node = map; node != NULL; node = node->next) {
+    t3_key_match_t match;
+    int timeout;
+
+    if (node->key[0] == '_') {
+      continue;
+    }
+
+    /* A sequence which can not be extended must be returned immediately,
+       others must be kept until flushed. */
+    match = t3_key_decoder_match(decoder, node->string, node->string_length);
+    t3_key_decoder_feed(decoder, node->string, node->string_length);
+    if (t3_key_decoder_next(decoder, &event)) {
+      add_result(&list, &event);
+    }
+    timeout = t3_key_decoder_get_timeout(decoder);
+    if (match == T3_KEY_MATCH_COMPLETE
+            ? list.used != 1 || t3_key_decoder_get_pending(decoder, NULL) != T3_KEY_MATCH_NONE ||
+                  timeout != -1
+            : match != T3_KEY_MATCH_AMBIGUOUS || list.used != 0 ||
+                  t3_key_decoder_get_pending(decoder, NULL) != T3_KEY_MATCH_AMBIGUOUS ||
+                  timeout < 0 || timeout > T3_KEY_DEFAULT_TIMEOUT) {
+      fprintf(stderr, "Sequence of %s not matched correctly\n", node->key);
+      failed = 1;
+    }
+    while (t3_key_decoder_flush(decoder, &event)) {
+      add_result(&list, &event);
+    }
+
+    if (list.used != 1 || list.results[0].node != first_with_sequence(node)) {
+      fprintf(stderr, "Sequence of %s not decoded correctly\n", node->key);
+      failed = 1;
+    }
+    free_results(&list);
+  }
+}
+
+/* Check that a strict prefix of a sequence is reported as such, and that its
+   deadline is honoured. */
+static void check_prefix(t3_key_decoder_t *decoder) {
+  const t3_key_node_t *node;
+  t3_key_event_t event;
+
+  for (node = map; node != NULL; node = node->next) {
+    if (node->key[0] != '_' && node->string_length > 1 &&
+        t3_key_decoder_match(decoder, node->string, node->string_length - 1) ==
+            T3_KEY_MATCH_PREFIX) {
+      break;
+    }
+  }
+  if (node == NULL) {
+    return;
+  }
+
+  t3_key_decoder_set_timeout(decoder, 0);
+  t3_key_decoder_feed(decoder, node->string, node->string_length - 1);
+  if (t3_key_decoder_next(decoder, &event) ||
+      t3_key_decoder_get_pending(decoder, NULL) != T3_KEY_MATCH_PREFIX ||
+      t3_key_decoder_get_timeout(decoder) != 0) {
+    fprintf(stderr, "Prefix of %s not kept correctly\n", node->key);
+    failed = 1;
+  }
+  t3_key_decoder_feed(decoder, node->string + node->string_length - 1, 1);
+  if (!t3_key_decoder_next(decoder, &event) || event.node != first_with_sequence(node) ||
+      t3_key_decoder_get_timeout(decoder) != -1) {
+    fprintf(stderr, "Sequence of %s not completed correctly\n", node->key);
+    failed = 1;
+  }
+  while (t3_key_decoder_flush(decoder, &event)) {
+  }
+  t3_key_decoder_set_timeout(decoder, T3_KEY_DEFAULT_TIMEOUT);
+}
+
+static int compare_results(const result_list_t *a, const result_list_t *b) {
+  size_t i;
+
+  if (a->used != b->used) {
+    return 0;
+  }
+  for (i = 0; i < a->used; i++) {
+    if (a->results[i].node != b->results[i].node || a->results[i].length != b->results[i].length ||
+        memcmp(a->results[i].text, b->results[i].text, a->results[i].length) != 0) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/* Check that the events of a batch stay valid when bytes kept from previous
+   input are decoded and new bytes are kept in the same batch. */
+static void check_batch(t3_key_decoder_t *decoder) {
+  result_list_t expected = {NULL, 0, 0}, list = {NULL, 0, 0};
+  const t3_key_node_t *node;
+  char *buffer = NULL;
+  size_t length = 0, chunk;
+
+  /* The starts of all sequences, each interrupted by a character which
+     prevents it from being completed. */
+  for (node = map; node != NULL; node = node->next) {
+    if (node->key[0] == '_' || node->string_length < 2) {
+      continue;
+    }
+    buffer = safe_realloc(buffer, length + node->string_length);
+    memcpy(buffer + length, node->string, node->string_length - 1);
+    length += node->string_length - 1;
+    buffer[length++] = '\001';
+  }
+
+  decode(decoder, buffer, length, length, &expected);
+  for (chunk = 1; chunk <= 64; chunk++) {
+    decode_batch(decoder, buffer, length, chunk, 256, &list);
+    if (!compare_results(&expected, &list)) {
+      fprintf(stderr, "Kept bytes not decoded correctly in batches with chunk size %zu\n", chunk);
+      failed = 1;
+    }
+    free_results(&list);
+  }
+  free_results(&expected);
+  free(buffer);
+}
+
+static void check_combined(t3_key_decoder_t *decoder) {
+  static const size_t chunks[] = {1, 2, 3, 7, 64, 4096};
+  static const size_t batches[] = {1, 5, 256};
+  result_list_t expected = {NULL, 0, 0}, list = {NULL, 0, 0};
+  const t3_key_node_t *node;
+  char used[256], separator;
+  char *buffer = NULL;
+  size_t length = 0, i, j;
+
+  /* Separate the sequences by a character which does not occur in any
+     sequence, such that sequences can not combine into other sequences. */
+  memset(used, 0, sizeof(used));
+  for (node = map; node != NULL; node = node->next) {
+    for (i = 0; i < node->string_length; i++) {
+      used[(unsigned char)node->string[i]] = 1;
+    }
+  }
+  for (separator = ' '; separator < '~' && used[(unsigned char)separator]; separator++) {
+  }
+
+  for (node = map; node != NULL; node = node->next) {
+    t3_key_event_t event;
+
+    if (node->key[0] == '_') {
+      continue;
+    }
+    buffer = safe_realloc(buffer, length + node->string_length + 1);
+    memcpy(buffer + length, node->string, node->string_length);
+    buffer[length + node->string_length] = separator;
+    length += node->string_length + 1;
+
+    event.type = T3_KEY_EVENT_KEY;
+    event.node = first_with_sequence(node);
+    event.data = node->string;
+    event.length = node->string_length;
+    add_result(&expected, &event);
+    event.type = T3_KEY_EVENT_TEXT;
+    event.data = &separator;
+    event.length = 1;
+    add_result(&expected, &event);
+  }
+
+  for (i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++) {
+    decode(decoder, buffer, length, chunks[i], &list);
+    if (!compare_results(&expected, &list)) {
+      fprintf(stderr, "Combined sequences not decoded correctly with chunk size %zu\n", chunks[i]);
+      failed = 1;
+    }
+    free_results(&list);
+
+    for (j = 0; j < sizeof(batches) / sizeof(batches[0]); j++) {
+      decode_batch(decoder, buffer, length, chunks[i], batches[j], &list);
+      if (!compare_results(&expected, &list)) {
+        fprintf(stderr,
+                "Combined sequences not decoded correctly with chunk size %zu in batches of %zu\n",
+                chunks[i], batches[j]);
+        failed = 1;
+      }
+      free_results(&list);
+    }
+  }
+  free_results(&expected);
+  free(buffer);
+}
+
+/* Check that reading input from a file descriptor gives the same events as
+   passing it to the decoder. The input is several times larger than the ring
+   buffer of the decoder, such that sequences and kept bytes wrap around at
+   all positions. */
+static void check_read(t3_key_decoder_t *decoder) {
+  static const size_t chunks[] = {1, 7, 64, 4096, 65536};
+  static const char text[] = "text with \xe2\x82\xac sign\r";
+  result_list_t expected = {NULL, 0, 0}, list = {NULL, 0, 0};
+  const t3_key_node_t *node;
+  char *buffer = NULL;
+  size_t length = 0, count = 0, i;
+
+  while (length < 4 * 65536) {
+    for (node = map; node != NULL; node = node->next, count++) {
+      if (node->key[0] == '_') {
+        continue;
+      }
+      buffer = safe_realloc(buffer, length + node->string_length + sizeof(text));
+      memcpy(buffer + length, node->string, node->string_length);
+      length += node->string_length;
+      /* Vary the amount of text, to shift the following sequences. */
+      memcpy(buffer + length, text, count % sizeof(text));
+      length += count % sizeof(text);
+    }
+  }
+
+  decode(decoder, buffer, length, length, &expected);
+  for (i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++) {
+    decode_read(buffer, length, chunks[i], &list);
+    if (!compare_results(&expected, &list)) {
+      fprintf(stderr, "Input from a file descriptor not decoded correctly with chunk size %zu\n",
+              chunks[i]);
+      failed = 1;
+    }
+    free_results(&list);
+  }
+  free_results(&expected);
+  free(buffer);
+}
+
+/* Check that the vector versions of the text scanner split random input in
+   the same way as the scalar version. The input mostly consists of printable
+   characters, with the occasional sequence or control character, such that
+   both long and short runs of text are scanned. */
+static void check_scan(t3_key_decoder_t *decoder) {
+  static const size_t chunks[] = {1, 31, 4096, 65536};
+  result_list_t expected = {NULL, 0, 0}, list = {NULL, 0, 0};
+  const t3_key_node_t *node;
+  size_t length = 65536, pos, i;
+  char *buffer;
+
+  buffer = safe_realloc(NULL, length);
+  srand(1);
+  for (pos = 0; pos < length; pos++) {
+    int r = rand() % 1024;
+    if (r == 0) {
+      buffer[pos] = rand() % 0x20;
+    } else if (r == 1) {
+      buffer[pos] = 0x7f;
+    } else if (r < 4) {
+      for (node = map; node != NULL && rand() % 8 != 0; node = node->next) {
+      }
+      if (node != NULL && node->string_length > 0 && pos + node->string_length <= length) {
+        memcpy(buffer + pos, node->string, node->string_length);
+        pos += node->string_length - 1;
+        continue;
+      }
+      buffer[pos] = ' ';
+    } else if (r < 64) {
+      buffer[pos] = 0x80 + rand() % 0x80;
+    } else {
+      buffer[pos] = ' ' + rand() % 0x5f;
+    }
+  }
+
+  t3_key_decoder_set_flags(decoder, T3_KEY_DECODER_NO_SIMD);
+  decode(decoder, buffer, length, length, &expected);
+  t3_key_decoder_set_flags(decoder, 0);
+  for (i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++) {
+    decode(decoder, buffer, length, chunks[i], &list);
+    if (!compare_results(&expected, &list)) {
+      fprintf(stderr, "Random input not decoded correctly with chunk size %zu\n", chunks[i]);
+      failed = 1;
+    }
+    free_results(&list);
+  }
+  free_results(&expected);
+  free(buffer);
+}
+
+/* Decode @p string one byte at a time, and store the first event in @p event.
+   Returns the number of events. */
+static int decode_single(t3_key_decoder_t *decoder, const char *string, t3_key_event_t *event) {
+  t3_key_event_t next;
+  size_t i, length = strlen(string);
+  int count = 0;
+
+  for (i = 0; i < length; i++) {
+    t3_key_decoder_feed(decoder, string + i, 1);
+    while (t3_key_decoder_next(decoder, &next)) {
+      if (count++ == 0) {
+        *event = next;
+      }
+    }
+  }
+  while (t3_key_decoder_flush(decoder, &next)) {
+    if (count++ == 0) {
+      *event = next;
+    }
+  }
+  return count;
+}
+
+/* Check the key decoded from a sequence with modifier parameter @p mod, for
+   the key without modifiers @p base. */
+static void check_csi_key(t3_key_decoder_t *decoder, const t3_key_node_t *base,
+                          const char *sequence, int mod) {
+  const t3_key_node_t *listed = find_sequence(sequence, strlen(sequence)), *expected_node;
+  t3_key_event_t event;
+  t3_key_id_t id;
+  int modifiers;
+
+  id = t3_key_get_node_id(base, NULL);
+  modifiers = ((mod - 1) & 1 ? T3_KEY_MOD_SHIFT : 0) | ((mod - 1) & 10 ? T3_KEY_MOD_META : 0) |
+              ((mod - 1) & 4 ? T3_KEY_MOD_CTRL : 0);
+  expected_node = listed != NULL ? listed : t3_key_lookup(map, id, modifiers);
+
+  if (listed != NULL) {
+    int listed_modifiers;
+    if (t3_key_get_node_id(listed, &listed_modifiers) != id || listed_modifiers != modifiers) {
+      /* The map deviates from the xterm scheme. The listed key is used. */
+      return;
+    }
+  }
+  if (decode_single(decoder, sequence, &event) != 1 || event.type != T3_KEY_EVENT_KEY ||
+      event.id != id || event.modifiers != modifiers || event.node != expected_node) {
+    fprintf(stderr, "Modifier parameter %d for %s not decoded correctly\n", mod, base->key);
+    failed = 1;
+  }
+}
+
+/* Check the decoding of sequences with xterm-style modifier parameters, both
+   for the combinations listed in the map and for the ones not listed. */
+static void check_csi(t3_key_decoder_t *decoder) {
+  const t3_key_node_t *base;
+  t3_key_event_t event;
+  char sequence[32];
+  int has_base = 0, final, number, mod, modifiers;
+
+  for (final = 0x40; final < 0x7f; final++) {
+    sprintf(sequence, "\033[%c", final);
+    if ((base = find_sequence(sequence, 3)) == NULL) {
+      sequence[1] = 'O';
+      base = find_sequence(sequence, 3);
+    }
+    if (final == '~' || base == NULL || t3_key_get_node_id(base, &modifiers) == T3_KEY_ID_NONE ||
+        modifiers != 0) {
+      continue;
+    }
+    has_base = 1;
+    for (mod = 1; mod <= 16; mod++) {
+      sprintf(sequence, "\033[1;%d%c", mod, final);
+      check_csi_key(decoder, base, sequence, mod);
+    }
+  }
+
+  for (number = 1; number < 64; number++) {
+    sprintf(sequence, "\033[%d~", number);
+    if ((base = find_sequence(sequence, strlen(sequence))) == NULL ||
+        t3_key_get_node_id(base, &modifiers) == T3_KEY_ID_NONE || modifiers != 0) {
+      continue;
+    }
+    has_base = 1;
+    for (mod = 1; mod <= 16; mod++) {
+      sprintf(sequence, "\033[%d;%d~", number, mod);
+      check_csi_key(decoder, base, sequence, mod);
+    }
+  }
+
+  if (!has_base) {
+    return;
+  }
+  if (decode_single(decoder, "\033[27;5;97~", &event) != 1 || event.type != T3_KEY_EVENT_CHAR ||
+      event.character != 'a' || event.modifiers != T3_KEY_MOD_CTRL ||
+      decode_single(decoder, "\033[27;2;9~", &event) != 1 || event.type != T3_KEY_EVENT_KEY ||
+      event.id != T3_KEY_ID_TAB || event.modifiers != T3_KEY_MOD_SHIFT ||
+      decode_single(decoder, "\033[1;17A", &event) == 1) {
+    fprintf(stderr, "modifyOtherKeys sequences not decoded correctly\n");
+    failed = 1;
+  }
+  t3_key_decoder_set_flags(decoder, T3_KEY_DECODER_NO_CSI_MODIFIERS);
+  if (decode_single(decoder, "\033[27;5;97~", &event) == 1) {
+    fprintf(stderr, "Modifier parameters decoded while disabled\n");
+    failed = 1;
+  }
+  t3_key_decoder_set_flags(decoder, 0);
+}
+
+typedef struct {
+  const char *report;
+  int flags;
+  t3_key_mouse_t expected;
+} mouse_test_t;
+
+/* Check the parsing of mouse reports in all encodings, both directly and
+   through the decoder if the map has the _xterm_mouse node. */
+static void check_mouse(t3_key_decoder_t *decoder) {
+  static const mouse_test_t tests[] = {
+      {"\033[M !!", 0, {T3_KEY_MOUSE_PRESS, 1, 0, 0, 0}},
+      {"\033[M#\377\377", 0, {T3_KEY_MOUSE_RELEASE, 0, 222, 222, 0}},
+      {"\033[M@\000+", 0, {T3_KEY_MOUSE_MOTION, 1, -1, 10, 0}},
+      {"\033[Ma!!", 0, {T3_KEY_MOUSE_PRESS, 5, 0, 0, 0}},
+      {"\033[M6!!", 0, {T3_KEY_MOUSE_PRESS, 3, 0, 0, T3_KEY_MOD_SHIFT | T3_KEY_MOD_CTRL}},
+      {"\033[M \304\254\337\277", T3_KEY_DECODER_MOUSE_UTF8,
+       {T3_KEY_MOUSE_PRESS, 1, 267, 2014, 0}},
+      {"\033[M(x!", T3_KEY_DECODER_MOUSE_UTF8, {T3_KEY_MOUSE_PRESS, 1, 87, 0, T3_KEY_MOD_META}},
+      {"\033[32;300;1000M", 0, {T3_KEY_MOUSE_PRESS, 1, 299, 999, 0}},
+      {"\033[35;12;8M", 0, {T3_KEY_MOUSE_RELEASE, 0, 11, 7, 0}},
+      {"\033[<0;1;1M", 0, {T3_KEY_MOUSE_PRESS, 1, 0, 0, 0}},
+      {"\033[<2;5000;70m", 0, {T3_KEY_MOUSE_RELEASE, 3, 4999, 69, 0}},
+      {"\033[<35;224;225M", 0, {T3_KEY_MOUSE_MOTION, 0, 223, 224, 0}},
+      {"\033[<65;3;4M", 0, {T3_KEY_MOUSE_PRESS, 5, 2, 3, 0}},
+      {"\033[<128;3;4M", 0, {T3_KEY_MOUSE_PRESS, 8, 2, 3, 0}},
+      {"\033[<28;3;4M", 0,
+       {T3_KEY_MOUSE_PRESS, 1, 2, 3, T3_KEY_MOD_SHIFT | T3_KEY_MOD_META | T3_KEY_MOD_CTRL}},
+  };
+  static const char *const invalid[] = {"\033[A",          "\033[1;5A", "\033[<0;1;1A",
+                                        "\033[<0;;1M",     "\033[M\037!!", "\033[<1000000;1;1M",
+                                        "\033[<0;1;1;1M", "x"};
+  t3_key_mouse_t mouse;
+  t3_key_event_t event;
+  size_t i, j, length;
+
+  for (i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+    const t3_key_mouse_t *expected = &tests[i].expected;
+    /* The reports with a NUL byte are not NUL terminated. */
+    length = tests[i].report[4] == 0 ? 6 : strlen(tests[i].report);
+
+    for (j = 0; j < length; j++) {
+      if (t3_key_parse_mouse(tests[i].report, j, tests[i].flags, &mouse) != 0) {
+        fprintf(stderr, "Prefix of mouse report %zu not recognized\n", i);
+        failed = 1;
+      }
+    }
+    if (t3_key_parse_mouse(tests[i].report, length, tests[i].flags, &mouse) != (int)length ||
+        memcmp(&mouse, expected, sizeof(mouse)) != 0) {
+      fprintf(stderr, "Mouse report %zu not parsed correctly\n", i);
+      failed = 1;
+    }
+
+    if (t3_key_decoder_match(decoder, "\033[M", 3) == T3_KEY_MATCH_NONE) {
+      continue;
+    }
+    t3_key_decoder_set_flags(decoder, tests[i].flags);
+    for (j = 0; j < length; j++) {
+      t3_key_decoder_feed(decoder, tests[i].report + j, 1);
+      if (t3_key_decoder_next(decoder, &event) != (j == length - 1) ||
+          (j == length - 1 &&
+           (event.type != T3_KEY_EVENT_MOUSE || event.length != length ||
+            memcmp(event.data, tests[i].report, length) != 0 ||
+            memcmp(&event.mouse, expected, sizeof(mouse)) != 0))) {
+        fprintf(stderr, "Mouse report %zu not decoded correctly\n", i);
+        failed = 1;
+        break;
+      }
+    }
+    while (t3_key_decoder_flush(decoder, &event)) {
+    }
+    t3_key_decoder_set_flags(decoder, 0);
+  }
+
+  for (i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+    if (t3_key_parse_mouse(invalid[i], strlen(invalid[i]), 0, &mouse) != -1) {
+      fprintf(stderr, "Invalid mouse report %zu accepted\n", i);
+      failed = 1;
+    }
+  }
+}
+
+/* Check that a mouse report with a very long parameter is not waited for,
+   both when passed in a single buffer and when read from a pipe. The value
+   of the parameter is 0, so only its length makes it invalid. */
+static void check_long_mouse(t3_key_decoder_t *decoder) {
+  static const size_t length = 100000;
+  result_list_t list = {NULL, 0, 0};
+  t3_key_event_t event;
+  size_t i, total;
+  char *input;
+
+  if (t3_key_decoder_match(decoder, "\033[<", 3) == T3_KEY_MATCH_NONE) {
+    return;
+  }
+  input = safe_realloc(NULL, length);
+  memcpy(input, "\033[<", 3);
+  memset(input + 3, '0', length - 3);
+
+  decode(decoder, input, length, length, &list);
+  for (i = 0, total = 0; i < list.used; i++) {
+    total += list.results[i].length;
+  }
+  t3_key_decoder_feed(decoder, input, 3 + T3_KEY_MOUSE_MAX_LENGTH);
+  if (total != length ||
+      (t3_key_decoder_next(decoder, &event) && event.type == T3_KEY_EVENT_MOUSE)) {
+    fprintf(stderr, "Long mouse report not rejected\n");
+    failed = 1;
+  }
+  while (t3_key_decoder_flush(decoder, &event)) {
+  }
+  free_results(&list);
+
+  decode_read(input, length, 4096, &list);
+  for (i = 0, total = 0; i < list.used; i++) {
+    total += list.results[i].length;
+  }
+  if (total != length) {
+    fprintf(stderr, "Long mouse report not rejected when reading\n");
+    failed = 1;
+  }
+  free_results(&list);
+  free(input);
+}
+
+/* Decode @p input in chunks of @p chunk bytes, and store the events in
+   @p output, each followed by a '|'. */
+static void decode_events(t3_key_decoder_t *decoder, const char *input, size_t chunk,
+                          char *output) {
+  t3_key_event_t event;
+  size_t length = strlen(input), pos;
+
+  *output = 0;
+  for (pos = 0; pos < length; pos += chunk) {
+    t3_key_decoder_feed(decoder, input + pos, pos + chunk > length ? length - pos : chunk);
+    while (t3_key_decoder_next(decoder, &event)) {
+      strncat(output, event.data, event.length);
+      strcat(output, "|");
+    }
+  }
+}
+
+/* Check that only consecutive motion reports with the same buttons and
+   modifiers are coalesced, and only if enabled. */
+static void check_coalesce(t3_key_decoder_t *decoder) {
+  static const char input[] =
+      "\033[<32;1;1M\033[<32;2;1M\033[<35;3;1M\033[<35;4;1M\033[<0;4;1M\033[<32;5;1M"
+      "\033[<36;6;1Mx\033[<35;7;1M\033[<35;8;1M";
+  static const char coalesced[] =
+      "\033[<32;2;1M|\033[<35;4;1M|\033[<0;4;1M|\033[<32;5;1M|\033[<36;6;1M|x|\033[<35;8;1M|";
+  char output[512];
+
+  if (t3_key_decoder_match(decoder, "\033[<", 3) == T3_KEY_MATCH_NONE) {
+    return;
+  }
+  t3_key_decoder_set_flags(decoder, T3_KEY_DECODER_COALESCE_MOTION);
+  decode_events(decoder, input, sizeof(input), output);
+  if (strcmp(output, coalesced) != 0 || t3_key_decoder_get_coalesced(decoder) != 3) {
+    fprintf(stderr, "Motion reports not coalesced correctly\n");
+    failed = 1;
+  }
+  /* Reports which are not available yet are not waited for. */
+  decode_events(decoder, input, 1, output);
+  if (strlen(output) != sizeof(input) - 1 + 10 || t3_key_decoder_get_coalesced(decoder) != 3) {
+    fprintf(stderr, "Motion reports coalesced with later input\n");
+    failed = 1;
+  }
+  t3_key_decoder_set_flags(decoder, 0);
+  decode_events(decoder, input, sizeof(input), output);
+  if (strlen(output) != sizeof(input) - 1 + 10 || t3_key_decoder_get_coalesced(decoder) != 3) {
+    fprintf(stderr, "Motion reports coalesced while disabled\n");
+    failed = 1;
+  }
+}
+
+/* Check that pasted text is returned unchanged, without decoding any
+   sequences, for all ways to split the input. */
+static void check_paste(t3_key_decoder_t *decoder) {
+  static const char payload[] = "x\033[Ay\033\033[201z\r\033[20";
+  char input[256], pasted[256];
+  const t3_key_node_t *key;
+  t3_key_event_t event;
+  size_t chunk, pos, length, pasted_length;
+  int starts, ends, others;
+
+  /* Include a sequence from the map in the pasted text. */
+  for (key = map; key != NULL && (key->key[0] == '_' || key->string_length == 0);
+       key = key->next) {
+  }
+  sprintf(input, "a\033[200~%s%.*s\033[201~b", payload,
+          key != NULL && key->string_length < 100 ? (int)key->string_length : 0,
+          key != NULL ? key->string : "");
+  length = strlen(input);
+
+  for (chunk = 1; chunk <= length; chunk++) {
+    pasted_length = 0;
+    starts = ends = others = 0;
+    for (pos = 0; pos < length; pos += chunk) {
+      t3_key_decoder_feed(decoder, input + pos, pos + chunk > length ? length - pos : chunk);
+      while (t3_key_decoder_next(decoder, &event)) {
+        if (event.type == T3_KEY_EVENT_PASTE) {
+          memcpy(pasted + pasted_length, event.data, event.length);
+          pasted_length += event.length;
+        } else if (event.type == T3_KEY_EVENT_PASTE_START) {
+          starts += pasted_length == 0 && others == 1;
+        } else if (event.type == T3_KEY_EVENT_PASTE_END) {
+          ends++;
+        } else {
+          others++;
+        }
+      }
+    }
+    while (t3_key_decoder_flush(decoder, &event)) {
+      others++;
+    }
+    if (starts != 1 || ends != 1 || others != 2 || pasted_length != length - 14 ||
+        memcmp(pasted, input + 7, pasted_length) != 0) {
+      fprintf(stderr, "Pasted text not decoded correctly in chunks of %zu bytes\n", chunk);
+      failed = 1;
+      return;
+    }
+  }
+}
+
+typedef struct {
+  const char *input;
+  t3_key_event_type_t type;
+  int param_count;
+  int params[3];
+  const char *string;
+} reply_test_t;
+
+/* Check the decoding of replies from the terminal, and that they do not
+   interfere with the keys around them. */
+static void check_replies(t3_key_decoder_t *decoder) {
+  static const reply_test_t tests[] = {
+      {"\033[12;80R", T3_KEY_EVENT_CURSOR_POSITION, 2, {12, 80}, NULL},
+      {"\033[?64;1;22c", T3_KEY_EVENT_PRIMARY_DA, 3, {64, 1, 22}, NULL},
+      {"\033[?c", T3_KEY_EVENT_PRIMARY_DA, 0, {0}, NULL},
+      {"\033[>41;;0c", T3_KEY_EVENT_SECONDARY_DA, 3, {41, 0, 0}, NULL},
+      {"\033[I", T3_KEY_EVENT_FOCUS_IN, 0, {0}, NULL},
+      {"\033[O", T3_KEY_EVENT_FOCUS_OUT, 0, {0}, NULL},
+      {"\033]11;rgb:ffff/ffff/dddd\033\\", T3_KEY_EVENT_OSC, 1, {11}, "11;rgb:ffff/ffff/dddd"},
+      {"\033]lwindow title\a", T3_KEY_EVENT_OSC, 0, {0}, "lwindow title"},
+  };
+  const t3_key_node_t *key;
+  t3_key_event_t event;
+  char input[512];
+  size_t i;
+
+  for (i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+    const reply_test_t *test = &tests[i];
+    size_t length = strlen(test->input);
+    int count = decode_single(decoder, test->input, &event);
+
+    if (count != 1 || event.type != test->type || event.length != length ||
+        event.reply.param_count != test->param_count ||
+        memcmp(event.reply.params, test->params, test->param_count * sizeof(int)) != 0 ||
+        (test->string != NULL && (event.reply.string_length != strlen(test->string) ||
+                                  memcmp(event.reply.string, test->string,
+                                         event.reply.string_length) != 0))) {
+      fprintf(stderr, "Reply %zu not decoded correctly\n", i);
+      failed = 1;
+    }
+  }
+
+  /* A reply between keys, passed in a single buffer. */
+  for (key = map; key != NULL && (key->key[0] == '_' || key->string_length == 0 ||
+                                  key->string_length > 100 || key->string[0] != '\033');
+       key = key->next) {
+  }
+  if (key != NULL) {
+    sprintf(input, "%.*s\033[?1;2cx%.*s", (int)key->string_length, key->string,
+            (int)key->string_length, key->string);
+    t3_key_decoder_feed(decoder, input, strlen(input));
+    if (!t3_key_decoder_next(decoder, &event) || event.type != T3_KEY_EVENT_KEY ||
+        event.node != first_with_sequence(key) || !t3_key_decoder_next(decoder, &event) ||
+        event.type != T3_KEY_EVENT_PRIMARY_DA || !t3_key_decoder_next(decoder, &event) ||
+        event.type != T3_KEY_EVENT_TEXT || !t3_key_decoder_next(decoder, &event) ||
+        event.type != T3_KEY_EVENT_KEY || t3_key_decoder_next(decoder, &event)) {
+      fprintf(stderr, "Reply between keys not decoded correctly\n");
+      failed = 1;
+    }
+    while (t3_key_decoder_flush(decoder, &event)) {
+    }
+  }
+
+  /* The cursor position report which is also shift-F3. */
+  if ((key = find_sequence("\033[1;2R", 6)) != NULL ||
+      t3_key_decoder_match(decoder, "\033[1;2R", 6) != T3_KEY_MATCH_NONE) {
+    if (decode_single(decoder, "\033[1;2R", &event) != 1 || event.type != T3_KEY_EVENT_KEY) {
+      fprintf(stderr, "Key decoded as cursor position report\n");
+      failed = 1;
+    }
+    t3_key_decoder_set_flags(decoder, T3_KEY_DECODER_CURSOR_REPORT);
+    if (decode_single(decoder, "\033[1;2R", &event) != 1 ||
+        event.type != T3_KEY_EVENT_CURSOR_POSITION || event.reply.params[1] != 2) {
+      fprintf(stderr, "Expected cursor position report not decoded correctly\n");
+      failed = 1;
+    }
+    t3_key_decoder_set_flags(decoder, 0);
+  }
+
+  /* Replies beyond the limits are not recognized. */
+  t3_key_decoder_set_limits(decoder, 9, 2);
+  if (decode_single(decoder, "\033[12;80R", &event) != 1 ||
+      event.type != T3_KEY_EVENT_CURSOR_POSITION ||
+      (decode_single(decoder, "\033[1234;80R", &event) >= 1 &&
+       event.type == T3_KEY_EVENT_CURSOR_POSITION) ||
+      (decode_single(decoder, "\033[?1;2;3c", &event) >= 1 &&
+       event.type == T3_KEY_EVENT_PRIMARY_DA) ||
+      (decode_single(decoder, "\033]0;title\a", &event) >= 1 && event.type == T3_KEY_EVENT_OSC)) {
+    fprintf(stderr, "Reply limits not applied correctly\n");
+    failed = 1;
+  }
+  t3_key_decoder_set_limits(decoder, SIZE_MAX, 0);
+
+  /* The limit includes the terminator of an OSC reply. */
+  memset(input, 'x', T3_KEY_REPLY_MAX_LENGTH + 1);
+  memcpy(input, "\033]", 2);
+  memcpy(input + T3_KEY_REPLY_MAX_LENGTH - 2, "\033\\", 3);
+  if (decode_single(decoder, input, &event) != 1 || event.type != T3_KEY_EVENT_OSC ||
+      event.length != T3_KEY_REPLY_MAX_LENGTH) {
+    fprintf(stderr, "OSC reply of the maximum length not decoded correctly\n");
+    failed = 1;
+  }
+  memcpy(input + T3_KEY_REPLY_MAX_LENGTH - 2, "x\033\\", 4);
+  if (decode_single(decoder, input, &event) >= 1 && event.type == T3_KEY_EVENT_OSC) {
+    fprintf(stderr, "OSC reply longer than the maximum length decoded\n");
+    failed = 1;
+  }
+}
+
+/* Check that the decoder never keeps as many bytes as the length limit, for
+   sequences of each type with long runs of leading zeros or parameters, and
+   that all bytes are returned. */
+static void check_limits(t3_key_decoder_t *decoder) {
+  static const char *const patterns[] = {"\033[<%s0;1;1M", "\033[%s1;5A", "\033[?%s1c",
+                                         "\033]%s\a"};
+  static const size_t limits[] = {6, 16, 64, SIZE_MAX};
+  char padding[301], input[400];
+  t3_key_event_t event;
+  size_t i, j, pos, decoded, length;
+
+  memset(padding, '0', sizeof(padding) - 1);
+  padding[sizeof(padding) - 1] = 0;
+  for (i = 0; i < sizeof(limits) / sizeof(limits[0]); i++) {
+    t3_key_decoder_set_limits(decoder, limits[i], 0);
+    for (j = 0; j < sizeof(patterns) / sizeof(patterns[0]); j++) {
+      sprintf(input, patterns[j], padding);
+      length = strlen(input);
+      for (pos = 0, decoded = 0; pos < length; pos++) {
+        t3_key_decoder_feed(decoder, input + pos, 1);
+        while (t3_key_decoder_next(decoder, &event)) {
+          decoded += event.length;
+        }
+        if (pos + 1 - decoded >= limits[i]) {
+          fprintf(stderr, "Pattern %zu kept %zu bytes with limit %zu\n", j, pos + 1 - decoded,
+                  limits[i]);
+          failed = 1;
+          break;
+        }
+      }
+      while (t3_key_decoder_flush(decoder, &event)) {
+        decoded += event.length;
+      }
+      if (pos == length && decoded != length) {
+        fprintf(stderr, "Pattern %zu lost bytes with limit %zu\n", j, limits[i]);
+        failed = 1;
+      }
+    }
+  }
+  t3_key_decoder_set_limits(decoder, SIZE_MAX, 0);
+}
+
+int main(int argc, char *argv[]) {
+  t3_key_decoder_t *decoder;
+  const char *term;
+  int error;
+
+  if (argc > 2 || (argc == 2 && strcmp(argv[1], "-h") == 0)) {
+    printf("Usage: decoder_test [<terminal name>]\n");
+    exit(EXIT_SUCCESS);
+  }
+
+  term = argc == 2 ? argv[1] : "xterm";
+  setupterm(term, 1, &error);
+  if ((map = t3_key_load_map(term, NULL, &error)) == NULL) {
+    fprintf(stderr, "Could not load map for %s: %s\n", term, t3_key_strerror(error));
+    exit(EXIT_FAILURE);
+  }
+  if ((decoder = t3_key_decoder_new(map, &error)) == NULL) {
+    fprintf(stderr, "Could not create decoder: %s\n", t3_key_strerror(error));
+    exit(EXIT_FAILURE);
+  }
+
+  check_single(decoder);
+  check_prefix(decoder);
+  check_combined(decoder);
+  check_batch(decoder);
+  check_read(decoder);
+  check_scan(decoder);
+  check_csi(decoder);
+  check_mouse(decoder);
+  check_long_mouse(decoder);
+  check_coalesce(decoder);
+  check_paste(decoder);
+  check_replies(decoder);
+  check_limits(decoder);
+
+  t3_key_decoder_free(decoder);
+  t3_key_free_map(map);
+  printf("%s: %s\n", term, failed ? "FAILED" : "PASSED");
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
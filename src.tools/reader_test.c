@@ -0,0 +1,286 @@
+/* Copyright (C) 2018 G.P. Halkes
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#define _XOPEN_SOURCE 600
+#include <curses.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <term.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "t3key/reader.h"
+
+/* Test for the input reader, using a pseudo terminal. Each sequence of a map
+   is written to the pseudo terminal separately, and the time until the reader
+   thread read it and until the program received the event is measured.
+   Sequences which are the start of longer sequences must be delivered after
+   the timeout, without any action from the program. Then, large amounts of
+   input are written at once, to check the splitting of text, that replies are
+   not split and the handling of a full queue. Finally, closing the pseudo
+   terminal must stop the reader thread. */
+
+static const t3_key_node_t *map;
+static int failed;
+
+static long long elapsed_us(const struct timespec *start, const struct timespec *end) {
+  return (long long)(end->tv_sec - start->tv_sec) * 1000000 +
+         (end->tv_nsec - start->tv_nsec) / 1000;
+}
+
+static int compare_long_long(const void *a, const void *b) {
+  long long value_a = *(const long long *)a, value_b = *(const long long *)b;
+  return value_a < value_b ? -1 : value_a > value_b;
+}
+
+static void report(const char *name, long long *values, size_t count) {
+  if (count == 0) {
+    return;
+  }
+  qsort(values, count, sizeof(long long), compare_long_long);
+  printf("  %-9s median %6lld us  p99 %6lld us  max %6lld us\n", name, values[count / 2],
+         values[count * 99 / 100], values[count - 1]);
+}
+
+/* Wait at most @p timeout milliseconds for the next event. */
+static int wait_event(t3_key_reader_t *reader, t3_key_reader_event_t *event, int timeout) {
+  struct pollfd fds;
+
+  fds.fd = t3_key_reader_get_fd(reader);
+  fds.events = POLLIN;
+  while (!t3_key_reader_next(reader, event)) {
+    if (poll(&fds, 1, timeout) <= 0) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static void write_all(int fd, const char *data, size_t length) {
+  ssize_t result;
+
+  for (; length > 0; data += result, length -= result) {
+    if ((result = write(fd, data, length)) < 0) {
+      perror("write");
+      exit(EXIT_FAILURE);
+    }
+  }
+}
+
+static void check_sequences(t3_key_reader_t *reader, int master) {
+  t3_key_decoder_t *decoder;
+  const t3_key_node_t *node;
+  t3_key_reader_event_t event;
+  long long *read_latency, *delivery_latency, *timeout_latency;
+  size_t count = 0, timeout_count = 0, total = 0;
+  int error;
+
+  if ((decoder = t3_key_decoder_new(map, &error)) == NULL) {
+    fprintf(stderr, "Could not create decoder: %s\n", t3_key_strerror(error));
+    exit(EXIT_FAILURE);
+  }
+  for (node = map; node != NULL; node = node->next) {
+    total++;
+  }
+  read_latency = malloc(total * sizeof(long long));
+  delivery_latency = malloc(total * sizeof(long long));
+  timeout_latency = malloc(total * sizeof(long long));
+  if (read_latency == NULL || delivery_latency == NULL || timeout_latency == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+
+  for (node = map; node != NULL; node = node->next) {
+    struct timespec start, end;
+    int ambiguous;
+
+    if (node->key[0] == '_' || node->string_length == 0) {
+      continue;
+    }
+    ambiguous =
+        t3_key_decoder_match(decoder, node->string, node->string_length) == T3_KEY_MATCH_AMBIGUOUS;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    write_all(master, node->string, node->string_length);
+    if (!wait_event(reader, &event, 2000)) {
+      fprintf(stderr, "No event for %s\n", node->key);
+      failed = 1;
+      continue;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (event.event.length != node->string_length ||
+        memcmp(event.event.data, node->string, node->string_length) != 0 ||
+        (event.event.type != T3_KEY_EVENT_KEY && event.event.type != T3_KEY_EVENT_CHAR)) {
+      fprintf(stderr, "Sequence for %s not decoded correctly\n", node->key);
+      failed = 1;
+    }
+    /* Discard the rest, in case the sequence was not decoded as one event. */
+    while (wait_event(reader, &event, ambiguous ? 2 * T3_KEY_DEFAULT_TIMEOUT : 1)) {
+    }
+
+    if (ambiguous) {
+      timeout_latency[timeout_count++] = elapsed_us(&start, &end);
+      if (elapsed_us(&start, &end) < T3_KEY_DEFAULT_TIMEOUT * 1000) {
+        fprintf(stderr, "Sequence for %s delivered before the timeout\n", node->key);
+        failed = 1;
+      }
+    } else {
+      read_latency[count] = elapsed_us(&start, &event.time);
+      delivery_latency[count++] = elapsed_us(&start, &end);
+    }
+  }
+
+  printf("Latency from write to:\n");
+  report("read", read_latency, count);
+  report("delivery", delivery_latency, count);
+  report("timeout", timeout_latency, timeout_count);
+  free(read_latency);
+  free(delivery_latency);
+  free(timeout_latency);
+  t3_key_decoder_free(decoder);
+}
+
+/* Write a large amount of UTF-8 text at once, which the reader splits into
+   multiple events. */
+static void check_text(t3_key_reader_t *reader, int master) {
+  static const char character[] = "\xe2\x82\xac";
+  size_t length = 3 * 10000, received = 0, i;
+  t3_key_reader_event_t event;
+  char *text;
+
+  if ((text = malloc(length)) == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  for (i = 0; i < length; i += 3) {
+    memcpy(text + i, character, 3);
+  }
+  write_all(master, text, length);
+  while (received < length && wait_event(reader, &event, 2000)) {
+    if (event.event.type != T3_KEY_EVENT_TEXT || received + event.event.length > length ||
+        memcmp(event.event.data, text + received, event.event.length) != 0) {
+      fprintf(stderr, "Text not received correctly\n");
+      failed = 1;
+      break;
+    }
+    received += event.event.length;
+  }
+  if (received != length) {
+    fprintf(stderr, "Text not received completely\n");
+    failed = 1;
+  }
+  free(text);
+}
+
+/* Write a reply of the maximum length, which must not be split. */
+static void check_reply(t3_key_reader_t *reader, int master) {
+  char input[T3_KEY_REPLY_MAX_LENGTH];
+  t3_key_reader_event_t event;
+
+  memset(input, 'x', sizeof(input));
+  memcpy(input, "\033]", 2);
+  memcpy(input + sizeof(input) - 2, "\033\\", 2);
+  write_all(master, input, sizeof(input));
+  if (!wait_event(reader, &event, 2000) || event.event.type != T3_KEY_EVENT_OSC ||
+      event.event.length != sizeof(input) || event.event.reply.string != event.data + 2 ||
+      event.event.reply.string_length != sizeof(input) - 4) {
+    fprintf(stderr, "Reply not received correctly\n");
+    failed = 1;
+  }
+  while (wait_event(reader, &event, 100)) {
+  }
+}
+
+/* Write more single byte events than the queue holds, before retrieving any
+   of them. */
+static void check_full_queue(t3_key_reader_t *reader, int master) {
+  char input[3000];
+  t3_key_reader_event_t event;
+  size_t count = 0;
+
+  memset(input, '\001', sizeof(input));
+  write_all(master, input, sizeof(input));
+  usleep(100000);
+  while (count < sizeof(input) && wait_event(reader, &event, 2000)) {
+    if (event.event.length != 1 || event.event.data[0] != '\001') {
+      break;
+    }
+    count++;
+  }
+  if (count != sizeof(input)) {
+    fprintf(stderr, "Events lost with a full queue\n");
+    failed = 1;
+  }
+}
+
+static void check_close(t3_key_reader_t *reader, int master) {
+  t3_key_reader_event_t event;
+
+  close(master);
+  if (wait_event(reader, &event, 2000) || t3_key_reader_get_error(reader) == T3_ERR_SUCCESS) {
+    fprintf(stderr, "Reader did not stop after closing the terminal\n");
+    failed = 1;
+  }
+}
+
+int main(int argc, char *argv[]) {
+  t3_key_reader_t *reader;
+  struct termios attributes;
+  const char *term;
+  int master, slave, error;
+
+  if (argc > 2 || (argc == 2 && strcmp(argv[1], "-h") == 0)) {
+    printf("Usage: reader_test [<terminal name>]\n");
+    exit(EXIT_SUCCESS);
+  }
+
+  term = argc == 2 ? argv[1] : "xterm";
+  setupterm(term, 1, &error);
+  if ((map = t3_key_load_map(term, NULL, &error)) == NULL) {
+    fprintf(stderr, "Could not load map for %s: %s\n", term, t3_key_strerror(error));
+    exit(EXIT_FAILURE);
+  }
+
+  if ((master = posix_openpt(O_RDWR | O_NOCTTY)) < 0 || grantpt(master) < 0 ||
+      unlockpt(master) < 0 || (slave = open(ptsname(master), O_RDWR | O_NOCTTY)) < 0) {
+    perror("Could not open pseudo terminal");
+    exit(EXIT_FAILURE);
+  }
+  tcgetattr(slave, &attributes);
+  attributes.c_iflag &= ~(BRKINT | ICRNL | INLCR | IGNCR | ISTRIP | IXON);
+  attributes.c_oflag &= ~OPOST;
+  attributes.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+  attributes.c_cc[VMIN] = 1;
+  attributes.c_cc[VTIME] = 0;
+  tcsetattr(slave, TCSANOW, &attributes);
+
+  if ((reader = t3_key_reader_new(slave, map, 0, &error)) == NULL) {
+    fprintf(stderr, "Could not create reader: %s\n", t3_key_strerror(error));
+    exit(EXIT_FAILURE);
+  }
+
+  check_sequences(reader, master);
+  check_text(reader, master);
+  check_reply(reader, master);
+  check_full_queue(reader, master);
+  check_close(reader, master);
+
+  t3_key_reader_free(reader);
+  close(slave);
+  t3_key_free_map(map);
+  printf("%s: %s\n", term, failed ? "FAILED" : "PASSED");
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
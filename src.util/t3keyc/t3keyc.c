@@ -11,9 +11,12 @@
    You should have received a copy of the GNU General Public License
    along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
+#include <dirent.h>
 #include <errno.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include <ctype.h>
@@ -23,6 +26,7 @@
 #include <t3config/config.h>
 
 #include "optionMacros.h"
+#include "shareddefs.h"
 
 #define ARRAY_LENGTH(x) (sizeof(x) / sizeof(x[0]))
 #define is_asciidigit(x) ((x) >= '0' && (x) <= '9')
@@ -36,23 +40,47 @@ static const char map_schema[] = {
 
 static bool option_link;
 static bool option_trace_circular;
-static bool option_check_terminfo = true;
 static bool option_verbose;
-static const char *input;
+static const char *option_compile;
+static const char *option_flatten;
+static const char *option_all;
+static int option_jobs;
+static const char **inputs;
+static int inputs_count;
+
+/* The state of checking a single input. With -a/--all, each worker thread
+   checks its own inputs, so these are thread local. */
+static __thread const char *input;
+static __thread bool option_check_terminfo = true;
+/* The stream to write the messages about the input to. */
+static __thread FILE *diagnostics;
+/* The terminfo entry to check against, or NULL if there is none. */
+static __thread TERMINAL *terminal;
+
+/* The terminfo functions use the current terminal, which is shared by all
+   threads. */
+static pthread_mutex_t terminfo_lock = PTHREAD_MUTEX_INITIALIZER;
 
 #include "mappings.c"
+#include "key_ids.h"
 
-static const char *valid_names[] = {
-    "insert",   "delete",    "home",     "end",      "page_up", "page_down",  "up",
-    "left",     "down",      "right",    "kp_home",  "kp_up",   "kp_page_up", "kp_page_down",
-    "kp_left",  "kp_center", "kp_right", "kp_end",   "kp_down", "kp_insert",  "kp_delete",
-    "kp_enter", "kp_div",    "kp_mul",   "kp_minus", "kp_plus", "tab",        "backspace"};
+/* The key names known to the library, other than the function keys. */
+#define VALID_NAME(_id, _name) _name,
+static const char *valid_names[] = {T3_KEY_IDS(VALID_NAME)};
+#undef VALID_NAME
 
 /* Print usage message/help. */
 static void print_usage(void) {
   printf(
       "Usage: t3keyc [<OPTIONS>] <INPUT>\n"
+      "       t3keyc -c <OUTPUT> <INPUT>...\n"
+      "       t3keyc -a <DIRECTORY>\n"
+      "  -a<dir>, --all=<dir>             Check all files in <dir> and create symbolic links\n"
+      "                                     for their aliases. With -l, only create the links\n"
+      "  -c<file>, --compile=<file>       Write a compiled database for all inputs\n"
+      "  -f<file>, --flatten=<file>       Write the input with all '_use' inclusions resolved\n"
       "  -h, --help                       Print this help message\n"
+      "  -j<jobs>, --jobs=<jobs>          Number of threads for -a/--all\n"
       "  -l, --link                       Create symbolic links for aliases\n"
       "  -t, --trace-circular-use         Trace circular '_use' inclusion\n"
       "  -v, --verbose                    Verbose output\n");
@@ -87,9 +115,21 @@ static char *safe_strdup(const char *str) { return strcpy(safe_malloc(strlen(str
 /* clang-format off */
 static PARSE_FUNCTION(parse_options)
   OPTIONS
+    OPTION('a', "all", REQUIRED_ARG)
+      option_all = optArg;
+    END_OPTION
+    OPTION('c', "compile", REQUIRED_ARG)
+      option_compile = optArg;
+    END_OPTION
+    OPTION('f', "flatten", REQUIRED_ARG)
+      option_flatten = optArg;
+    END_OPTION
     OPTION('h', "help", NO_ARG)
       print_usage();
     END_OPTION
+    OPTION('j', "jobs", REQUIRED_ARG)
+      PARSE_INT(option_jobs, 1, 1024);
+    END_OPTION
     OPTION('l', "link", NO_ARG)
       option_link = true;
     END_OPTION
@@ -104,16 +144,32 @@ static PARSE_FUNCTION(parse_options)
     END_OPTION
     fatal("Unknown option " OPTFMT "\n", OPTPRARG);
   NO_OPTION
-    if (input != NULL)
-      fatal("Multiple input files specified\n");
-    input = optcurrent;
+    inputs = realloc(inputs, (inputs_count + 1) * sizeof(const char *));
+    if (inputs == NULL)
+      fatal("Out of memory\n");
+    inputs[inputs_count++] = optcurrent;
   END_OPTIONS
 
-  if (option_link && option_trace_circular)
+  if (option_link && (option_trace_circular || option_compile != NULL || option_flatten != NULL))
     fatal("-l/--link only valid without other options\n");
 
-  if (input == NULL)
+  if (option_compile != NULL && option_flatten != NULL)
+    fatal("-c/--compile and -f/--flatten are mutually exclusive\n");
+
+  if (option_all != NULL) {
+    if (option_compile != NULL || option_flatten != NULL)
+      fatal("-a/--all can not be combined with -c/--compile or -f/--flatten\n");
+    if (inputs_count > 0)
+      fatal("-a/--all does not take input files\n");
+    return;
+  }
+
+  if (inputs_count == 0)
     fatal("No input\n");
+
+  if (inputs_count > 1 && option_compile == NULL)
+    fatal("Multiple input files specified\n");
+  input = inputs[0];
 END_FUNCTION
 /* clang-format on */
 
@@ -230,7 +286,7 @@ static size_t parse_escapes(char *string) {
 
 /* Convert a sequence to a printable representation. */
 static char *get_print_seq(const char *seq) {
-  static char buffer[1024];
+  static __thread char buffer[1024];
   char *dest = buffer;
 
   while (*seq && dest - buffer < 1018) {
@@ -261,15 +317,129 @@ typedef struct map_list_t {
   struct map_list_t *next;
 } map_list_t;
 
-typedef struct sequence_list_t {
+typedef struct {
   t3_config_t *config;
+  char *name;
   char *str;
   size_t str_len;
-  struct sequence_list_t *next;
-} sequence_list_t;
+} sequence_t;
+
+/* Hash table of the sequences defined in the map being checked. */
+typedef struct {
+  sequence_t **entries;
+  size_t used, mask;
+} sequence_set_t;
+
+/* Hash table mapping names to their index in a table of names. */
+typedef struct {
+  const char **names;
+  int *indices;
+  size_t mask;
+} name_table_t;
+
+static __thread map_list_t *map_head;
+static __thread sequence_set_t sequences;
+static name_table_t valid_name_table, keymapping_table;
+
+/* FNV-1a hash of @p length bytes of @p data. */
+static uint32_t hash_bytes(const char *data, size_t length) {
+  uint32_t hash = 2166136261u;
+  size_t i;
+
+  for (i = 0; i < length; i++) {
+    hash = (hash ^ (unsigned char)data[i]) * 16777619u;
+  }
+  return hash;
+}
+
+/* Initialize @p table with @p count names, taken from @p names at intervals
+   of @p stride bytes. */
+static void init_name_table(name_table_t *table, const void *names, size_t count, size_t stride) {
+  size_t size = 16, i;
 
-static map_list_t *map_head;
-static sequence_list_t *seq_head;
+  /* Keep the load factor of the table at or below 0.5. */
+  while (size < 2 * count) {
+    size *= 2;
+  }
+  table->names = safe_malloc(size * sizeof(const char *));
+  table->indices = safe_malloc(size * sizeof(int));
+  table->mask = size - 1;
+  memset(table->names, 0, size * sizeof(const char *));
+
+  for (i = 0; i < count; i++) {
+    const char *name = *(const char *const *)((const char *)names + i * stride);
+    size_t slot = hash_bytes(name, strlen(name)) & table->mask;
+
+    while (table->names[slot] != NULL && strcmp(table->names[slot], name) != 0) {
+      slot = (slot + 1) & table->mask;
+    }
+    if (table->names[slot] == NULL) {
+      table->names[slot] = name;
+      table->indices[slot] = i;
+    }
+  }
+}
+
+/* Look up the first @p name_len characters of @p name in @p table.
+   @return The index of the name, or -1 if it is not in @p table. */
+static int lookup_name(const name_table_t *table, const char *name, size_t name_len) {
+  size_t slot = hash_bytes(name, name_len) & table->mask;
+
+  for (; table->names[slot] != NULL; slot = (slot + 1) & table->mask) {
+    if (strncmp(table->names[slot], name, name_len) == 0 && table->names[slot][name_len] == 0) {
+      return table->indices[slot];
+    }
+  }
+  return -1;
+}
+
+/* Find the slot for sequence @p str of @p str_len bytes in the sequence set.
+   The slot is empty if the sequence is not in the set. */
+static sequence_t **find_sequence(const char *str, size_t str_len) {
+  size_t slot = hash_bytes(str, str_len) & sequences.mask;
+
+  for (; sequences.entries[slot] != NULL; slot = (slot + 1) & sequences.mask) {
+    if (sequences.entries[slot]->str_len == str_len &&
+        memcmp(sequences.entries[slot]->str, str, str_len) == 0) {
+      break;
+    }
+  }
+  return &sequences.entries[slot];
+}
+
+/* Add @p sequence to the sequence set, growing the set if necessary. */
+static void add_to_sequence_set(sequence_t *sequence) {
+  if (2 * (sequences.used + 1) > sequences.mask + 1) {
+    sequence_t **entries = sequences.entries;
+    size_t size = sequences.mask + 1, i;
+
+    sequences.mask = sequences.entries == NULL ? 255 : 2 * size - 1;
+    sequences.entries = safe_malloc((sequences.mask + 1) * sizeof(sequence_t *));
+    memset(sequences.entries, 0, (sequences.mask + 1) * sizeof(sequence_t *));
+    for (i = 0; entries != NULL && i < size; i++) {
+      if (entries[i] != NULL) {
+        *find_sequence(entries[i]->str, entries[i]->str_len) = entries[i];
+      }
+    }
+    free(entries);
+  }
+  *find_sequence(sequence->str, sequence->str_len) = sequence;
+  sequences.used++;
+}
+
+static void clear_sequence_set(void) {
+  size_t i;
+
+  for (i = 0; sequences.entries != NULL && i <= sequences.mask; i++) {
+    if (sequences.entries[i] != NULL) {
+      free(sequences.entries[i]->name);
+      free(sequences.entries[i]->str);
+      free(sequences.entries[i]);
+      sequences.entries[i] = NULL;
+    }
+  }
+  sequences.used = 0;
+}
 
 static t3_bool compare_name(const t3_config_t *check, const void *check_value) {
   const char *str = t3_config_get_string(check);
@@ -277,74 +447,81 @@ static t3_bool compare_name(const t3_config_t *check, const void *check_value) {
   return strcmp(check_value, str) == 0;
 }
 
-static void add_sequence(t3_config_t *ptr, t3_config_t *noticheck) {
-  sequence_list_t *seq_ptr;
-  const char *name, *minus;
+/* Get the terminfo string @p name for the terminal of the input. */
+static char *get_terminfo_string(const char *name) {
+  char *result;
+
+  pthread_mutex_lock(&terminfo_lock);
+  set_curterm(terminal);
+  result = tigetstr(name);
+  pthread_mutex_unlock(&terminfo_lock);
+  return result;
+}
+
+static bool is_valid_modifier_sequence(const char *modifiers) {
+  return strcmp(modifiers, "s") == 0 || strcmp(modifiers, "m") == 0 ||
+         strcmp(modifiers, "c") == 0 || strcmp(modifiers, "cm") == 0 ||
+         strcmp(modifiers, "cs") == 0 || strcmp(modifiers, "ms") == 0 ||
+         strcmp(modifiers, "cms") == 0;
+}
+
+/* Add the sequence of key @p name, defined by @p ptr. If @p combination is not
+   0, the value of @p ptr is a modifier pattern, and @p name is the name of the
+   key for @p combination. */
+static void add_sequence(t3_config_t *ptr, const char *name, int combination,
+                         t3_config_t *noticheck) {
+  sequence_t *seq_ptr;
+  const char *minus;
   size_t name_len;
-  size_t i;
   char *str = safe_strdup(t3_config_get_string(ptr));
-  size_t str_len = parse_escapes(str);
+  size_t str_len;
   bool invalid_name = false;
 
-  name = t3_config_get_name(ptr);
+  if (combination != 0) {
+    substitute_pattern(str, combination);
+  }
+  str_len = parse_escapes(str);
   minus = strchr(name, '-');
   name_len = minus == NULL ? strlen(name) : (size_t)(minus - name);
-  for (i = 0; i < ARRAY_LENGTH(valid_names); i++) {
-    if (strncmp(name, valid_names[i], name_len) == 0 && name_len == strlen(valid_names[i])) {
-      break;
-    }
-  }
-
-  if (i == ARRAY_LENGTH(valid_names)) {
+  if (lookup_name(&valid_name_table, name, name_len) < 0) {
     if (!(name[0] == 'f' && is_asciidigit(name[1]) &&
           (name[2] == 0 || name[2] == '-' ||
            (is_asciidigit(name[2]) && (name[3] == 0 || name[3] == '-') && name[1] != '0')))) {
       // FIXME: get file name information
-      fprintf(stderr, "%s:%d: '%s' is not a valid key name\n", input,
-              t3_config_get_line_number(ptr), t3_config_get_name(ptr));
+      fprintf(diagnostics, "%s:%d: '%s' is not a valid key name\n", input,
+              t3_config_get_line_number(ptr), name);
       invalid_name = true;
     }
   }
 
-  if (minus != NULL && strcmp(minus + 1, "s") != 0 && strcmp(minus + 1, "m") != 0 &&
-      strcmp(minus + 1, "c") != 0 && strcmp(minus + 1, "cm") != 0 && strcmp(minus + 1, "cs") != 0 &&
-      strcmp(minus + 1, "ms") != 0 && strcmp(minus + 1, "cms") != 0) {
-    fprintf(stderr, "%s:%d: '%s' includes incorrect modifier sequence\n", input,
-            t3_config_get_line_number(ptr), t3_config_get_name(ptr));
+  if (minus != NULL && !is_valid_modifier_sequence(minus + 1)) {
+    fprintf(diagnostics, "%s:%d: '%s' includes incorrect modifier sequence\n", input,
+            t3_config_get_line_number(ptr), name);
     invalid_name = true;
   }
 
-  for (seq_ptr = seq_head; seq_ptr != NULL; seq_ptr = seq_ptr->next) {
+  if (sequences.entries != NULL && (seq_ptr = *find_sequence(str, str_len)) != NULL) {
     // FIXME: get file name information
-    if (seq_ptr->str_len == str_len && memcmp(seq_ptr->str, str, str_len) == 0) {
-      fprintf(stderr, "%s:%d: '%s' has the same sequence as '%s' defined at %s:%d\n", input,
-              t3_config_get_line_number(ptr), t3_config_get_name(ptr),
-              t3_config_get_name(seq_ptr->config), input,
-              t3_config_get_line_number(seq_ptr->config));
-      break;
-    }
-  }
-
-  if (seq_ptr == NULL) {
-    seq_ptr = safe_malloc(sizeof(sequence_list_t));
+    fprintf(diagnostics, "%s:%d: '%s' has the same sequence as '%s' defined at %s:%d\n", input,
+            t3_config_get_line_number(ptr), name, seq_ptr->name, input,
+            t3_config_get_line_number(seq_ptr->config));
+  } else {
+    seq_ptr = safe_malloc(sizeof(sequence_t));
     seq_ptr->config = ptr;
+    seq_ptr->name = safe_strdup(name);
     seq_ptr->str = str;
     seq_ptr->str_len = str_len;
-    seq_ptr->next = seq_head;
-    seq_head = seq_ptr;
+    add_to_sequence_set(seq_ptr);
   }
 
   if (option_check_terminfo && !invalid_name &&
       t3_config_find(noticheck, compare_name, name, NULL) == NULL) {
     const char *tistr;
-    for (i = 0; i < ARRAY_LENGTH(keymapping); i++) {
-      if (strcmp(name, keymapping[i].key) == 0) {
-        tistr = tigetstr(keymapping[i].tikey);
-        break;
-        return;
-      }
-    }
-    if (i == ARRAY_LENGTH(keymapping)) {
+    int index = lookup_name(&keymapping_table, name, strlen(name));
+
+    if (index >= 0) {
+      tistr = get_terminfo_string(keymapping[index].tikey);
+    } else {
       char buffer[100];
       if (!(name[0] == 'f' && is_asciidigit(name[1]))) {
         return;
@@ -354,14 +531,14 @@ static void add_sequence(t3_config_t *ptr, t3_config_t *noticheck) {
       }
       buffer[0] = 'k';
       strcpy(buffer + 1, name);
-      tistr = tigetstr(buffer);
+      tistr = get_terminfo_string(buffer);
     }
 
     if (tistr != (char *)0 && tistr != (char *)-1) {
       if (strlen(tistr) != str_len || memcmp(tistr, str, str_len) != 0) {
         // FIXME: get file name information
-        fprintf(stderr, "%s:%d: '%s' has different definition (%s) than terminfo (%s)\n", input,
-                t3_config_get_line_number(ptr), t3_config_get_name(ptr), t3_config_get_string(ptr),
+        fprintf(diagnostics, "%s:%d: '%s' has different definition (%s) than terminfo (%s)\n",
+                input, t3_config_get_line_number(ptr), name, t3_config_get_string(ptr),
                 get_print_seq(tistr));
       }
     }
@@ -382,16 +559,30 @@ static void add_sequences(t3_config_t *map) {
         parse_escapes(str);
         free(str);
       } else {
-        char *tistr = tigetstr(t3_config_get_string(ptr));
+        char *tistr = get_terminfo_string(t3_config_get_string(ptr));
         if (tistr == (char *)0 || tistr == (char *)-1) {
           // FIXME: get file name information
-          fprintf(stderr, "%s:%d: '%s' specifies non-%s terminfo entry '%s'\n", input,
+          fprintf(diagnostics, "%s:%d: '%s' specifies non-%s terminfo entry '%s'\n", input,
                   t3_config_get_line_number(ptr), t3_config_get_name(ptr),
                   tistr == (char *)0 ? "existant" : "string", t3_config_get_string(ptr));
         }
       }
+    } else if (name[0] != '_' && is_modifier_pattern(name, t3_config_get_string(ptr))) {
+      char *instance_name = safe_strdup(name);
+      int combination;
+
+      if (!is_valid_modifier_sequence(strchr(name, '-') + 1)) {
+        fprintf(diagnostics, "%s:%d: '%s' includes incorrect modifier sequence\n", input,
+                t3_config_get_line_number(ptr), name);
+      }
+      for (combination = 1; combination < PATTERN_COMBINATIONS; combination++) {
+        if (get_pattern_name(name, combination, instance_name)) {
+          add_sequence(ptr, instance_name, combination, noticheck);
+        }
+      }
+      free(instance_name);
     } else if (name[0] != '_') {
-      add_sequence(ptr, noticheck);
+      add_sequence(ptr, name, 0, noticheck);
     }
   }
 }
@@ -403,11 +594,11 @@ static void check_use(t3_config_t *map_config, t3_config_t *use_map) {
   for (ptr = map_head; ptr != NULL; ptr = ptr->next) {
     if (ptr->map == use_map) {
       // FIXME: get file name info
-      fprintf(stderr, "%s:%d: circular inclusion of map '%s'\n", input,
+      fprintf(diagnostics, "%s:%d: circular inclusion of map '%s'\n", input,
               t3_config_get_line_number(use_map), t3_config_get_name(use_map));
       if (option_trace_circular) {
         for (ptr = map_head; ptr != NULL; ptr = ptr->next) {
-          fprintf(stderr, "  from map '%s'\n", t3_config_get_name(ptr->map));
+          fprintf(diagnostics, "  from map '%s'\n", t3_config_get_name(ptr->map));
           if (ptr->map == use_map) break;
         }
       }
@@ -429,10 +620,10 @@ static void check_map_rec(t3_config_t *map_config, t3_config_t *map, bool outer)
 
   if (!outer) {
     if ((enter_leave = t3_config_get(map, "_enter")) != NULL)
-      fprintf(stderr, "%s:%d: 'enter' should only be used in top-level maps\n", input,
+      fprintf(diagnostics, "%s:%d: 'enter' should only be used in top-level maps\n", input,
               t3_config_get_line_number(enter_leave));
     if ((enter_leave = t3_config_get(map, "_leave")) != NULL)
-      fprintf(stderr, "%s:%d: 'leave' should only be used in top-level maps\n", input,
+      fprintf(diagnostics, "%s:%d: 'leave' should only be used in top-level maps\n", input,
               t3_config_get_line_number(enter_leave));
   } else {
     if (((enter_leave = t3_config_get(map, "_enter")) == NULL ||
@@ -459,6 +650,12 @@ static void check_map_rec(t3_config_t *map_config, t3_config_t *map, bool outer)
   }
 }
 
+static void init_name_tables(void) {
+  init_name_table(&valid_name_table, valid_names, ARRAY_LENGTH(valid_names), sizeof(const char *));
+  init_name_table(&keymapping_table, &keymapping[0].key, ARRAY_LENGTH(keymapping),
+                  sizeof(mapping_t));
+}
+
 static void check_maps(t3_config_t *map_config) {
   t3_config_t *map;
 
@@ -468,72 +665,1159 @@ static void check_maps(t3_config_t *map_config) {
 
     check_map_rec(map_config, map, true);
 
-    while (seq_head != NULL) {
-      sequence_list_t *tmp = seq_head;
-      seq_head = tmp->next;
-      free(tmp->str);
-      free(tmp);
-    }
+    clear_sequence_set();
   }
+  free(sequences.entries);
+  sequences.entries = NULL;
+  sequences.mask = 0;
 }
 
-static void create_symlinks(t3_config_t *map_config, const char *term_name) {
-  const t3_config_t *aka;
-  char *dirname = safe_strdup(input);
+/* Create a symbolic link @p alias to @p term_name, in the directory of the input. */
+static void create_symlink(const char *alias, const char *term_name) {
+  const char *slash = strrchr(input, '/');
+  size_t dirname_len = slash == NULL ? 0 : (size_t)(slash - input) + 1;
   char *linkname;
 
-  if (strrchr(dirname, '/') != NULL) {
-    strrchr(dirname, '/')[1] = 0;
+  linkname = safe_malloc(dirname_len + strlen(alias) + 1);
+  memcpy(linkname, input, dirname_len);
+  strcpy(linkname + dirname_len, alias);
+  if (symlink(term_name, linkname) == -1) {
+    if (errno != EEXIST || option_verbose)
+      fprintf(diagnostics, "Could not create symbolic link %s -> %s: %s\n", linkname, term_name,
+              strerror(errno));
   }
+  free(linkname);
+}
+
+static void create_symlinks(t3_config_t *map_config, const char *term_name) {
+  const t3_config_t *aka;
 
   for (aka = t3_config_get(t3_config_get(map_config, "aka"), NULL); aka != NULL;
        aka = t3_config_get_next(aka)) {
-    linkname = safe_malloc(strlen(dirname) + strlen(t3_config_get_string(aka)) + 1);
-    strcpy(linkname, dirname);
-    strcat(linkname, t3_config_get_string(aka));
-    if (symlink(term_name, linkname) == -1) {
-      if (errno != EEXIST || option_verbose)
-        fprintf(stderr, "Could not create symbolic link %s -> %s: %s\n", linkname, term_name,
-                strerror(errno));
+    create_symlink(t3_config_get_string(aka), term_name);
+  }
+}
+
+/*============== Compiled database ==============*/
+typedef struct {
+  char *data;
+  size_t used, allocated;
+} buffer_t;
+
+/* The tables of the compiled database. While compiling, the offsets in the
+   tables are relative to the start of the table they refer to. They are
+   converted to file offsets when the database is written. */
+static buffer_t db_terminals, db_infos, db_maps, db_keys, db_strings;
+
+/* Append data to a buffer, and return the offset at which it was stored. */
+static size_t buffer_add(buffer_t *buffer, const void *data, size_t size) {
+  size_t offset = buffer->used;
+
+  if (buffer->used + size > buffer->allocated) {
+    buffer->allocated = buffer->allocated == 0 ? 4096 : buffer->allocated * 2;
+    if (buffer->allocated < buffer->used + size) {
+      buffer->allocated = buffer->used + size;
+    }
+    if ((buffer->data = realloc(buffer->data, buffer->allocated)) == NULL) {
+      fatal("Out of memory\n");
     }
-    free(linkname);
   }
-  free(dirname);
+  memcpy(buffer->data + buffer->used, data, size);
+  buffer->used += size;
+  return offset;
 }
 
-int main(int argc, char *argv[]) {
+static uint32_t add_db_string(const char *str, size_t str_len) {
+  uint32_t offset = buffer_add(&db_strings, str, str_len);
+  buffer_add(&db_strings, "", 1);
+  return offset;
+}
+
+/* Add the key @p name with the sequence defined by @p ptr to the compiled
+   database. If @p combination is not 0, the value of @p ptr is a modifier
+   pattern. */
+static void compile_key(t3_config_t *ptr, const char *name, int combination) {
+  char *str = safe_strdup(t3_config_get_string(ptr));
+  size_t str_len;
+  db_key_t key;
+
+  if (combination != 0) {
+    substitute_pattern(str, combination);
+  }
+  key.name = add_db_string(name, strlen(name));
+  if ((str_len = parse_escapes(str)) == 0) {
+    fatal("%s:%d: invalid sequence for '%s'\n", input, t3_config_get_line_number(ptr), name);
+  }
+  key.string = add_db_string(str, str_len);
+  key.string_length = str_len;
+  key.flags = 0;
+  buffer_add(&db_keys, &key, sizeof(key));
+  free(str);
+}
+
+static void compile_map_rec(t3_config_t *map_config, t3_config_t *map, bool outer,
+                            map_list_t **included) {
+  t3_config_t *ptr;
+
+  for (ptr = t3_config_get(map, NULL); ptr != NULL; ptr = t3_config_get_next(ptr)) {
+    const char *name = t3_config_get_name(ptr);
+
+    if (strcmp(name, "_use") == 0) {
+      t3_config_t *use_name, *use_map;
+      map_list_t *tmp;
+
+      for (use_name = t3_config_get(ptr, NULL); use_name != NULL;
+           use_name = t3_config_get_next(use_name)) {
+        use_map = t3_config_get(t3_config_get(map_config, "maps"), t3_config_get_string(use_name));
+        /* Each map is only included once, as is done by the library. */
+        for (tmp = *included; tmp != NULL && tmp->map != use_map; tmp = tmp->next) {
+        }
+        if (use_map == NULL || tmp != NULL) {
+          continue;
+        }
+        tmp = safe_malloc(sizeof(map_list_t));
+        tmp->map = use_map;
+        tmp->next = *included;
+        *included = tmp;
+        compile_map_rec(map_config, use_map, false, included);
+      }
+    } else if (name[0] != '_' && is_modifier_pattern(name, t3_config_get_string(ptr))) {
+      char *instance_name = safe_strdup(name);
+      int combination;
+
+      for (combination = 1; combination < PATTERN_COMBINATIONS; combination++) {
+        if (get_pattern_name(name, combination, instance_name)) {
+          compile_key(ptr, instance_name, combination);
+        }
+      }
+      free(instance_name);
+    } else if (name[0] != '_' || strcmp(name, "_enter") == 0 || strcmp(name, "_leave") == 0) {
+      const char *value = t3_config_get_string(ptr);
+
+      if (name[0] == '_' && value[0] != '\\') {
+        db_key_t key;
+
+        if (!outer) {
+          fatal("%s:%d: terminfo name for '%s' only allowed in top-level maps\n", input,
+                t3_config_get_line_number(ptr), name);
+        }
+        key.name = add_db_string(name, strlen(name));
+        key.string = add_db_string(value, strlen(value));
+        key.string_length = strlen(value);
+        key.flags = DB_KEY_TERMINFO;
+        buffer_add(&db_keys, &key, sizeof(key));
+      } else {
+        compile_key(ptr, name, 0);
+      }
+    }
+  }
+}
+
+static void compile_terminal(t3_config_t *map_config, const char *term_name) {
+  t3_config_t *map, *ptr;
+  db_terminal_t terminal;
+  db_info_t info;
+  const char *best = t3_config_get_string(t3_config_get(map_config, "best"));
+  bool best_found = false;
+
+  memset(&info, 0, sizeof(info));
+  info.maps = db_maps.used / sizeof(db_map_t);
+  if (t3_config_get_bool(t3_config_get(map_config, "xterm_mouse"))) {
+    info.flags |= DB_INFO_XTERM_MOUSE;
+  }
+  if ((ptr = t3_config_get(map_config, "shiftfn")) != NULL) {
+    int i;
+    info.flags |= DB_INFO_SHIFTFN;
+    for (ptr = t3_config_get(ptr, NULL), i = 0; ptr != NULL && i < 3;
+         ptr = t3_config_get_next(ptr), i++) {
+      info.shiftfn[i] = t3_config_get_int(ptr);
+    }
+  }
+
+  for (map = t3_config_get(t3_config_get(map_config, "maps"), NULL); map != NULL;
+       map = t3_config_get_next(map)) {
+    map_list_t *included = NULL;
+    db_map_t db_map;
+
+    if (strcmp(t3_config_get_name(map), best) == 0) {
+      info.best = info.map_count;
+      best_found = true;
+    }
+
+    db_map.name = add_db_string(t3_config_get_name(map), strlen(t3_config_get_name(map)));
+    db_map.keys = db_keys.used / sizeof(db_key_t);
+
+    included = safe_malloc(sizeof(map_list_t));
+    included->map = map;
+    included->next = NULL;
+    compile_map_rec(map_config, map, true, &included);
+    while (included != NULL) {
+      map_list_t *tmp = included;
+      included = tmp->next;
+      free(tmp);
+    }
+
+    db_map.key_count = db_keys.used / sizeof(db_key_t) - db_map.keys;
+    buffer_add(&db_maps, &db_map, sizeof(db_map));
+    info.map_count++;
+  }
+  if (!best_found) {
+    fatal("%s: 'best' must name an existing map\n", input);
+  }
+
+  terminal.info = buffer_add(&db_infos, &info, sizeof(info)) / sizeof(db_info_t);
+  terminal.name = add_db_string(term_name, strlen(term_name));
+  buffer_add(&db_terminals, &terminal, sizeof(terminal));
+  for (ptr = t3_config_get(t3_config_get(map_config, "aka"), NULL); ptr != NULL;
+       ptr = t3_config_get_next(ptr)) {
+    terminal.name = add_db_string(t3_config_get_string(ptr), strlen(t3_config_get_string(ptr)));
+    buffer_add(&db_terminals, &terminal, sizeof(terminal));
+  }
+}
+
+static int compare_terminals(const void *a, const void *b) {
+  return strcmp(db_strings.data + ((const db_terminal_t *)a)->name,
+                db_strings.data + ((const db_terminal_t *)b)->name);
+}
+
+static void write_db(const char *name) {
+  db_header_t header;
+  db_terminal_t *terminals = (db_terminal_t *)db_terminals.data;
+  db_info_t *infos = (db_info_t *)db_infos.data;
+  db_map_t *maps = (db_map_t *)db_maps.data;
+  db_key_t *keys = (db_key_t *)db_keys.data;
+  size_t terminal_count = db_terminals.used / sizeof(db_terminal_t);
+  size_t infos_offset, maps_offset, keys_offset, strings_offset, i;
+  char *tmp_name;
+  FILE *output;
+
+  qsort(terminals, terminal_count, sizeof(db_terminal_t), compare_terminals);
+  for (i = 1; i < terminal_count; i++) {
+    if (compare_terminals(&terminals[i - 1], &terminals[i]) == 0) {
+      fatal("Terminal '%s' is defined more than once\n", db_strings.data + terminals[i].name);
+    }
+  }
+
+  infos_offset = sizeof(header) + db_terminals.used;
+  maps_offset = infos_offset + db_infos.used;
+  keys_offset = maps_offset + db_maps.used;
+  strings_offset = keys_offset + db_keys.used;
+  if (strings_offset + db_strings.used > UINT32_MAX) {
+    fatal("Compiled database is too large\n");
+  }
+
+  for (i = 0; i < terminal_count; i++) {
+    terminals[i].name += strings_offset;
+    terminals[i].info = infos_offset + terminals[i].info * sizeof(db_info_t);
+  }
+  for (i = 0; i < db_infos.used / sizeof(db_info_t); i++) {
+    infos[i].maps = maps_offset + infos[i].maps * sizeof(db_map_t);
+  }
+  for (i = 0; i < db_maps.used / sizeof(db_map_t); i++) {
+    maps[i].name += strings_offset;
+    maps[i].keys = keys_offset + maps[i].keys * sizeof(db_key_t);
+  }
+  for (i = 0; i < db_keys.used / sizeof(db_key_t); i++) {
+    keys[i].name += strings_offset;
+    keys[i].string += strings_offset;
+  }
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, DB_MAGIC, sizeof(DB_MAGIC));
+  header.version = DB_VERSION;
+  header.byte_order = DB_BYTE_ORDER;
+  header.size = strings_offset + db_strings.used;
+  header.terminal_count = terminal_count;
+  header.terminals = sizeof(header);
+
+  /* Write to a temporary file first, such that programs which have the
+     current database mapped into memory are not affected. */
+  tmp_name = safe_malloc(strlen(name) + 5);
+  strcpy(tmp_name, name);
+  strcat(tmp_name, ".new");
+  if ((output = fopen(tmp_name, "wb")) == NULL) {
+    fatal("Could not open file '%s': %s\n", tmp_name, strerror(errno));
+  }
+  fwrite(&header, 1, sizeof(header), output);
+  fwrite(db_terminals.data, 1, db_terminals.used, output);
+  fwrite(db_infos.data, 1, db_infos.used, output);
+  fwrite(db_maps.data, 1, db_maps.used, output);
+  fwrite(db_keys.data, 1, db_keys.used, output);
+  fwrite(db_strings.data, 1, db_strings.used, output);
+  if (ferror(output) || fclose(output) != 0) {
+    fatal("Error writing file '%s': %s\n", tmp_name, strerror(errno));
+  }
+  if (rename(tmp_name, name) == -1) {
+    fatal("Could not rename '%s' to '%s': %s\n", tmp_name, name, strerror(errno));
+  }
+  free(tmp_name);
+}
+
+/*============== Flattened database ==============*/
+/* The entries of a map in the order in which the library adds them, with the
+   '_use' inclusions resolved. */
+typedef struct {
+  t3_config_t **entries;
+  size_t used, allocated;
+} entry_list_t;
+
+static void add_entry(entry_list_t *list, t3_config_t *ptr) {
+  if (list->used == list->allocated) {
+    list->allocated = list->allocated == 0 ? 64 : list->allocated * 2;
+    if ((list->entries = realloc(list->entries, list->allocated * sizeof(t3_config_t *))) ==
+        NULL) {
+      fatal("Out of memory\n");
+    }
+  }
+  list->entries[list->used++] = ptr;
+}
+
+/* Collect the entries of @p map in @p list, following the same order as
+   compile_map_rec. */
+static void flatten_map_rec(t3_config_t *maps, t3_config_t *map, bool outer, map_list_t **included,
+                            entry_list_t *list) {
+  t3_config_t *ptr;
+
+  for (ptr = t3_config_get(map, NULL); ptr != NULL; ptr = t3_config_get_next(ptr)) {
+    const char *name = t3_config_get_name(ptr);
+
+    if (strcmp(name, "_use") == 0) {
+      t3_config_t *use_name, *use_map;
+      map_list_t *tmp;
+
+      for (use_name = t3_config_get(ptr, NULL); use_name != NULL;
+           use_name = t3_config_get_next(use_name)) {
+        use_map = t3_config_get(maps, t3_config_get_string(use_name));
+        for (tmp = *included; tmp != NULL && tmp->map != use_map; tmp = tmp->next) {
+        }
+        if (use_map == NULL || tmp != NULL) {
+          continue;
+        }
+        tmp = safe_malloc(sizeof(map_list_t));
+        tmp->map = use_map;
+        tmp->next = *included;
+        *included = tmp;
+        flatten_map_rec(maps, use_map, false, included, list);
+      }
+    } else if (name[0] != '_' || strcmp(name, "_enter") == 0 || strcmp(name, "_leave") == 0) {
+      if (!outer && name[0] == '_' && t3_config_get_string(ptr)[0] != '\\') {
+        fatal("%s:%d: terminfo name for '%s' only allowed in top-level maps\n", input,
+              t3_config_get_line_number(ptr), name);
+      }
+      add_entry(list, ptr);
+    }
+  }
+}
+
+static bool is_terminfo_entry(t3_config_t *ptr) {
+  return t3_config_get_name(ptr)[0] == '_' && t3_config_get_string(ptr)[0] != '\\';
+}
+
+/* Check whether the name of @p ptr occurs in entries @p start up to @p end of @p list. */
+static bool has_entry_name(const entry_list_t *list, size_t start, size_t end, t3_config_t *ptr) {
+  for (; start < end; start++) {
+    if (strcmp(t3_config_get_name(list->entries[start]), t3_config_get_name(ptr)) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void add_entries(t3_config_t *section, const entry_list_t *list, size_t start,
+                        size_t end) {
+  for (; start < end; start++) {
+    if (t3_config_add_string(section, t3_config_get_name(list->entries[start]),
+                             t3_config_get_string(list->entries[start])) != T3_ERR_SUCCESS) {
+      fatal("Out of memory\n");
+    }
+  }
+}
+
+static t3_config_t *add_flat_section(t3_config_t *config, const char *name) {
+  t3_config_t *section;
+
+  if ((section = t3_config_add_section(config, name, NULL)) == NULL) {
+    fatal("Out of memory\n");
+  }
+  return section;
+}
+
+/* Add the flattened version of @p map from @p maps to @p flat_maps.
+
+   A section can not contain the same key twice, but a map in which the same
+   key is defined both by the map and by an included map contains both.
+   Therefore, the entries are only stored in the map itself up to the first
+   repeated name. The remaining entries are divided over internal maps named
+   _<map>_<n>, which are all included by a single '_use' list, such that the
+   library adds the entries in the original order. Terminfo names for _enter
+   and _leave are only allowed in the map itself, so if such an entry occurs
+   after the first repeated name, it and all entries following it are stored
+   in the map itself after the '_use' list. */
+static void flatten_map(t3_config_t *maps, t3_config_t *map, t3_config_t *flat_maps) {
+  const char *map_name = t3_config_get_name(map);
+  entry_list_t list = {NULL, 0, 0};
+  map_list_t *included;
+  t3_config_t *section, *use_list = NULL;
+  size_t prefix_end, suffix_start, start, end;
+  char *segment_name;
+  int segment;
+
+  included = safe_malloc(sizeof(map_list_t));
+  included->map = map;
+  included->next = NULL;
+  flatten_map_rec(maps, map, true, &included, &list);
+  while (included != NULL) {
+    map_list_t *tmp = included;
+    included = tmp->next;
+    free(tmp);
+  }
+
+  for (prefix_end = 0; prefix_end < list.used; prefix_end++) {
+    if (has_entry_name(&list, 0, prefix_end, list.entries[prefix_end])) {
+      break;
+    }
+  }
+  for (suffix_start = prefix_end;
+       suffix_start < list.used && !is_terminfo_entry(list.entries[suffix_start]);
+       suffix_start++) {
+  }
+  for (start = suffix_start; start < list.used; start++) {
+    if (has_entry_name(&list, 0, prefix_end, list.entries[start]) ||
+        has_entry_name(&list, suffix_start, start, list.entries[start])) {
+      fatal("%s: map '%s' can not be flattened, because '%s' is repeated after a terminfo "
+            "name for '%s'\n",
+            input, map_name, t3_config_get_name(list.entries[start]),
+            t3_config_get_name(list.entries[suffix_start]));
+    }
+  }
+
+  section = add_flat_section(flat_maps, map_name);
+  add_entries(section, &list, 0, prefix_end);
+  segment_name = safe_malloc(strlen(map_name) + 16);
+  for (start = prefix_end, segment = 1; start < suffix_start; start = end, segment++) {
+    for (end = start + 1;
+         end < suffix_start && !has_entry_name(&list, start, end, list.entries[end]); end++) {
+    }
+    sprintf(segment_name, "_%s_%d", map_name, segment);
+    if (use_list == NULL && (use_list = t3_config_add_plist(section, "_use", NULL)) == NULL) {
+      fatal("Out of memory\n");
+    }
+    if (t3_config_add_string(use_list, NULL, segment_name) != T3_ERR_SUCCESS) {
+      fatal("Out of memory\n");
+    }
+    add_entries(add_flat_section(flat_maps, segment_name), &list, start, end);
+  }
+  add_entries(section, &list, suffix_start, list.used);
+  free(segment_name);
+  free(list.entries);
+}
+
+/* Write @p map_config to @p name, with the '_use' inclusions of all maps
+   resolved. Internal maps are not written, as they are only used through
+   inclusion. Neither are the keys which are only used for checking. */
+static void write_flattened(t3_config_t *map_config, const char *name) {
+  t3_config_t *maps, *map, *flat_maps;
+  FILE *output;
+
+  maps = t3_config_unlink(map_config, "maps");
+  flat_maps = add_flat_section(map_config, "maps");
+  for (map = t3_config_get(maps, NULL); map != NULL; map = t3_config_get_next(map)) {
+    if (t3_config_get_name(map)[0] != '_') {
+      flatten_map(maps, map, flat_maps);
+    }
+  }
+  t3_config_delete(maps);
+
+  if ((output = fopen(name, "w")) == NULL) {
+    fatal("Could not open file '%s': %s\n", name, strerror(errno));
+  }
+  if (t3_config_write_file(map_config, output) != T3_ERR_SUCCESS || ferror(output) ||
+      fclose(output) != 0) {
+    fatal("Error writing file '%s': %s\n", name, strerror(errno));
+  }
+}
+
+/* Read and validate the input.
+   @return The contents of the input, or NULL if an error was reported. */
+static t3_config_t *read_map_config(const t3_config_schema_t *schema) {
   t3_config_t *map_config;
   t3_config_opts_t opts;
   t3_config_error_t error;
-  t3_config_schema_t *schema;
-  const char *term_name;
-  int err;
   FILE *file;
 
-  parse_options(argc, argv);
-
   if ((file = fopen(input, "r")) == NULL) {
-    fatal("Could not open file '%s': %s\n", input, strerror(errno));
+    fprintf(diagnostics, "Could not open file '%s': %s\n", input, strerror(errno));
+    return NULL;
   }
 
   opts.flags = T3_CONFIG_VERBOSE_ERROR;
-  if ((map_config = t3_config_read_file(file, &error, &opts)) == NULL)
-    fatal("%s:%d: %s%s%s\n", input, error.line_number, t3_config_strerror(error.error),
-          error.extra == NULL ? "" : ": ", error.extra == NULL ? "" : error.extra);
+  map_config = t3_config_read_file(file, &error, &opts);
   fclose(file);
+  if (map_config == NULL) {
+    goto report_error;
+  }
+
+  if (!t3_config_validate(map_config, schema, &error, T3_CONFIG_VERBOSE_ERROR)) {
+    t3_config_delete(map_config);
+    goto report_error;
+  }
+  return map_config;
+
+report_error:
+  fprintf(diagnostics, "%s:%d: %s%s%s\n", input, error.line_number,
+          t3_config_strerror(error.error), error.extra == NULL ? "" : ": ",
+          error.extra == NULL ? "" : error.extra);
+  return NULL;
+}
+
+static const char *get_term_name(void) {
+  const char *term_name;
+
+  if ((term_name = strrchr(input, '/')) == NULL) {
+    return input;
+  }
+  return term_name + 1;
+}
+
+/*============== Manifest ==============*/
+/* The manifest records, for each file checked with -a/--all, the hash of its
+   contents and of its terminfo entry, its aliases and, for each of its maps,
+   the hash of the map with all maps it includes and the messages about it.
+   Files whose hashes did not change are not checked again: their messages
+   are taken from the manifest instead. Similarly, only the maps whose hash
+   changed are checked again in a changed file. */
+#define MANIFEST_NAME ".t3keyc-manifest"
+#define MANIFEST_VERSION "t3keyc-manifest 1"
+
+/* A map or alias in the manifest. */
+typedef struct manifest_entry_t {
+  char *name;
+  uint64_t hash;
+  char *diagnostics;
+  size_t diagnostics_size;
+  struct manifest_entry_t *next;
+} manifest_entry_t;
+
+typedef struct manifest_file_t {
+  char *name;
+  uint64_t content_hash, terminfo_hash;
+  manifest_entry_t *aliases, *maps;
+  struct manifest_file_t *next;
+} manifest_file_t;
+
+/* FNV-1a hash of @p length bytes of @p data, continuing from @p hash. */
+static uint64_t update_hash(uint64_t hash, const void *data, size_t length) {
+  size_t i;
+
+  for (i = 0; i < length; i++) {
+    hash = (hash ^ ((const unsigned char *)data)[i]) * UINT64_C(1099511628211);
+  }
+  return hash;
+}
+
+#define INITIAL_HASH UINT64_C(14695981039346656037)
+
+static uint64_t update_hash_string(uint64_t hash, const char *str) {
+  return update_hash(hash, str, strlen(str) + 1);
+}
+
+/* Compute the hash of the contents of the input.
+   @return Whether the input could be read. */
+static bool hash_file(uint64_t *hash) {
+  char buffer[4096];
+  size_t result;
+  FILE *file;
+
+  if ((file = fopen(input, "r")) == NULL) {
+    fprintf(diagnostics, "Could not open file '%s': %s\n", input, strerror(errno));
+    return false;
+  }
+  *hash = INITIAL_HASH;
+  while ((result = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+    *hash = update_hash(*hash, buffer, result);
+  }
+  fclose(file);
+  return true;
+}
+
+/* Compute the hash of the string capabilities of the current terminal. */
+static uint64_t hash_terminfo(void) {
+  uint64_t hash = INITIAL_HASH;
+  const char *str;
+  size_t i;
+
+  for (i = 0; strnames[i] != NULL; i++) {
+    str = tigetstr(strnames[i]);
+    hash = update_hash_string(hash, str == (char *)0 || str == (char *)-1 ? "" : str);
+  }
+  /* The keys with modifiers are extended capabilities. */
+  for (i = 0; i < ARRAY_LENGTH(keymapping); i++) {
+    str = tigetstr(keymapping[i].tikey);
+    hash = update_hash_string(hash, str == (char *)0 || str == (char *)-1 ? "" : str);
+  }
+  return hash;
+}
+
+/* Add everything which influences the messages about @p config to @p hash. */
+static uint64_t hash_config(uint64_t hash, const t3_config_t *config) {
+  const t3_config_t *ptr;
+
+  for (ptr = t3_config_get(config, NULL); ptr != NULL; ptr = t3_config_get_next(ptr)) {
+    t3_config_type_t type = t3_config_get_type(ptr);
+    int line_number = t3_config_get_line_number(ptr);
+
+    hash = update_hash_string(hash, t3_config_get_name(ptr) == NULL ? "" : t3_config_get_name(ptr));
+    hash = update_hash(hash, &type, sizeof(type));
+    hash = update_hash(hash, &line_number, sizeof(line_number));
+    if (type == T3_CONFIG_STRING) {
+      hash = update_hash_string(hash, t3_config_get_string(ptr));
+    } else if (type == T3_CONFIG_BOOL) {
+      t3_bool value = t3_config_get_bool(ptr);
+      hash = update_hash(hash, &value, sizeof(value));
+    } else if (type == T3_CONFIG_LIST || type == T3_CONFIG_PLIST || type == T3_CONFIG_SECTION) {
+      hash = hash_config(hash, ptr);
+      /* Mark the end of the list or section. */
+      hash = update_hash(hash, "", 1);
+    }
+  }
+  return hash;
+}
+
+/* Compute the hash of @p map, together with all maps it includes. */
+static uint64_t hash_map_rec(uint64_t hash, t3_config_t *maps, t3_config_t *map,
+                             map_list_t **included) {
+  t3_config_t *use_name, *use_map;
+  map_list_t *tmp;
+
+  hash = update_hash_string(hash, t3_config_get_name(map));
+  hash = hash_config(hash, map);
+  for (use_name = t3_config_get(t3_config_get(map, "_use"), NULL); use_name != NULL;
+       use_name = t3_config_get_next(use_name)) {
+    use_map = t3_config_get(maps, t3_config_get_string(use_name));
+    for (tmp = *included; tmp != NULL && tmp->map != use_map; tmp = tmp->next) {
+    }
+    if (use_map == NULL || tmp != NULL) {
+      continue;
+    }
+    tmp = safe_malloc(sizeof(map_list_t));
+    tmp->map = use_map;
+    tmp->next = *included;
+    *included = tmp;
+    hash = hash_map_rec(hash, maps, use_map, included);
+  }
+  return hash;
+}
+
+static uint64_t hash_map(t3_config_t *maps, t3_config_t *map) {
+  map_list_t *included;
+  uint64_t hash;
+
+  included = safe_malloc(sizeof(map_list_t));
+  included->map = map;
+  included->next = NULL;
+  hash = hash_map_rec(INITIAL_HASH, maps, map, &included);
+  while (included != NULL) {
+    map_list_t *tmp = included;
+    included = tmp->next;
+    free(tmp);
+  }
+  return hash;
+}
+
+/* Compute the hash identifying the version of t3keyc and the options, which
+   must be the same for the manifest to be used. */
+static uint64_t hash_settings(const char *directory) {
+  uint64_t hash = update_hash_string(INITIAL_HASH, MANIFEST_VERSION);
+  size_t i;
+
+  hash = update_hash(hash, map_schema, sizeof(map_schema));
+  for (i = 0; i < ARRAY_LENGTH(valid_names); i++) {
+    hash = update_hash_string(hash, valid_names[i]);
+  }
+  for (i = 0; i < ARRAY_LENGTH(keymapping); i++) {
+    hash = update_hash_string(hash, keymapping[i].tikey);
+    hash = update_hash_string(hash, keymapping[i].key);
+  }
+  hash = update_hash(hash, &option_trace_circular, sizeof(option_trace_circular));
+  /* The messages include the path of the files. */
+  return update_hash_string(hash, directory);
+}
+
+static manifest_entry_t *new_manifest_entry(const char *name, manifest_entry_t ***tail) {
+  manifest_entry_t *entry = safe_malloc(sizeof(manifest_entry_t));
+
+  entry->name = safe_strdup(name);
+  entry->hash = 0;
+  entry->diagnostics = NULL;
+  entry->diagnostics_size = 0;
+  entry->next = NULL;
+  **tail = entry;
+  *tail = &entry->next;
+  return entry;
+}
+
+static void free_manifest_entries(manifest_entry_t *entries) {
+  while (entries != NULL) {
+    manifest_entry_t *tmp = entries;
+    entries = tmp->next;
+    free(tmp->name);
+    free(tmp->diagnostics);
+    free(tmp);
+  }
+}
+
+static void free_manifest_file(manifest_file_t *file) {
+  if (file == NULL) {
+    return;
+  }
+  free_manifest_entries(file->aliases);
+  free_manifest_entries(file->maps);
+  free(file->name);
+  free(file);
+}
+
+/* Append @p length bytes of @p data to the messages of @p entry. */
+static void add_manifest_diagnostics(manifest_entry_t *entry, const char *data, size_t length) {
+  if ((entry->diagnostics = realloc(entry->diagnostics, entry->diagnostics_size + length + 1)) ==
+      NULL) {
+    fatal("Out of memory\n");
+  }
+  memcpy(entry->diagnostics + entry->diagnostics_size, data, length);
+  entry->diagnostics_size += length;
+  entry->diagnostics[entry->diagnostics_size] = 0;
+}
+
+/* Read the manifest @p name. The manifest is line based, with the name of a
+   file, alias or map, or the text of a message at the end of each line.
+   @return The files in the manifest, or NULL if it does not exist or was
+       written for different settings. */
+static manifest_file_t *read_manifest(const char *name, uint64_t settings) {
+  manifest_file_t *files = NULL, **files_tail = &files, *file = NULL;
+  manifest_entry_t **aliases_tail = NULL, **maps_tail = NULL, *map = NULL;
+  unsigned long long content_hash, terminfo_hash, hash;
+  char *line = NULL;
+  size_t line_size = 0;
+  ssize_t length;
+  FILE *manifest;
+  int offset;
+
+  if ((manifest = fopen(name, "r")) == NULL) {
+    return NULL;
+  }
+  if ((length = getline(&line, &line_size, manifest)) < 0 ||
+      sscanf(line, MANIFEST_VERSION " %llx", &hash) != 1 || hash != settings) {
+    goto end;
+  }
+  while ((length = getline(&line, &line_size, manifest)) > 0) {
+    if (line[length - 1] == '\n') {
+      line[--length] = 0;
+    }
+    if (sscanf(line, "file %llx %llx %n", &content_hash, &terminfo_hash, &offset) == 2) {
+      file = safe_malloc(sizeof(manifest_file_t));
+      file->name = safe_strdup(line + offset);
+      file->content_hash = content_hash;
+      file->terminfo_hash = terminfo_hash;
+      file->aliases = file->maps = NULL;
+      file->next = NULL;
+      *files_tail = file;
+      files_tail = &file->next;
+      aliases_tail = &file->aliases;
+      maps_tail = &file->maps;
+      map = NULL;
+    } else if (file != NULL && strncmp(line, "alias ", 6) == 0) {
+      new_manifest_entry(line + 6, &aliases_tail);
+    } else if (file != NULL && sscanf(line, "map %llx %n", &hash, &offset) == 1) {
+      map = new_manifest_entry(line + offset, &maps_tail);
+      map->hash = hash;
+    } else if (map != NULL && strncmp(line, "message ", 8) == 0) {
+      line[length++] = '\n';
+      add_manifest_diagnostics(map, line + 8, length - 8);
+    }
+  }
+end:
+  free(line);
+  fclose(manifest);
+  return files;
+}
+
+/* Write the manifest @p name, for the files checked successfully. */
+static void write_manifest(const char *name, uint64_t settings, manifest_file_t **files,
+                           size_t count) {
+  manifest_entry_t *entry;
+  char *tmp_name;
+  FILE *manifest;
+  size_t i;
+
+  tmp_name = safe_malloc(strlen(name) + 5);
+  strcpy(tmp_name, name);
+  strcat(tmp_name, ".new");
+  if ((manifest = fopen(tmp_name, "w")) == NULL) {
+    fprintf(stderr, "Could not write manifest '%s': %s\n", tmp_name, strerror(errno));
+    free(tmp_name);
+    return;
+  }
+  fprintf(manifest, MANIFEST_VERSION " %016llx\n", (unsigned long long)settings);
+  for (i = 0; i < count; i++) {
+    if (files[i] == NULL) {
+      continue;
+    }
+    fprintf(manifest, "file %016llx %016llx %s\n", (unsigned long long)files[i]->content_hash,
+            (unsigned long long)files[i]->terminfo_hash, files[i]->name);
+    for (entry = files[i]->aliases; entry != NULL; entry = entry->next) {
+      fprintf(manifest, "alias %s\n", entry->name);
+    }
+    for (entry = files[i]->maps; entry != NULL; entry = entry->next) {
+      const char *message, *end;
+
+      fprintf(manifest, "map %016llx %s\n", (unsigned long long)entry->hash, entry->name);
+      for (message = entry->diagnostics; message != NULL && *message != 0; message = end + 1) {
+        if ((end = strchr(message, '\n')) == NULL) {
+          end = message + strlen(message);
+          fprintf(manifest, "message %s\n", message);
+          break;
+        }
+        fprintf(manifest, "message %.*s\n", (int)(end - message), message);
+      }
+    }
+  }
+  if (ferror(manifest) || fclose(manifest) != 0 || rename(tmp_name, name) == -1) {
+    fprintf(stderr, "Could not write manifest '%s': %s\n", name, strerror(errno));
+    remove(tmp_name);
+  }
+  free(tmp_name);
+}
+
+/*============== Checking all files in a directory ==============*/
+typedef struct {
+  char *input;
+  const char *term_name;
+  TERMINAL *terminal;
+  uint64_t terminfo_hash;
+  /* The entry for the file in the previous manifest, if any. */
+  manifest_file_t *previous;
+  /* The entry for the file in the new manifest, or NULL if checking failed. */
+  manifest_file_t *current;
+  /* The messages about the input, written by the worker thread. */
+  char *diagnostics;
+  size_t diagnostics_size;
+  bool failed;
+} job_t;
+
+static job_t *jobs;
+static size_t jobs_count, next_job;
+static pthread_mutex_t jobs_lock = PTHREAD_MUTEX_INITIALIZER;
+static const t3_config_schema_t *jobs_schema;
+
+/* Find the map named @p name with hash @p hash in @p file. */
+static manifest_entry_t *find_manifest_map(manifest_file_t *file, const char *name,
+                                           uint64_t hash) {
+  manifest_entry_t *entry;
+
+  for (entry = file == NULL ? NULL : file->maps; entry != NULL; entry = entry->next) {
+    if (entry->hash == hash && strcmp(entry->name, name) == 0) {
+      return entry;
+    }
+  }
+  return NULL;
+}
+
+/* Check the maps of @p map_config which changed since the previous manifest
+   entry, and record the maps and aliases in the new manifest entry. */
+static void check_changed_maps(job_t *job, t3_config_t *map_config) {
+  FILE *job_diagnostics = diagnostics;
+  manifest_entry_t **tail, *entry, *previous;
+  t3_config_t *maps = t3_config_get(map_config, "maps"), *map, *aka;
+
+  tail = &job->current->aliases;
+  for (aka = t3_config_get(t3_config_get(map_config, "aka"), NULL); aka != NULL;
+       aka = t3_config_get_next(aka)) {
+    new_manifest_entry(t3_config_get_string(aka), &tail);
+  }
+
+  tail = &job->current->maps;
+  for (map = t3_config_get(maps, NULL); map != NULL; map = t3_config_get_next(map)) {
+    if (t3_config_get_name(map)[0] == '_') continue;
+
+    entry = new_manifest_entry(t3_config_get_name(map), &tail);
+    entry->hash = hash_map(maps, map);
+    previous = job->previous != NULL && job->previous->terminfo_hash == job->terminfo_hash
+                   ? find_manifest_map(job->previous, entry->name, entry->hash)
+                   : NULL;
+    if (previous != NULL) {
+      entry->diagnostics = previous->diagnostics;
+      entry->diagnostics_size = previous->diagnostics_size;
+      previous->diagnostics = NULL;
+    } else {
+      if ((diagnostics = open_memstream(&entry->diagnostics, &entry->diagnostics_size)) ==
+          NULL) {
+        fatal("Out of memory\n");
+      }
+      check_map_rec(map_config, map, true);
+      clear_sequence_set();
+      fclose(diagnostics);
+      diagnostics = job_diagnostics;
+    }
+    if (entry->diagnostics != NULL) {
+      fwrite(entry->diagnostics, 1, entry->diagnostics_size, diagnostics);
+    }
+  }
+  free(sequences.entries);
+  sequences.entries = NULL;
+  sequences.mask = 0;
+}
+
+/* Check the input of @p job and create the symbolic links for its aliases.
+   If neither the input nor its terminfo entry changed since the previous
+   manifest, the messages are taken from the manifest. With -l/--link, only
+   the links are created. */
+static void run_job(job_t *job) {
+  manifest_file_t *previous = job->previous;
+  t3_config_t *map_config;
+  manifest_entry_t *entry;
+  uint64_t content_hash;
+
+  if ((diagnostics = open_memstream(&job->diagnostics, &job->diagnostics_size)) == NULL) {
+    fatal("Out of memory\n");
+  }
+  input = job->input;
+  if (option_link) {
+    if ((map_config = read_map_config(jobs_schema)) == NULL) {
+      job->failed = true;
+    } else {
+      create_symlinks(map_config, job->term_name);
+      t3_config_delete(map_config);
+    }
+    goto end;
+  }
+
+  terminal = job->terminal;
+  option_check_terminfo = terminal != NULL;
+  if (terminal == NULL) {
+    fprintf(diagnostics, "Could not find terminfo for %s\n", job->term_name);
+  }
+
+  if (!hash_file(&content_hash)) {
+    job->failed = true;
+    goto end;
+  }
+  job->current = safe_malloc(sizeof(manifest_file_t));
+  job->current->name = safe_strdup(job->term_name);
+  job->current->content_hash = content_hash;
+  job->current->terminfo_hash = job->terminfo_hash;
+  job->current->aliases = job->current->maps = NULL;
+  job->current->next = NULL;
+
+  if (previous != NULL && previous->content_hash == content_hash &&
+      previous->terminfo_hash == job->terminfo_hash) {
+    job->current->aliases = previous->aliases;
+    job->current->maps = previous->maps;
+    previous->aliases = previous->maps = NULL;
+    for (entry = job->current->maps; entry != NULL; entry = entry->next) {
+      if (entry->diagnostics != NULL) {
+        fwrite(entry->diagnostics, 1, entry->diagnostics_size, diagnostics);
+      }
+    }
+  } else if ((map_config = read_map_config(jobs_schema)) == NULL) {
+    free_manifest_file(job->current);
+    job->current = NULL;
+    job->failed = true;
+    goto end;
+  } else {
+    check_changed_maps(job, map_config);
+    t3_config_delete(map_config);
+  }
+  /* The links are always created, in case they were removed. */
+  for (entry = job->current->aliases; entry != NULL; entry = entry->next) {
+    create_symlink(entry->name, job->term_name);
+  }
+
+end:
+  fclose(diagnostics);
+}
+
+static void *worker(void *arg) {
+  (void)arg;
+
+  while (true) {
+    size_t job;
+
+    pthread_mutex_lock(&jobs_lock);
+    job = next_job++;
+    pthread_mutex_unlock(&jobs_lock);
+    if (job >= jobs_count) {
+      return NULL;
+    }
+    run_job(&jobs[job]);
+  }
+}
+
+static int select_database(const struct dirent *entry) {
+  return entry->d_name[0] != '.' && strcmp(entry->d_name, "libt3key.db") != 0;
+}
+
+/* Check all files in @p directory using a pool of worker threads, and create
+   the symbolic links for their aliases. The terminfo entries are loaded
+   before starting the threads, and the messages are printed per file, in
+   the order of the file names. Only the files which changed since the
+   previous run, according to the manifest, are checked again. With
+   -l/--link, the files are not checked, and the manifest is not used.
+   @return Whether all files could be read. */
+static bool check_all(const t3_config_schema_t *schema, const char *directory) {
+  struct dirent **entries;
+  manifest_file_t *manifest = NULL, *file, **files;
+  pthread_t *threads;
+  size_t threads_count, i;
+  int entries_count, j, err;
+  uint64_t settings = 0;
+  char *manifest_name = NULL;
+  bool success = true;
+
+  if ((entries_count = scandir(directory, &entries, select_database, alphasort)) < 0) {
+    fatal("Could not read directory '%s': %s\n", directory, strerror(errno));
+  }
+  if (!option_link) {
+    settings = hash_settings(directory);
+    manifest_name = safe_malloc(strlen(directory) + strlen(MANIFEST_NAME) + 2);
+    sprintf(manifest_name, "%s/" MANIFEST_NAME, directory);
+    manifest = read_manifest(manifest_name, settings);
+  }
+
+  jobs = safe_malloc((entries_count + 1) * sizeof(job_t));
+  for (j = 0; j < entries_count; j++) {
+    job_t *job = &jobs[jobs_count];
+    struct stat statbuf;
+
+    memset(job, 0, sizeof(job_t));
+    job->input = safe_malloc(strlen(directory) + strlen(entries[j]->d_name) + 2);
+    sprintf(job->input, "%s/%s", directory, entries[j]->d_name);
+    /* Symbolic links are recreated from the aka lists. */
+    if (lstat(job->input, &statbuf) != 0 || !S_ISREG(statbuf.st_mode)) {
+      free(job->input);
+      continue;
+    }
+    job->term_name = strrchr(job->input, '/') + 1;
+    if (!option_link && setupterm(job->term_name, 1, &err) == OK) {
+      job->terminfo_hash = hash_terminfo();
+      job->terminal = set_curterm(NULL);
+    }
+    for (file = manifest; file != NULL && strcmp(file->name, job->term_name) != 0;
+         file = file->next) {
+    }
+    job->previous = file;
+    jobs_count++;
+  }
+
+  threads_count = option_jobs > 0 ? (size_t)option_jobs : (size_t)sysconf(_SC_NPROCESSORS_ONLN);
+  if (threads_count < 1) {
+    threads_count = 1;
+  } else if (threads_count > jobs_count) {
+    threads_count = jobs_count;
+  }
+  jobs_schema = schema;
+  threads = safe_malloc((threads_count + 1) * sizeof(pthread_t));
+  for (i = 0; i < threads_count; i++) {
+    if ((err = pthread_create(&threads[i], NULL, worker, NULL)) != 0) {
+      fatal("Could not create thread: %s\n", strerror(err));
+    }
+  }
+  for (i = 0; i < threads_count; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  free(threads);
+
+  files = safe_malloc((jobs_count + 1) * sizeof(manifest_file_t *));
+  for (i = 0; i < jobs_count; i++) {
+    fwrite(jobs[i].diagnostics, 1, jobs[i].diagnostics_size, stderr);
+    if (jobs[i].failed) {
+      success = false;
+    }
+    files[i] = jobs[i].current;
+  }
+  if (manifest_name != NULL) {
+    write_manifest(manifest_name, settings, files, jobs_count);
+  }
+
+  for (i = 0; i < jobs_count; i++) {
+    if (jobs[i].terminal != NULL) {
+      del_curterm(jobs[i].terminal);
+    }
+    free_manifest_file(jobs[i].current);
+    free(jobs[i].diagnostics);
+    free(jobs[i].input);
+  }
+  free(files);
+  free(jobs);
+  while (manifest != NULL) {
+    file = manifest;
+    manifest = file->next;
+    free_manifest_file(file);
+  }
+  free(manifest_name);
+  for (j = 0; j < entries_count; j++) {
+    free(entries[j]);
+  }
+  free(entries);
+  return success;
+}
+
+int main(int argc, char *argv[]) {
+  t3_config_t *map_config;
+  t3_config_error_t error;
+  t3_config_schema_t *schema;
+  const char *term_name;
+  int err;
+
+  parse_options(argc, argv);
+  diagnostics = stderr;
 
   if ((schema = t3_config_read_schema_buffer(map_schema, sizeof(map_schema), &error, NULL)) == NULL)
     fatal("Internal schema contains an error: %s\n", t3_config_strerror(error.error));
 
-  if (!t3_config_validate(map_config, schema, &error, T3_CONFIG_VERBOSE_ERROR))
-    fatal("%s:%d: %s%s%s\n", input, error.line_number, t3_config_strerror(error.error),
-          error.extra == NULL ? "" : ": ", error.extra == NULL ? "" : error.extra);
+  if (option_all != NULL) {
+    bool success;
+
+    init_name_tables();
+    success = check_all(schema, option_all);
+    t3_config_delete_schema(schema);
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  if (option_compile != NULL) {
+    int i;
+
+    for (i = 0; i < inputs_count; i++) {
+      struct stat statbuf;
+
+      input = inputs[i];
+      /* Symbolic links are created for aliases, which are already included
+         through the aka list. */
+      if (lstat(input, &statbuf) == 0 && S_ISLNK(statbuf.st_mode)) {
+        if (option_verbose) {
+          fprintf(stderr, "Skipping symbolic link %s\n", input);
+        }
+        continue;
+      }
+      if ((map_config = read_map_config(schema)) == NULL) {
+        exit(EXIT_FAILURE);
+      }
+      compile_terminal(map_config, get_term_name());
+      t3_config_delete(map_config);
+    }
+    t3_config_delete_schema(schema);
+    write_db(option_compile);
+    return EXIT_SUCCESS;
+  }
+
+  if ((map_config = read_map_config(schema)) == NULL) {
+    exit(EXIT_FAILURE);
+  }
   t3_config_delete_schema(schema);
+  term_name = get_term_name();
 
-  if ((term_name = strrchr(input, '/')) == NULL) {
-    term_name = input;
-  } else {
-    term_name++;
+  if (option_flatten != NULL) {
+    write_flattened(map_config, option_flatten);
+    t3_config_delete(map_config);
+    return EXIT_SUCCESS;
   }
 
   if (option_link) {
@@ -544,7 +1828,10 @@ int main(int argc, char *argv[]) {
   if (setupterm(term_name, 1, &err) == ERR) {
     fprintf(stderr, "Could not find terminfo for %s\n", term_name);
     option_check_terminfo = false;
+  } else {
+    terminal = cur_term;
   }
+  init_name_tables();
   check_maps(map_config);
 
   t3_config_delete(map_config);
@@ -0,0 +1,1476 @@
+/* Copyright (C) 2018 G.P. Halkes
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAS_X86_SIMD
+#include <immintrin.h>
+#endif
+
+#include "decoder.h"
+
+#define RETURN_ERROR(_e)            \
+  do {                              \
+    if (error != NULL) *error = _e; \
+    goto return_error;              \
+  } while (0)
+
+/* The sequences of the map are stored in a trie. State 0 is the root, which
+   is never the target of an edge, such that 0 can be used for "no state". The
+   edges of each state are stored consecutively, sorted by byte. */
+typedef struct {
+  uint32_t accept; /* 1 + the index in keys of the sequence ending here, or 0. */
+  uint32_t edges;  /* Index of the first edge of the state. */
+  uint32_t edge_count;
+} trie_state_t;
+
+typedef struct {
+  const t3_key_node_t *node;
+  t3_key_id_t id;
+  int modifiers;
+} decoder_key_t;
+
+/* The maximum number of bytes, other than the C0 controls and DEL, which can
+   start a sequence for the vector versions of scan_text to be used. */
+#define MAX_EXTRA_STOPS 4
+
+/* The maximum length of a sequence with xterm-style modifier parameters. The
+   longest valid form is "\e[27;16;1114111~". */
+#define CSI_MAX_LENGTH 24
+/* The first final byte of a CSI sequence. */
+#define CSI_FINAL_FIRST 0x40
+#define CSI_FINAL_COUNT (0x7f - CSI_FINAL_FIRST)
+/* The number of "\e[<n>~" sequences which can be used as base for modifiers. */
+#define CSI_TILDE_COUNT 64
+/* The first parameter of the modifyOtherKeys form, "\e[27;<mod>;<code>~". */
+#define CSI_OTHER_KEYS 27
+
+/* The markers around pasted text when bracketed paste mode is enabled. */
+#define PASTE_START "\033[200~"
+#define PASTE_END "\033[201~"
+#define PASTE_MARKER_LENGTH 6
+
+/* The largest parameter accepted in the URXVT and SGR mouse encodings. This
+   limits the length of a report without leading zeros to 21 bytes, well below
+   T3_KEY_MOUSE_MAX_LENGTH. */
+#define MOUSE_MAX_PARAM 99999
+
+/* The size of the ring buffer used by t3_key_decoder_read. */
+#define RING_SIZE 65536
+
+typedef size_t (*scan_text_func_t)(const t3_key_decoder_t *decoder, const char *data,
+                                   size_t length);
+
+struct t3_key_decoder_t {
+  trie_state_t *states;
+  unsigned char *edge_bytes;
+  uint32_t *edge_targets;
+  decoder_key_t *keys;
+  /* The edges of the root, indexed by byte. Bytes which do not start a
+     sequence have value 0. */
+  uint32_t root[256];
+  /* The length of the longest sequence. */
+  size_t max_length;
+  int flags;
+
+  /* The keys without modifiers with sequences "\e[X" or "\eOX", indexed by
+     the final byte X, and with sequences "\e[<n>~", indexed by n. These are
+     the keys for which modifiers are decoded from the parameters of the
+     sequences "\e[1;<mod>X" and "\e[<n>;<mod>~". Entries are 1 + the index
+     in keys, or 0. */
+  uint32_t csi_keys[CSI_FINAL_COUNT];
+  uint32_t csi_tilde_keys[CSI_TILDE_COUNT];
+  int has_csi_keys;
+  const t3_key_node_t *map;
+  /* Whether the map has the _xterm_mouse node. */
+  int has_mouse;
+  /* The number of motion reports replaced by a later one. */
+  unsigned long coalesced;
+  /* Whether the input is pasted text, up to the paste end marker. */
+  int in_paste;
+  /* The limits set with t3_key_decoder_set_limits. A max_params of 0 means
+     no limit. */
+  size_t max_sequence_length;
+  int max_params;
+
+  /* The bytes which end a run of text: the C0 controls, DEL and all bytes
+     which start a sequence. The latter are also listed in extra_stops, if
+     there are at most MAX_EXTRA_STOPS of them. */
+  unsigned char stops[256];
+  unsigned char extra_stops[MAX_EXTRA_STOPS];
+  int extra_stop_count;
+  scan_text_func_t scan_text;
+
+  /* The input passed to t3_key_decoder_feed. */
+  const char *data;
+  size_t length, pos;
+
+  /* Bytes kept from previous input, because they may be the start of a
+     sequence. At most max_sequence_length - 1 bytes are kept. These are
+     stored in pending_buffer,
+     except when reading with t3_key_decoder_read, in which case pending
+     points to the part of the input up to the end of the ring buffer. */
+  const char *pending;
+  size_t pending_length, pending_pos;
+  char *pending_buffer;
+  /* The size of pending_buffer, excluding the byte for a nul terminator. */
+  size_t pending_size;
+  /* Buffer to return a sequence which is split over pending and data. */
+  char *sequence;
+
+  /* How the pending bytes match, and when they must be flushed. */
+  t3_key_match_t pending_match;
+  struct timespec deadline;
+  int timeout;
+
+  /* The ring buffer for t3_key_decoder_read, allocated on its first call.
+     The ring_length bytes from ring_start onwards, wrapping around at the end
+     of the buffer, have been read but not consumed yet. These bytes are
+     passed to decode_next as the pending bytes and the input, without copying
+     them. If ring_kept is set, they are kept until more input is read. */
+  char *ring;
+  size_t ring_start, ring_length;
+  int ring_kept;
+};
+
+/* A sequence from the map, while building the trie. */
+typedef struct {
+  const t3_key_node_t *node;
+  uint32_t index; /* Position of the node in the map. */
+} sequence_t;
+
+typedef struct {
+  t3_key_decoder_t *decoder;
+  const sequence_t *sequences;
+  uint32_t states_used, edges_used, keys_used;
+} trie_builder_t;
+
+static int compare_sequences(const void *a, const void *b) {
+  const sequence_t *seq_a = a, *seq_b = b;
+  size_t length = seq_a->node->string_length < seq_b->node->string_length
+                      ? seq_a->node->string_length
+                      : seq_b->node->string_length;
+  int result = memcmp(seq_a->node->string, seq_b->node->string, length);
+
+  if (result != 0) {
+    return result;
+  }
+  if (seq_a->node->string_length != seq_b->node->string_length) {
+    return seq_a->node->string_length < seq_b->node->string_length ? -1 : 1;
+  }
+  /* Equal sequences are ordered by position in the map, such that the first
+     occurrence is used. */
+  return seq_a->index < seq_b->index ? -1 : 1;
+}
+
+/** Build the trie state for the sorted sequences in [@p low, @p high).
+    @param depth The number of leading bytes which the sequences share.
+    @return The index of the new state.
+*/
+static uint32_t build_state(trie_builder_t *builder, size_t low, size_t high, size_t depth) {
+  t3_key_decoder_t *decoder = builder->decoder;
+  uint32_t state = builder->states_used++, edge;
+  size_t i, group;
+
+  decoder->states[state].accept = 0;
+  if (low < high && builder->sequences[low].node->string_length == depth) {
+    const t3_key_node_t *node = builder->sequences[low].node;
+    decoder_key_t *key = &decoder->keys[builder->keys_used++];
+
+    key->node = node;
+    key->id = t3_key_get_node_id(node, &key->modifiers);
+    decoder->states[state].accept = builder->keys_used;
+    /* Later duplicates of the sequence are ignored. */
+    while (low < high && builder->sequences[low].node->string_length == depth) {
+      low++;
+    }
+  }
+
+  decoder->states[state].edge_count = 0;
+  for (i = low; i < high; i++) {
+    if (i == low || builder->sequences[i].node->string[depth] !=
+                        builder->sequences[i - 1].node->string[depth]) {
+      decoder->states[state].edge_count++;
+    }
+  }
+  decoder->states[state].edges = builder->edges_used;
+  builder->edges_used += decoder->states[state].edge_count;
+
+  for (edge = decoder->states[state].edges; low < high; edge++, low = group) {
+    unsigned char byte = builder->sequences[low].node->string[depth];
+
+    for (group = low + 1;
+         group < high && (unsigned char)builder->sequences[group].node->string[depth] == byte;
+         group++) {
+    }
+    decoder->edge_bytes[edge] = byte;
+    decoder->edge_targets[edge] = build_state(builder, low, group, depth + 1);
+  }
+  return state;
+}
+
+/** Get the state reached from @p state on @p byte, or 0 if there is no such state. */
+static uint32_t next_state(const t3_key_decoder_t *decoder, uint32_t state, unsigned char byte) {
+  const trie_state_t *current = &decoder->states[state];
+  size_t low = current->edges, high = current->edges + current->edge_count;
+
+  if (state == 0) {
+    return decoder->root[byte];
+  }
+  while (low < high) {
+    size_t mid = low + (high - low) / 2;
+    if (decoder->edge_bytes[mid] == byte) {
+      return decoder->edge_targets[mid];
+    } else if (decoder->edge_bytes[mid] < byte) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  return 0;
+}
+
+/** Find the key with the sequence @p data.
+    @return 1 + the index in keys of the key, or 0 if @p data is not a sequence.
+*/
+static uint32_t find_sequence(const t3_key_decoder_t *decoder, const char *data, size_t length) {
+  uint32_t state = 0;
+  size_t i;
+
+  for (i = 0; i < length; i++) {
+    if ((state = next_state(decoder, state, data[i])) == 0) {
+      return 0;
+    }
+  }
+  return decoder->states[state].accept;
+}
+
+/** Fill csi_keys and csi_tilde_keys from the keys without modifiers in @p map. */
+static void find_csi_keys(t3_key_decoder_t *decoder, const t3_key_node_t *map) {
+  const t3_key_node_t *node;
+
+  for (node = map; node != NULL; node = node->next) {
+    const char *string = node->string;
+    size_t length = node->string_length;
+    uint32_t accept, *entry;
+    unsigned number = 0;
+    size_t i;
+
+    if (node->key[0] == '_' || length < 3 || string[0] != '\033' ||
+        (accept = find_sequence(decoder, string, length)) == 0 ||
+        decoder->keys[accept - 1].id == T3_KEY_ID_NONE ||
+        decoder->keys[accept - 1].modifiers != 0) {
+      continue;
+    }
+
+    /* Final byte '~' is used for the numbered sequences below. */
+    if (length == 3 && (string[1] == '[' || string[1] == 'O') &&
+        (unsigned char)string[2] >= CSI_FINAL_FIRST && string[2] < '~') {
+      entry = &decoder->csi_keys[string[2] - CSI_FINAL_FIRST];
+      /* The modified sequences use CSI, so the CSI form takes precedence. */
+      if (string[1] == 'O' && *entry != 0) {
+        continue;
+      }
+    } else if (string[1] == '[' && string[length - 1] == '~' && length > 3) {
+      for (i = 2;
+           i < length - 1 && string[i] >= '0' && string[i] <= '9' && number < CSI_TILDE_COUNT;
+           i++) {
+        number = number * 10 + string[i] - '0';
+      }
+      if (i < length - 1 || number >= CSI_TILDE_COUNT) {
+        continue;
+      }
+      entry = &decoder->csi_tilde_keys[number];
+    } else {
+      continue;
+    }
+    *entry = accept;
+    decoder->has_csi_keys = 1;
+  }
+}
+
+/** Find the first byte in @p data which ends a run of text.
+    @return The index of the byte, or @p length if there is no such byte.
+*/
+static size_t scan_text_scalar(const t3_key_decoder_t *decoder, const char *data, size_t length) {
+  size_t i;
+
+  for (i = 0; i < length && !decoder->stops[(unsigned char)data[i]]; i++) {
+  }
+  return i;
+}
+
+#ifdef HAS_X86_SIMD
+/* The C0 controls are the bytes with the top three bits clear. */
+__attribute__((target("sse2"))) static size_t scan_text_sse2(const t3_key_decoder_t *decoder,
+                                                             const char *data, size_t length) {
+  const __m128i high_bits = _mm_set1_epi8((char)0xe0), del = _mm_set1_epi8(0x7f);
+  __m128i extra_stops[MAX_EXTRA_STOPS];
+  int extra_stop_count = decoder->extra_stop_count, i;
+  size_t pos;
+
+  for (i = 0; i < extra_stop_count; i++) {
+    extra_stops[i] = _mm_set1_epi8((char)decoder->extra_stops[i]);
+  }
+
+  for (pos = 0; pos + 16 <= length; pos += 16) {
+    __m128i bytes = _mm_loadu_si128((const __m128i *)(data + pos));
+    __m128i stops = _mm_or_si128(
+        _mm_cmpeq_epi8(_mm_and_si128(bytes, high_bits), _mm_setzero_si128()),
+        _mm_cmpeq_epi8(bytes, del));
+    int mask;
+
+    for (i = 0; i < extra_stop_count; i++) {
+      stops = _mm_or_si128(stops, _mm_cmpeq_epi8(bytes, extra_stops[i]));
+    }
+    if ((mask = _mm_movemask_epi8(stops)) != 0) {
+      return pos + __builtin_ctz(mask);
+    }
+  }
+  return pos + scan_text_scalar(decoder, data + pos, length - pos);
+}
+
+__attribute__((target("avx2"))) static size_t scan_text_avx2(const t3_key_decoder_t *decoder,
+                                                             const char *data, size_t length) {
+  const __m256i high_bits = _mm256_set1_epi8((char)0xe0), del = _mm256_set1_epi8(0x7f);
+  __m256i extra_stops[MAX_EXTRA_STOPS];
+  int extra_stop_count = decoder->extra_stop_count, i;
+  size_t pos;
+
+  for (i = 0; i < extra_stop_count; i++) {
+    extra_stops[i] = _mm256_set1_epi8((char)decoder->extra_stops[i]);
+  }
+
+  for (pos = 0; pos + 32 <= length; pos += 32) {
+    __m256i bytes = _mm256_loadu_si256((const __m256i *)(data + pos));
+    __m256i stops = _mm256_or_si256(
+        _mm256_cmpeq_epi8(_mm256_and_si256(bytes, high_bits), _mm256_setzero_si256()),
+        _mm256_cmpeq_epi8(bytes, del));
+    unsigned mask;
+
+    for (i = 0; i < extra_stop_count; i++) {
+      stops = _mm256_or_si256(stops, _mm256_cmpeq_epi8(bytes, extra_stops[i]));
+    }
+    if ((mask = (unsigned)_mm256_movemask_epi8(stops)) != 0) {
+      return pos + __builtin_ctz(mask);
+    }
+  }
+  return pos + scan_text_sse2(decoder, data + pos, length - pos);
+}
+#endif
+
+/** Select the fastest version of scan_text supported by the CPU and the decoder. */
+static scan_text_func_t select_scan_text(const t3_key_decoder_t *decoder) {
+#ifdef HAS_X86_SIMD
+  if (!(decoder->flags & T3_KEY_DECODER_NO_SIMD) && decoder->extra_stop_count <= MAX_EXTRA_STOPS) {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+      return scan_text_avx2;
+    } else if (__builtin_cpu_supports("sse2")) {
+      return scan_text_sse2;
+    }
+  }
+#endif
+  return scan_text_scalar;
+}
+
+t3_key_decoder_t *t3_key_decoder_new(const t3_key_node_t *map, int *error) {
+  t3_key_decoder_t *decoder = NULL;
+  sequence_t *sequences = NULL;
+  trie_builder_t builder;
+  const t3_key_node_t *node;
+  size_t count = 0, total_length = 0, buffer_size, i;
+
+  for (node = map; node != NULL; node = node->next) {
+    if (node->key[0] != '_' && node->string_length > 0) {
+      count++;
+      total_length += node->string_length;
+    }
+  }
+
+  if ((decoder = calloc(1, sizeof(t3_key_decoder_t))) == NULL) {
+    RETURN_ERROR(T3_ERR_OUT_OF_MEMORY);
+  }
+  decoder->timeout = T3_KEY_DEFAULT_TIMEOUT;
+  /* Each byte of each sequence adds at most one state and one edge. */
+  if ((sequences = malloc((count + 1) * sizeof(sequence_t))) == NULL ||
+      (decoder->states = malloc((total_length + 1) * sizeof(trie_state_t))) == NULL ||
+      (decoder->edge_bytes = malloc(total_length + 1)) == NULL ||
+      (decoder->edge_targets = malloc((total_length + 1) * sizeof(uint32_t))) == NULL ||
+      (decoder->keys = malloc((count + 1) * sizeof(decoder_key_t))) == NULL) {
+    RETURN_ERROR(T3_ERR_OUT_OF_MEMORY);
+  }
+
+  for (node = map, i = 0; node != NULL; node = node->next) {
+    if (node->key[0] != '_' && node->string_length > 0) {
+      sequences[i].node = node;
+      sequences[i].index = i;
+      if (node->string_length > decoder->max_length) {
+        decoder->max_length = node->string_length;
+      }
+      i++;
+    }
+  }
+  qsort(sequences, count, sizeof(sequence_t), compare_sequences);
+
+  builder.decoder = decoder;
+  builder.sequences = sequences;
+  builder.states_used = 0;
+  builder.edges_used = 0;
+  builder.keys_used = 0;
+  build_state(&builder, 0, count, 0);
+  free(sequences);
+  sequences = NULL;
+
+  for (i = 0; i < 0x20; i++) {
+    decoder->stops[i] = 1;
+  }
+  decoder->stops[0x7f] = 1;
+  for (i = 0; i < decoder->states[0].edge_count; i++) {
+    unsigned char byte = decoder->edge_bytes[i];
+
+    decoder->root[byte] = decoder->edge_targets[i];
+    if (!decoder->stops[byte]) {
+      decoder->stops[byte] = 1;
+      if (decoder->extra_stop_count < MAX_EXTRA_STOPS) {
+        decoder->extra_stops[decoder->extra_stop_count] = byte;
+      }
+      decoder->extra_stop_count++;
+    }
+  }
+  decoder->scan_text = select_scan_text(decoder);
+
+  decoder->map = map;
+  find_csi_keys(decoder, map);
+  decoder->has_mouse = t3_key_get_named_node(map, "_xterm_mouse") != NULL;
+  buffer_size = decoder->max_length > CSI_MAX_LENGTH ? decoder->max_length : CSI_MAX_LENGTH;
+  /* Replies are the longest sequences which are not in the map. */
+  if (buffer_size < T3_KEY_REPLY_MAX_LENGTH) {
+    buffer_size = T3_KEY_REPLY_MAX_LENGTH;
+  }
+  if ((decoder->pending_buffer = malloc(buffer_size + 1)) == NULL ||
+      (decoder->sequence = malloc(buffer_size + 1)) == NULL) {
+    RETURN_ERROR(T3_ERR_OUT_OF_MEMORY);
+  }
+  decoder->pending = decoder->pending_buffer;
+  decoder->pending_size = buffer_size;
+  decoder->max_sequence_length = buffer_size;
+  return decoder;
+
+return_error:
+  free(sequences);
+  t3_key_decoder_free(decoder);
+  return NULL;
+}
+
+void t3_key_decoder_free(t3_key_decoder_t *decoder) {
+  if (decoder == NULL) {
+    return;
+  }
+  free(decoder->states);
+  free(decoder->edge_bytes);
+  free(decoder->edge_targets);
+  free(decoder->keys);
+  free(decoder->pending_buffer);
+  free(decoder->sequence);
+  free(decoder->ring);
+  free(decoder);
+}
+
+void t3_key_decoder_feed(t3_key_decoder_t *decoder, const char *data, size_t length) {
+  decoder->data = data;
+  decoder->length = length;
+  decoder->pos = 0;
+}
+
+/** Get byte @p offset of the remaining input, or -1 if the input is shorter. */
+static int input_byte(const t3_key_decoder_t *decoder, size_t offset) {
+  size_t pending_left = decoder->pending_length - decoder->pending_pos;
+
+  if (offset < pending_left) {
+    return (unsigned char)decoder->pending[decoder->pending_pos + offset];
+  }
+  offset -= pending_left;
+  if (offset < decoder->length - decoder->pos) {
+    return (unsigned char)decoder->data[decoder->pos + offset];
+  }
+  return -1;
+}
+
+/** Get byte @p offset of a sequence at the start of the remaining input.
+    @return The byte, or @c -1 if the input is shorter or if @p offset is beyond the longest
+        sequence allowed by t3_key_decoder_set_limits.
+
+    The parsers treat both cases as the end of the input. Input which is at
+    least as long as the limit is never kept, so at the limit they stop
+    without waiting for more input.
+*/
+static int sequence_byte(const t3_key_decoder_t *decoder, size_t offset) {
+  return offset < decoder->max_sequence_length ? input_byte(decoder, offset) : -1;
+}
+
+/** Get the number of bytes of the remaining input. */
+static size_t remaining_input(const t3_key_decoder_t *decoder) {
+  return decoder->pending_length - decoder->pending_pos + decoder->length - decoder->pos;
+}
+
+/** Check whether the decoder keeps bytes until more input arrives. */
+static int has_kept_input(const t3_key_decoder_t *decoder) {
+  if (decoder->ring != NULL) {
+    return decoder->ring_kept && remaining_input(decoder) > 0;
+  }
+  return decoder->pending_pos < decoder->pending_length;
+}
+
+/** Remove @p length bytes from the start of the remaining input. */
+static void consume_input(t3_key_decoder_t *decoder, size_t length) {
+  size_t pending_left = decoder->pending_length - decoder->pending_pos;
+
+  if (length <= pending_left) {
+    decoder->pending_pos += length;
+    return;
+  }
+  decoder->pending_pos = decoder->pending_length = 0;
+  decoder->pos += length - pending_left;
+}
+
+/** Keep all remaining input in the pending buffer, until more input arrives.
+    @param match How the remaining input matches.
+    @return @c 1 if the input was kept, or @c 0 if it is not shorter than the longest sequence
+        allowed by t3_key_decoder_set_limits.
+
+    When reading with t3_key_decoder_read, the input is left in the ring
+    buffer instead. This is the only place where input is kept, for all types
+    of sequences. Input which is refused has been examined up to the limit by
+    all parsers, so the caller decodes it as if no more input will arrive.
+*/
+static int keep_input(t3_key_decoder_t *decoder, t3_key_match_t match) {
+  size_t pending_left = decoder->pending_length - decoder->pending_pos;
+
+  if (remaining_input(decoder) >= decoder->max_sequence_length) {
+    return 0;
+  }
+  decoder->pending_match = match;
+  clock_gettime(CLOCK_MONOTONIC, &decoder->deadline);
+  decoder->deadline.tv_sec += decoder->timeout / 1000;
+  decoder->deadline.tv_nsec += (long)(decoder->timeout % 1000) * 1000000;
+  if (decoder->deadline.tv_nsec >= 1000000000) {
+    decoder->deadline.tv_sec++;
+    decoder->deadline.tv_nsec -= 1000000000;
+  }
+
+  if (decoder->ring != NULL) {
+    decoder->ring_kept = 1;
+    return 1;
+  }
+  memmove(decoder->pending_buffer, decoder->pending + decoder->pending_pos, pending_left);
+  memcpy(decoder->pending_buffer + pending_left, decoder->data + decoder->pos,
+         decoder->length - decoder->pos);
+  decoder->pending = decoder->pending_buffer;
+  decoder->pending_length = pending_left + decoder->length - decoder->pos;
+  decoder->pending_pos = 0;
+  decoder->pos = decoder->length;
+  return 1;
+}
+
+/** Compare the remaining input at byte @p offset with @p string.
+    @return @c 1 if the input starts with @p string, @c 0 if the input ends before a mismatch, or
+        @c -1 if the input does not start with @p string.
+*/
+static int input_matches(const t3_key_decoder_t *decoder, size_t offset, const char *string) {
+  size_t i;
+  int byte;
+
+  for (i = 0; string[i] != 0; i++) {
+    if ((byte = input_byte(decoder, offset + i)) < 0) {
+      return 0;
+    }
+    if (byte != (unsigned char)string[i]) {
+      return -1;
+    }
+  }
+  return 1;
+}
+
+/** Get the contiguous part at the start of the remaining input.
+
+    This is either the rest of the pending buffer or the rest of the input
+    buffer, such that it can be returned without copying.
+*/
+static const char *contiguous_input(const t3_key_decoder_t *decoder, size_t *available) {
+  if (decoder->pending_pos < decoder->pending_length) {
+    *available = decoder->pending_length - decoder->pending_pos;
+    return decoder->pending + decoder->pending_pos;
+  }
+  *available = decoder->length - decoder->pos;
+  return decoder->data + decoder->pos;
+}
+
+/** Store a text event for the run of bytes at the start of the remaining input.
+
+    If the first byte is a C0 control, DEL or a byte which starts a sequence,
+    the run consists of only that byte. Otherwise, it consists of all bytes up
+    to the next such byte. The run is limited to either the pending buffer or
+    the input buffer, such that it can be returned without copying.
+*/
+static void text_event(t3_key_decoder_t *decoder, t3_key_event_t *event) {
+  size_t available, length;
+  const char *start = contiguous_input(decoder, &available);
+
+  if (decoder->stops[(unsigned char)start[0]]) {
+    length = 1;
+  } else {
+    length = 1 + decoder->scan_text(decoder, start + 1, available - 1);
+  }
+
+  event->type = T3_KEY_EVENT_TEXT;
+  event->data = start;
+  event->length = length;
+  event->node = NULL;
+  event->id = T3_KEY_ID_NONE;
+  event->modifiers = 0;
+  event->character = 0;
+  consume_input(decoder, length);
+}
+
+/* The parser for sequences with xterm-style modifier parameters. */
+typedef struct {
+  size_t length;
+  int param_count;
+  int digits; /* Whether the current parameter has any digits. */
+  unsigned long params[3];
+  int final;
+} csi_parser_t;
+
+typedef enum { CSI_MORE, CSI_DONE, CSI_FAIL } csi_result_t;
+
+/** Pass the next byte to a parser for sequences with modifier parameters.
+    @return ::CSI_MORE if more bytes are required, ::CSI_DONE if @p byte ends the sequence, or
+        ::CSI_FAIL if the bytes are not the start of such a sequence.
+
+    The sequences consist of "\e[" followed by two or three numeric parameters separated by
+    semicolons, and a final byte. Whether a key exists for the sequence is checked with
+    resolve_csi.
+*/
+static csi_result_t csi_step(csi_parser_t *parser, int byte) {
+  size_t position = parser->length++;
+
+  if (position == 0) {
+    parser->param_count = 1;
+    parser->digits = 0;
+    parser->params[0] = 0;
+    return byte == '\033' ? CSI_MORE : CSI_FAIL;
+  } else if (position == 1) {
+    return byte == '[' ? CSI_MORE : CSI_FAIL;
+  } else if (position >= CSI_MAX_LENGTH) {
+    return CSI_FAIL;
+  }
+
+  if (byte >= '0' && byte <= '9') {
+    unsigned long *param = &parser->params[parser->param_count - 1];
+    *param = *param * 10 + byte - '0';
+    parser->digits = 1;
+    return *param > 0x10ffff ? CSI_FAIL : CSI_MORE;
+  } else if (!parser->digits) {
+    return CSI_FAIL;
+  } else if (byte == ';') {
+    if (parser->param_count == 3) {
+      return CSI_FAIL;
+    }
+    parser->params[parser->param_count++] = 0;
+    parser->digits = 0;
+    return CSI_MORE;
+  } else if (byte >= CSI_FINAL_FIRST && byte < 0x7f && parser->param_count > 1) {
+    parser->final = byte;
+    return CSI_DONE;
+  }
+  return CSI_FAIL;
+}
+
+/** Fill the key fields of @p event for the sequence parsed by @p parser.
+    @return @c 1 if the sequence is a key, @c 0 otherwise.
+*/
+static int resolve_csi(const t3_key_decoder_t *decoder, const csi_parser_t *parser,
+                       t3_key_event_t *event) {
+  unsigned long modifiers = parser->params[1] - 1;
+  uint32_t accept = 0;
+
+  if (decoder->max_params > 0 && parser->param_count > decoder->max_params) {
+    return 0;
+  }
+  /* The modifier parameter is 1 + a bit mask of shift (1), alt (2), control
+     (4) and meta (8). Both alt and meta map to T3_KEY_MOD_META. */
+  if (parser->params[1] < 1 || parser->params[1] > 16) {
+    return 0;
+  }
+  event->modifiers = ((modifiers & 1) ? T3_KEY_MOD_SHIFT : 0) |
+                     ((modifiers & 10) ? T3_KEY_MOD_META : 0) |
+                     ((modifiers & 4) ? T3_KEY_MOD_CTRL : 0);
+  event->character = 0;
+
+  if (parser->final != '~') {
+    if (parser->param_count == 2 && parser->params[0] == 1) {
+      accept = decoder->csi_keys[parser->final - CSI_FINAL_FIRST];
+    }
+  } else if (parser->param_count == 2) {
+    if (parser->params[0] < CSI_TILDE_COUNT) {
+      accept = decoder->csi_tilde_keys[parser->params[0]];
+    }
+  } else if (parser->params[0] == CSI_OTHER_KEYS) {
+    /* The modifyOtherKeys form. Only the characters which are keys in their
+       own right are reported as keys. */
+    switch (parser->params[2]) {
+      case '\t':
+        event->id = T3_KEY_ID_TAB;
+        break;
+      case '\r':
+        event->id = T3_KEY_ID_ENTER;
+        break;
+      case '\b':
+      case 0x7f:
+        event->id = T3_KEY_ID_BACKSPACE;
+        break;
+      default:
+        event->type = T3_KEY_EVENT_CHAR;
+        event->node = NULL;
+        event->id = T3_KEY_ID_NONE;
+        event->character = parser->params[2];
+        return 1;
+    }
+    event->type = T3_KEY_EVENT_KEY;
+    event->node = t3_key_lookup(decoder->map, event->id, event->modifiers);
+    return 1;
+  }
+
+  if (accept == 0) {
+    return 0;
+  }
+  event->type = T3_KEY_EVENT_KEY;
+  event->id = decoder->keys[accept - 1].id;
+  event->node = t3_key_lookup(decoder->map, event->id, event->modifiers);
+  return 1;
+}
+
+/** Decode a coordinate or button value of an X10 or UTF-8 encoded mouse report.
+    @return The number of bytes used, @c 0 if @p length is too short, or @c -1 if the bytes are not
+        a valid value.
+
+    Values are offset by 32. In the UTF-8 encoding used by xterm, values up to
+    2047 are sent as one or two byte UTF-8 sequences.
+*/
+static int mouse_value(const unsigned char *data, size_t length, int flags, int *value) {
+  if (length == 0) {
+    return 0;
+  }
+  if (!(flags & T3_KEY_DECODER_MOUSE_UTF8) || data[0] < 0x80) {
+    *value = data[0] - 32;
+    return 1;
+  }
+  if (data[0] < 0xc2 || data[0] > 0xdf) {
+    return -1;
+  }
+  if (length < 2) {
+    return 0;
+  }
+  if ((data[1] & 0xc0) != 0x80) {
+    return -1;
+  }
+  *value = (((data[0] & 0x1f) << 6) | (data[1] & 0x3f)) - 32;
+  return 2;
+}
+
+/** Parse a mouse report, without limiting its length. See ::t3_key_parse_mouse. */
+static int parse_mouse(const char *data, size_t length, int flags, t3_key_mouse_t *mouse) {
+  const unsigned char *bytes = (const unsigned char *)data;
+  int values[3], count, release = 0, used;
+  size_t pos;
+
+  for (pos = 0; pos < 2; pos++) {
+    if (pos == length) {
+      return 0;
+    }
+    if (bytes[pos] != "\033["[pos]) {
+      return -1;
+    }
+  }
+  if (pos == length) {
+    return 0;
+  }
+
+  if (bytes[pos] == 'M') {
+    /* X10 and UTF-8 encodings: "\e[M" followed by the button, column and row. */
+    for (pos++, count = 0; count < 3; count++, pos += used) {
+      if ((used = mouse_value(bytes + pos, length - pos, flags, &values[count])) <= 0) {
+        return used;
+      }
+    }
+  } else {
+    /* SGR encoding "\e[<b;x;yM" or "\e[<b;x;ym" for releases, and URXVT encoding
+       "\e[b;x;yM" with the button offset by 32. */
+    int sgr = bytes[pos] == '<';
+
+    if (sgr) {
+      pos++;
+    }
+    for (count = 0; count < 3; count++, pos++) {
+      size_t start = pos;
+
+      values[count] = 0;
+      for (; pos < length && bytes[pos] >= '0' && bytes[pos] <= '9'; pos++) {
+        values[count] = values[count] * 10 + bytes[pos] - '0';
+        if (values[count] > MOUSE_MAX_PARAM) {
+          return -1;
+        }
+      }
+      if (pos == length) {
+        return 0;
+      }
+      if (pos == start || bytes[pos] != (count < 2 ? ';' : 'M')) {
+        if (count == 2 && sgr && pos > start && bytes[pos] == 'm') {
+          release = 1;
+        } else {
+          return -1;
+        }
+      }
+    }
+    if (!sgr) {
+      values[0] -= 32;
+    }
+  }
+
+  if (values[0] < 0) {
+    return -1;
+  }
+  /* The low two bits of the button value are the button, or 3 for a release
+     of an unknown button. The next three bits are the modifiers, bit 5 marks
+     motion, and bits 6 and 7 select the wheel and additional buttons. */
+  if (values[0] & 128) {
+    mouse->button = 8 + (values[0] & 3);
+  } else if (values[0] & 64) {
+    mouse->button = 4 + (values[0] & 3);
+  } else {
+    mouse->button = (values[0] & 3) == 3 ? 0 : (values[0] & 3) + 1;
+  }
+  if (release) {
+    mouse->type = T3_KEY_MOUSE_RELEASE;
+  } else if (values[0] & 32) {
+    mouse->type = T3_KEY_MOUSE_MOTION;
+  } else {
+    mouse->type = mouse->button == 0 ? T3_KEY_MOUSE_RELEASE : T3_KEY_MOUSE_PRESS;
+  }
+  mouse->modifiers = ((values[0] & 4) ? T3_KEY_MOD_SHIFT : 0) |
+                     ((values[0] & 8) ? T3_KEY_MOD_META : 0) |
+                     ((values[0] & 16) ? T3_KEY_MOD_CTRL : 0);
+  /* Coordinates start at 1. xterm sends 0 for coordinates it can not
+     encode. */
+  mouse->x = values[1] > 0 ? values[1] - 1 : -1;
+  mouse->y = values[2] > 0 ? values[2] - 1 : -1;
+  return pos;
+}
+
+int t3_key_parse_mouse(const char *data, size_t length, int flags, t3_key_mouse_t *mouse) {
+  int result;
+
+  /* The parameters may have any number of leading zeros, so limiting their
+     values does not limit the length of a report. */
+  if (length < T3_KEY_MOUSE_MAX_LENGTH) {
+    return parse_mouse(data, length, flags, mouse);
+  }
+  result = parse_mouse(data, T3_KEY_MOUSE_MAX_LENGTH, flags, mouse);
+  return result == 0 ? -1 : result;
+}
+
+/** Parse a mouse report at byte @p offset of the remaining input.
+    @return The result of ::t3_key_parse_mouse, for at most the number of bytes allowed by
+        t3_key_decoder_set_limits.
+*/
+static int mouse_report(const t3_key_decoder_t *decoder, size_t offset, t3_key_mouse_t *mouse) {
+  char report[T3_KEY_MOUSE_MAX_LENGTH];
+  size_t length, max_length = decoder->max_sequence_length;
+  int byte;
+
+  if (input_byte(decoder, offset) != '\033') {
+    return -1;
+  }
+  if (decoder->pending_pos == decoder->pending_length) {
+    length = decoder->length - decoder->pos - offset;
+    return t3_key_parse_mouse(decoder->data + decoder->pos + offset,
+                              length < max_length ? length : max_length, decoder->flags, mouse);
+  }
+  if (max_length > T3_KEY_MOUSE_MAX_LENGTH) {
+    max_length = T3_KEY_MOUSE_MAX_LENGTH;
+  }
+  for (length = 0; length < max_length && (byte = input_byte(decoder, offset + length)) >= 0;
+       length++) {
+    report[length] = byte;
+  }
+  return t3_key_parse_mouse(report, length, decoder->flags, mouse);
+}
+
+/** Get a pointer to the first @p length bytes of the remaining input.
+
+    If the bytes are split over the pending buffer and the input buffer, they
+    are copied to the sequence buffer.
+*/
+static const char *sequence_data(t3_key_decoder_t *decoder, size_t length) {
+  size_t offset;
+
+  if (decoder->pending_pos == decoder->pending_length) {
+    return decoder->data + decoder->pos;
+  } else if (decoder->pending_length - decoder->pending_pos >= length) {
+    return decoder->pending + decoder->pending_pos;
+  }
+  for (offset = 0; offset < length; offset++) {
+    decoder->sequence[offset] = input_byte(decoder, offset);
+  }
+  return decoder->sequence;
+}
+
+/** Parse a reply from the terminal at the start of the remaining input.
+    @return The length of the reply, @c 0 if the input ends before the end of the reply, or @c -1
+        if the input does not start with a reply.
+
+    The type and the reply field of @p event are set, except for the string,
+    which is set once the data of the event is known.
+*/
+static int parse_reply(const t3_key_decoder_t *decoder, t3_key_event_t *event) {
+  t3_key_reply_t *reply = &event->reply;
+  int byte, introducer, digits = 0, empty = 0, params = 0;
+  long value = 0;
+  size_t pos;
+
+  if (input_byte(decoder, 0) != '\033') {
+    return -1;
+  }
+  if ((byte = input_byte(decoder, 1)) < 0) {
+    return 0;
+  }
+  reply->param_count = 0;
+  reply->string = NULL;
+  reply->string_length = 0;
+
+  if (byte == ']') {
+    /* OSC: text ended by BEL or ST. The number at the start of the text
+       identifies the command. */
+    for (pos = 2; pos < T3_KEY_REPLY_MAX_LENGTH; pos++) {
+      if ((byte = sequence_byte(decoder, pos)) < 0) {
+        return 0;
+      }
+      if (byte == '\a' || byte == '\033') {
+        break;
+      }
+      if (byte >= '0' && byte <= '9' && digits == (int)pos - 2 && value < INT_MAX / 10) {
+        value = value * 10 + byte - '0';
+        digits++;
+      }
+    }
+    if (pos == T3_KEY_REPLY_MAX_LENGTH) {
+      return -1;
+    }
+    event->type = T3_KEY_EVENT_OSC;
+    if (digits > 0) {
+      reply->params[reply->param_count++] = value;
+    }
+    reply->string_length = pos - 2;
+    if (byte == '\a') {
+      return pos + 1;
+    } else if (pos + 2 > T3_KEY_REPLY_MAX_LENGTH) {
+      /* The string terminator is two bytes long. */
+      return -1;
+    }
+    byte = sequence_byte(decoder, pos + 1);
+    return byte == '\\' ? (int)pos + 2 : byte < 0 ? 0 : -1;
+  } else if (byte != '[') {
+    return -1;
+  }
+
+  if ((introducer = sequence_byte(decoder, 2)) < 0) {
+    return 0;
+  } else if (introducer == 'I' || introducer == 'O') {
+    event->type = introducer == 'I' ? T3_KEY_EVENT_FOCUS_IN : T3_KEY_EVENT_FOCUS_OUT;
+    return 3;
+  }
+
+  /* CPR and DA: numeric parameters separated by semicolons. */
+  for (pos = introducer == '?' || introducer == '>' ? 3 : 2; pos < T3_KEY_REPLY_MAX_LENGTH;
+       pos++) {
+    if ((byte = sequence_byte(decoder, pos)) < 0) {
+      return 0;
+    }
+    if (byte >= '0' && byte <= '9') {
+      if ((value = value * 10 + byte - '0') > INT_MAX / 10) {
+        return -1;
+      }
+      digits = 1;
+      continue;
+    }
+    if (byte != ';' && !digits && params == 0) {
+      break;
+    }
+    if (++params > decoder->max_params && decoder->max_params > 0) {
+      return -1;
+    }
+    if (reply->param_count < T3_KEY_REPLY_MAX_PARAMS) {
+      reply->params[reply->param_count++] = value;
+    }
+    empty |= !digits;
+    value = 0;
+    digits = 0;
+    if (byte != ';') {
+      break;
+    }
+  }
+
+  if (pos == T3_KEY_REPLY_MAX_LENGTH) {
+    return -1;
+  } else if (introducer == '?' || introducer == '>') {
+    if (byte != 'c') {
+      return -1;
+    }
+    event->type = introducer == '?' ? T3_KEY_EVENT_PRIMARY_DA : T3_KEY_EVENT_SECONDARY_DA;
+  } else if (byte == 'R' && reply->param_count == 2 && !empty) {
+    event->type = T3_KEY_EVENT_CURSOR_POSITION;
+  } else {
+    return -1;
+  }
+  return pos + 1;
+}
+
+/** Set the fields of @p event for a paste event of @p length bytes, and consume the bytes. */
+static void paste_event(t3_key_decoder_t *decoder, t3_key_event_t *event, t3_key_event_type_t type,
+                        const char *data, size_t length) {
+  event->type = type;
+  event->data = data;
+  event->length = length;
+  event->node = NULL;
+  event->id = T3_KEY_ID_NONE;
+  event->modifiers = 0;
+  event->character = 0;
+  consume_input(decoder, length);
+}
+
+/** Decode the next event from the remaining input, inside pasted text.
+    @param final Whether the input ends after the remaining input.
+    @return @c 1 if an event was stored in @p event, @c 0 if more input is required.
+
+    The pasted text is returned as runs of bytes up to the next escape
+    character which may start the paste end marker, without matching any
+    sequences.
+*/
+static int decode_paste(t3_key_decoder_t *decoder, t3_key_event_t *event, int final) {
+  size_t available, pos;
+  const char *start = contiguous_input(decoder, &available), *escape;
+  int match = -1;
+
+  for (pos = 0; pos < available; pos++) {
+    if ((escape = memchr(start + pos, '\033', available - pos)) == NULL) {
+      pos = available;
+      break;
+    }
+    pos = escape - start;
+    if ((match = input_matches(decoder, pos, PASTE_END)) >= 0) {
+      break;
+    }
+  }
+
+  if (pos > 0) {
+    paste_event(decoder, event, T3_KEY_EVENT_PASTE, start, pos);
+  } else if (match == 1) {
+    decoder->in_paste = 0;
+    paste_event(decoder, event, T3_KEY_EVENT_PASTE_END, sequence_data(decoder, PASTE_MARKER_LENGTH),
+                PASTE_MARKER_LENGTH);
+  } else if (!final && keep_input(decoder, T3_KEY_MATCH_PREFIX)) {
+    return 0;
+  } else {
+    /* The input ended in what may have been the start of the end marker. */
+    paste_event(decoder, event, T3_KEY_EVENT_PASTE, start, available);
+  }
+  return 1;
+}
+
+/** Decode the next event from the remaining input.
+    @param final Whether the input ends after the remaining input.
+    @return @c 1 if an event was stored in @p event, @c 0 if more input is required.
+*/
+static int decode_next(t3_key_decoder_t *decoder, t3_key_event_t *event, int final) {
+  const decoder_key_t *key;
+  t3_key_event_t csi_event, reply_event;
+  uint32_t state = 0, accept = 0;
+  size_t accept_length = 0, csi_length = 0, reply_length = 0, offset;
+  int byte, result, incomplete = 0;
+
+  if (input_byte(decoder, 0) < 0) {
+    return 0;
+  }
+
+  if (decoder->in_paste) {
+    return decode_paste(decoder, event, final);
+  }
+  switch (input_matches(decoder, 0, PASTE_START)) {
+    case 1:
+      decoder->in_paste = 1;
+      paste_event(decoder, event, T3_KEY_EVENT_PASTE_START,
+                  sequence_data(decoder, PASTE_MARKER_LENGTH), PASTE_MARKER_LENGTH);
+      return 1;
+    case 0:
+      incomplete = 1;
+      break;
+    default:
+      break;
+  }
+
+  if (decoder->has_mouse) {
+    t3_key_mouse_t next;
+    int next_result;
+
+    result = mouse_report(decoder, 0, &event->mouse);
+
+    if (result > 0) {
+      /* Replace motion reports by the motion reports directly following them
+         which have the same buttons and modifiers. Reports which are not
+         complete yet are not waited for. */
+      while ((decoder->flags & T3_KEY_DECODER_COALESCE_MOTION) &&
+             event->mouse.type == T3_KEY_MOUSE_MOTION &&
+             (next_result = mouse_report(decoder, result, &next)) > 0 &&
+             next.type == T3_KEY_MOUSE_MOTION && next.button == event->mouse.button &&
+             next.modifiers == event->mouse.modifiers) {
+        consume_input(decoder, result);
+        event->mouse = next;
+        result = next_result;
+        decoder->coalesced++;
+      }
+      event->type = T3_KEY_EVENT_MOUSE;
+      event->data = sequence_data(decoder, result);
+      event->length = result;
+      event->node = NULL;
+      event->id = T3_KEY_ID_NONE;
+      event->modifiers = event->mouse.modifiers;
+      event->character = 0;
+      consume_input(decoder, result);
+      return 1;
+    }
+    incomplete |= result == 0;
+  }
+
+  /* Find the longest sequence at the start of the input. */
+  for (offset = 0;; offset++) {
+    if ((byte = sequence_byte(decoder, offset)) < 0) {
+      incomplete = 1;
+      break;
+    }
+    if ((state = next_state(decoder, state, byte)) == 0) {
+      break;
+    }
+    if (decoder->states[state].accept != 0) {
+      accept = decoder->states[state].accept;
+      accept_length = offset + 1;
+    }
+    if (decoder->states[state].edge_count == 0) {
+      break;
+    }
+  }
+
+  /* Sequences with modifier parameters are only used if they are longer
+     than the sequence from the map, i.e. if the map does not list them. */
+  if (decoder->has_csi_keys && !(decoder->flags & T3_KEY_DECODER_NO_CSI_MODIFIERS)) {
+    csi_parser_t parser;
+    csi_result_t result = CSI_MORE;
+
+    parser.length = 0;
+    for (offset = 0; result == CSI_MORE; offset++) {
+      if ((byte = sequence_byte(decoder, offset)) < 0) {
+        incomplete = 1;
+        break;
+      }
+      result = csi_step(&parser, byte);
+    }
+    if (result == CSI_DONE && parser.length > accept_length &&
+        resolve_csi(decoder, &parser, &csi_event)) {
+      csi_length = parser.length;
+    }
+  }
+
+  /* Replies are only used if they are longer than the key sequences, except
+     for cursor position reports while they are expected. */
+  if ((result = parse_reply(decoder, &reply_event)) == 0) {
+    incomplete = 1;
+  } else if (result > 0 &&
+             (((size_t)result > accept_length && (size_t)result > csi_length) ||
+              (reply_event.type == T3_KEY_EVENT_CURSOR_POSITION &&
+               (decoder->flags & T3_KEY_DECODER_CURSOR_REPORT)))) {
+    reply_length = result;
+  }
+
+  if (incomplete && !final) {
+    offset = remaining_input(decoder);
+    if (keep_input(decoder, accept_length == offset || csi_length == offset
+                                ? T3_KEY_MATCH_AMBIGUOUS
+                                : T3_KEY_MATCH_PREFIX)) {
+      return 0;
+    }
+  }
+
+  if (reply_length > 0) {
+    event->type = reply_event.type;
+    event->data = sequence_data(decoder, reply_length);
+    event->length = reply_length;
+    event->node = NULL;
+    event->id = T3_KEY_ID_NONE;
+    event->modifiers = 0;
+    event->character = 0;
+    event->reply = reply_event.reply;
+    if (event->type == T3_KEY_EVENT_OSC) {
+      event->reply.string = event->data + 2;
+    }
+    consume_input(decoder, reply_length);
+    return 1;
+  }
+
+  if (csi_length > 0) {
+    *event = csi_event;
+    event->data = sequence_data(decoder, csi_length);
+    event->length = csi_length;
+    consume_input(decoder, csi_length);
+    return 1;
+  }
+
+  if (accept == 0) {
+    text_event(decoder, event);
+    return 1;
+  }
+
+  key = &decoder->keys[accept - 1];
+  event->type = T3_KEY_EVENT_KEY;
+  event->data = sequence_data(decoder, accept_length);
+  event->length = accept_length;
+  event->node = key->node;
+  event->id = key->id;
+  event->modifiers = key->modifiers;
+  event->character = 0;
+  consume_input(decoder, accept_length);
+  return 1;
+}
+
+int t3_key_decoder_next(t3_key_decoder_t *decoder, t3_key_event_t *event) {
+  return decode_next(decoder, event, 0);
+}
+
+int t3_key_decoder_flush(t3_key_decoder_t *decoder, t3_key_event_t *event) {
+  return decode_next(decoder, event, 1);
+}
+
+size_t t3_key_decoder_decode(t3_key_decoder_t *decoder, const char *data, size_t length,
+                             t3_key_event_t *events, size_t max_events) {
+  size_t count = 0;
+  int from_pending;
+
+  if (data != NULL) {
+    t3_key_decoder_feed(decoder, data, length);
+  }
+  while (count < max_events) {
+    from_pending = decoder->pending_pos < decoder->pending_length;
+    if (!decode_next(decoder, &events[count], 0)) {
+      break;
+    }
+    count++;
+    /* The data of events from kept bytes is overwritten when more bytes are
+       kept, so such events end the batch. */
+    if (from_pending) {
+      break;
+    }
+  }
+  return count;
+}
+
+/** Pass the unconsumed bytes in the ring buffer to decode_next.
+
+    The bytes up to the end of the ring buffer take the place of the pending
+    bytes, and the bytes which wrapped around to the start of the ring buffer
+    are the input.
+*/
+static void feed_ring(t3_key_decoder_t *decoder) {
+  size_t first = RING_SIZE - decoder->ring_start;
+
+  if (decoder->ring_length <= first) {
+    decoder->pending_length = 0;
+    decoder->data = decoder->ring + decoder->ring_start;
+    decoder->length = decoder->ring_length;
+  } else {
+    decoder->pending = decoder->ring + decoder->ring_start;
+    decoder->pending_length = first;
+    decoder->data = decoder->ring;
+    decoder->length = decoder->ring_length - first;
+  }
+  decoder->pending_pos = 0;
+  decoder->pos = 0;
+}
+
+int t3_key_decoder_read(t3_key_decoder_t *decoder, int fd, t3_key_event_t *event) {
+  struct iovec iov[2];
+  size_t remaining, end;
+  ssize_t result;
+
+  if (decoder->ring == NULL && (decoder->ring = malloc(RING_SIZE)) == NULL) {
+    return T3_ERR_OUT_OF_MEMORY;
+  }
+
+  /* Release the bytes consumed since the previous call, and decode the
+     remaining bytes, unless they were kept already. */
+  remaining = remaining_input(decoder);
+  if (remaining != decoder->ring_length) {
+    decoder->ring_start = (decoder->ring_start + decoder->ring_length - remaining) % RING_SIZE;
+    decoder->ring_length = remaining;
+    decoder->ring_kept = 0;
+  }
+  if (remaining == 0) {
+    decoder->ring_start = 0;
+  }
+  feed_ring(decoder);
+  if (!decoder->ring_kept && decode_next(decoder, event, 0)) {
+    return 1;
+  }
+
+  /* Only the kept bytes remain, so the free space is at least RING_SIZE minus
+     the size of the pending buffer. It consists of the bytes up to the end of
+     the ring buffer and the bytes before the kept bytes, if these are not at
+     the start of the ring buffer. */
+  end = decoder->ring_start + decoder->ring_length;
+  if (end < RING_SIZE) {
+    iov[0].iov_base = decoder->ring + end;
+    iov[0].iov_len = RING_SIZE - end;
+    iov[1].iov_base = decoder->ring;
+    iov[1].iov_len = decoder->ring_start;
+  } else {
+    iov[0].iov_base = decoder->ring + end - RING_SIZE;
+    iov[0].iov_len = decoder->ring_start - (end - RING_SIZE);
+    iov[1].iov_len = 0;
+  }
+  if ((result = readv(fd, iov, iov[1].iov_len > 0 ? 2 : 1)) < 0) {
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? 0 : T3_ERR_ERRNO;
+  } else if (result == 0) {
+    return T3_ERR_EOF;
+  }
+
+  decoder->ring_length += result;
+  decoder->ring_kept = 0;
+  feed_ring(decoder);
+  return decode_next(decoder, event, 0);
+}
+
+t3_key_match_t t3_key_decoder_match(const t3_key_decoder_t *decoder, const char *data,
+                                    size_t length) {
+  uint32_t state = 0;
+  int complete = 0, extendable = 0;
+  size_t i;
+
+  for (i = 0; i < length; i++) {
+    if ((state = next_state(decoder, state, data[i])) == 0) {
+      break;
+    }
+  }
+  if (state != 0) {
+    complete = decoder->states[state].accept != 0;
+    extendable = decoder->states[state].edge_count != 0;
+  }
+
+  if (decoder->has_csi_keys && !(decoder->flags & T3_KEY_DECODER_NO_CSI_MODIFIERS)) {
+    csi_parser_t parser;
+    csi_result_t result = CSI_MORE;
+    t3_key_event_t event;
+
+    parser.length = 0;
+    for (i = 0; i < length && result == CSI_MORE; i++) {
+      result = csi_step(&parser, (unsigned char)data[i]);
+    }
+    if (result == CSI_MORE) {
+      extendable |= length < CSI_MAX_LENGTH;
+    } else if (result == CSI_DONE && i == length) {
+      complete |= resolve_csi(decoder, &parser, &event);
+    }
+  }
+
+  if (decoder->has_mouse) {
+    t3_key_mouse_t mouse;
+    int result = t3_key_parse_mouse(data, length, decoder->flags, &mouse);
+
+    complete |= result == (int)length;
+    extendable |= result == 0;
+  }
+
+  if (length <= PASTE_MARKER_LENGTH && memcmp(data, PASTE_START, length) == 0) {
+    complete |= length == PASTE_MARKER_LENGTH;
+    extendable |= length < PASTE_MARKER_LENGTH;
+  }
+
+  if (complete) {
+    return extendable ? T3_KEY_MATCH_AMBIGUOUS : T3_KEY_MATCH_COMPLETE;
+  }
+  return extendable ? T3_KEY_MATCH_PREFIX : T3_KEY_MATCH_NONE;
+}
+
+t3_key_match_t t3_key_decoder_get_pending(const t3_key_decoder_t *decoder,
+                                          struct timespec *deadline) {
+  if (!has_kept_input(decoder)) {
+    return T3_KEY_MATCH_NONE;
+  }
+  if (deadline != NULL) {
+    *deadline = decoder->deadline;
+  }
+  return decoder->pending_match;
+}
+
+int t3_key_decoder_get_timeout(const t3_key_decoder_t *decoder) {
+  struct timespec now;
+  long long remaining;
+
+  if (!has_kept_input(decoder)) {
+    return -1;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  /* Remaining time in microseconds, rounded up to milliseconds. */
+  remaining = (long long)(decoder->deadline.tv_sec - now.tv_sec) * 1000000 +
+              (decoder->deadline.tv_nsec - now.tv_nsec) / 1000;
+  return remaining <= 0 ? 0 : (int)((remaining + 999) / 1000);
+}
+
+void t3_key_decoder_set_flags(t3_key_decoder_t *decoder, int flags) {
+  decoder->flags = flags;
+  decoder->scan_text = select_scan_text(decoder);
+}
+
+int t3_key_decoder_get_flags(const t3_key_decoder_t *decoder) { return decoder->flags; }
+
+unsigned long t3_key_decoder_get_coalesced(const t3_key_decoder_t *decoder) {
+  return decoder->coalesced;
+}
+
+void t3_key_decoder_set_timeout(t3_key_decoder_t *decoder, int timeout) {
+  decoder->timeout = timeout < 0 ? 0 : timeout;
+}
+
+void t3_key_decoder_set_limits(t3_key_decoder_t *decoder, size_t max_length, int max_params) {
+  /* The paste markers are always recognized, and the pending buffer must
+     hold everything which is kept. */
+  decoder->max_sequence_length = max_length < PASTE_MARKER_LENGTH    ? PASTE_MARKER_LENGTH
+                                 : max_length > decoder->pending_size ? decoder->pending_size
+                                                                      : max_length;
+  decoder->max_params = max_params < 0 ? 0 : max_params;
+}
@@ -0,0 +1,415 @@
+/* Copyright (C) 2018 G.P. Halkes
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef T3_KEY_DECODER_H
+#define T3_KEY_DECODER_H
+
+/** @addtogroup t3key_other */
+/** @{ */
+
+#include <time.h>
+#include <t3key/key.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** An input decoder, which converts the bytes read from a terminal into keys and text.
+
+    A decoder is created from a map with ::t3_key_decoder_new. The input is passed to the decoder
+    with ::t3_key_decoder_feed, after which the events are retrieved with ::t3_key_decoder_next.
+*/
+typedef struct t3_key_decoder_t t3_key_decoder_t;
+
+/** Types of events produced by a ::t3_key_decoder_t. */
+typedef enum {
+  /** A run of input bytes which are not part of a key sequence. C0 control characters and DEL
+      are always returned as separate single byte text events. */
+  T3_KEY_EVENT_TEXT,
+  /** A key. This is either a sequence from the map, or a sequence with xterm-style modifier
+      parameters for a key from the map. */
+  T3_KEY_EVENT_KEY,
+  /** A character with modifiers, sent by xterm as <tt>ESC [ 27 ; m ; c ~</tt> when the
+      modifyOtherKeys resource is set. */
+  T3_KEY_EVENT_CHAR,
+  /** A mouse report. See ::t3_key_parse_mouse. */
+  T3_KEY_EVENT_MOUSE,
+  /** The start of pasted text, <tt>ESC [ 200 ~</tt>, which terminals send when bracketed paste
+      mode is enabled. All input up to the next ::T3_KEY_EVENT_PASTE_END event is returned as
+      ::T3_KEY_EVENT_PASTE events. */
+  T3_KEY_EVENT_PASTE_START,
+  /** A run of pasted bytes. The pasted text is not decoded, so escape characters and control
+      characters in the pasted text are included, and the run may end in the middle of a UTF-8
+      character. */
+  T3_KEY_EVENT_PASTE,
+  /** The end of pasted text, <tt>ESC [ 201 ~</tt>. */
+  T3_KEY_EVENT_PASTE_END,
+  /** A cursor position report, <tt>ESC [ row ; column R</tt>, sent in reply to
+      <tt>ESC [ 6 n</tt>. The row and column are stored in t3_key_reply_t::params, counted from
+      1. As the report can not be distinguished from some function keys with modifiers, see
+      ::T3_KEY_DECODER_CURSOR_REPORT. */
+  T3_KEY_EVENT_CURSOR_POSITION,
+  /** A primary device attributes reply, <tt>ESC [ ? ... c</tt>, sent in reply to
+      <tt>ESC [ c</tt>. The parameters are stored in t3_key_reply_t::params. */
+  T3_KEY_EVENT_PRIMARY_DA,
+  /** A secondary device attributes reply, <tt>ESC [ > ... c</tt>, sent in reply to
+      <tt>ESC [ > c</tt>. The parameters are stored in t3_key_reply_t::params. */
+  T3_KEY_EVENT_SECONDARY_DA,
+  /** The terminal window gained focus, <tt>ESC [ I</tt>. Sent when focus reporting is enabled. */
+  T3_KEY_EVENT_FOCUS_IN,
+  /** The terminal window lost focus, <tt>ESC [ O</tt>. Sent when focus reporting is enabled. */
+  T3_KEY_EVENT_FOCUS_OUT,
+  /** An operating system command, <tt>ESC ]</tt> followed by text and ended by BEL or
+      <tt>ESC \\</tt>, as sent in reply to queries such as the one for the background color.
+      The text is stored in t3_key_reply_t::string, and the leading number of the text in
+      t3_key_reply_t::params. */
+  T3_KEY_EVENT_OSC
+} t3_key_event_type_t;
+
+/** Types of mouse reports. */
+typedef enum {
+  T3_KEY_MOUSE_PRESS,   /**< A button was pressed, or the wheel was turned. */
+  T3_KEY_MOUSE_RELEASE, /**< A button was released. */
+  T3_KEY_MOUSE_MOTION   /**< The mouse was moved. */
+} t3_key_mouse_type_t;
+
+/** A mouse report, as sent by xterm and compatible terminals when mouse tracking is enabled. */
+typedef struct {
+  t3_key_mouse_type_t type; /**< The type of the report. */
+  /** The button. This is 1 to 3 for the left, middle and right buttons, 4 to 7 for the wheel
+      directions and 8 to 11 for additional buttons. It is 0 if the button is not known, which is
+      the case for releases in the X10 and URXVT encodings, and for motion without a button
+      pressed. */
+  int button;
+  /** The column and row of the mouse, counted from 0. A coordinate which can not be represented
+      in the encoding used by the terminal is @c -1. */
+  int x, y;
+  int modifiers; /**< The @c T3_KEY_MOD_* flags. */
+} t3_key_mouse_t;
+
+/** The maximum number of parameters stored in a ::t3_key_reply_t. */
+#define T3_KEY_REPLY_MAX_PARAMS 16
+/** The maximum length of a reply from the terminal recognized by a ::t3_key_decoder_t. */
+#define T3_KEY_REPLY_MAX_LENGTH 256
+
+/** A reply from the terminal to a query sent by the program. */
+typedef struct {
+  /** The numeric parameters of the reply. Empty parameters are stored as @c 0. */
+  int params[T3_KEY_REPLY_MAX_PARAMS];
+  /** The number of parameters stored in t3_key_reply_t::params. Parameters beyond
+      ::T3_KEY_REPLY_MAX_PARAMS are not stored. */
+  int param_count;
+  /** For ::T3_KEY_EVENT_OSC events, the text between the introducer and the terminator. This
+      points into t3_key_event_t::data. */
+  const char *string;
+  size_t string_length; /**< The number of bytes in t3_key_reply_t::string. */
+} t3_key_reply_t;
+
+/** An event produced by a ::t3_key_decoder_t. */
+typedef struct {
+  t3_key_event_type_t type; /**< The type of the event. */
+  /** The input bytes of the event. For ::T3_KEY_EVENT_TEXT and ::T3_KEY_EVENT_PASTE events, this
+      points into the buffer passed to ::t3_key_decoder_feed whenever possible. The bytes are only
+      valid until the next call to a function of the decoder. */
+  const char *data;
+  size_t length; /**< The number of bytes in t3_key_event_t::data. */
+  /** For ::T3_KEY_EVENT_KEY events, the node from the map for the key. This is @c NULL if the
+      sequence has modifier parameters for which the map does not have a node. */
+  const t3_key_node_t *node;
+  t3_key_id_t id; /**< For ::T3_KEY_EVENT_KEY events, the key identifier. */
+  /** For ::T3_KEY_EVENT_KEY and ::T3_KEY_EVENT_CHAR events, the @c T3_KEY_MOD_* flags. */
+  int modifiers;
+  int character; /**< For ::T3_KEY_EVENT_CHAR events, the Unicode code point. */
+  t3_key_mouse_t mouse; /**< For ::T3_KEY_EVENT_MOUSE events, the mouse report. */
+  /** For ::T3_KEY_EVENT_CURSOR_POSITION, ::T3_KEY_EVENT_PRIMARY_DA, ::T3_KEY_EVENT_SECONDARY_DA
+      and ::T3_KEY_EVENT_OSC events, the contents of the reply. */
+  t3_key_reply_t reply;
+} t3_key_event_t;
+
+/** Results of matching bytes against the sequences of a decoder. See ::t3_key_decoder_match. */
+typedef enum {
+  T3_KEY_MATCH_NONE,      /**< The bytes are not a sequence, nor the start of one. */
+  T3_KEY_MATCH_COMPLETE,  /**< The bytes are a sequence, which is not the start of another. */
+  T3_KEY_MATCH_AMBIGUOUS, /**< The bytes are a sequence, but also the start of a longer one. */
+  T3_KEY_MATCH_PREFIX     /**< The bytes are the start of a sequence, but not a sequence. */
+} t3_key_match_t;
+
+/** @name Decoder flags */
+/*@{*/
+/** Do not use the SSE2 and AVX2 versions of the text scanner, even if the CPU supports them. */
+#define T3_KEY_DECODER_NO_SIMD (1 << 0)
+/** Only decode the sequences listed in the map, not the sequences with xterm-style modifier
+    parameters. See ::t3_key_decoder_new. */
+#define T3_KEY_DECODER_NO_CSI_MODIFIERS (1 << 1)
+/** Decode the coordinates of X10 style mouse reports as UTF-8, as sent by xterm when mode 1005
+    is enabled. See ::t3_key_parse_mouse. */
+#define T3_KEY_DECODER_MOUSE_UTF8 (1 << 2)
+/** Return only the last of consecutive mouse motion reports with the same buttons and modifiers.
+    See ::t3_key_decoder_get_coalesced. */
+#define T3_KEY_DECODER_COALESCE_MOTION (1 << 3)
+/** Decode <tt>ESC [ row ; column R</tt> as a cursor position report, even if it is also the
+    sequence of a key. Without this flag, <tt>ESC [ 1 ; 2 R</tt> is decoded as shift-F3 by xterm
+    compatible maps, so this flag should be set while a cursor position report is expected. */
+#define T3_KEY_DECODER_CURSOR_REPORT (1 << 4)
+/*@}*/
+
+/** The maximum length of a mouse report recognized by ::t3_key_parse_mouse. */
+#define T3_KEY_MOUSE_MAX_LENGTH 32
+
+/** The default time in milliseconds to wait for the rest of a sequence. See
+    ::t3_key_decoder_set_timeout. */
+#define T3_KEY_DEFAULT_TIMEOUT 100
+
+/** Create a decoder for the sequences in a map.
+    @param map The map to decode the sequences of, as returned by ::t3_key_load_map.
+    @param error Location to store the error code.
+    @return A new decoder, or @c NULL on failure.
+
+    All key sequences in @p map are compiled into a trie. Nodes whose name starts with an
+    underscore, such as @c _enter, are not keys and are skipped. If multiple nodes have the same
+    sequence, only the first one is used, as described in the database format. The @p map must
+    not be freed before the decoder.
+
+    In addition, the decoder recognizes the modifier parameters which xterm adds to the sequences
+    of keys, even for combinations of key and modifiers which the map does not list. If the map
+    has a key without modifiers with sequence <tt>ESC [ X</tt> or <tt>ESC O X</tt>, the sequence
+    <tt>ESC [ 1 ; m X</tt> is decoded as that key, and similarly <tt>ESC [ n ; m ~</tt> for keys
+    with sequence <tt>ESC [ n ~</tt>. The modifier parameter @c m is 1 plus the sum of 1 for
+    shift, 2 for alt, 4 for control and 8 for meta. Both alt and meta are reported as
+    ::T3_KEY_MOD_META. Furthermore, <tt>ESC [ 27 ; m ; c ~</tt> is decoded as the tab, enter or
+    backspace key, or as a ::T3_KEY_EVENT_CHAR event for other characters @c c. Sequences listed
+    in the map always take precedence. This can be disabled with
+    ::T3_KEY_DECODER_NO_CSI_MODIFIERS.
+
+    If the map has the @c _xterm_mouse node, which ::t3_key_load_map adds for terminals with the
+    @c xterm_mouse flag, mouse reports are returned as ::T3_KEY_EVENT_MOUSE events. Pasted text
+    is always recognized, as described for ::T3_KEY_EVENT_PASTE_START. So are the replies which
+    terminals send to queries, such as ::T3_KEY_EVENT_CURSOR_POSITION, unless the map has a longer
+    or equally long sequence for the same bytes.
+*/
+T3_KEY_API t3_key_decoder_t *t3_key_decoder_new(const t3_key_node_t *map, int *error);
+
+/** Free a decoder.
+    @param decoder The decoder to free. May be @c NULL.
+*/
+T3_KEY_API void t3_key_decoder_free(t3_key_decoder_t *decoder);
+
+/** Pass input bytes to a decoder.
+    @param decoder The decoder to pass the bytes to.
+    @param data The input bytes.
+    @param length The number of bytes in @p data.
+
+    The input is not copied, so @p data must remain valid until ::t3_key_decoder_next returns
+    @c 0. The input does not need to be split on sequence boundaries: multiple sequences may be
+    passed at once, and a sequence may be split over multiple calls. Any input from a previous call
+    must have been retrieved with ::t3_key_decoder_next before calling this function.
+*/
+T3_KEY_API void t3_key_decoder_feed(t3_key_decoder_t *decoder, const char *data, size_t length);
+
+/** Retrieve the next event from a decoder.
+    @param decoder The decoder to retrieve the event from.
+    @param event Location to store the event.
+    @return @c 1 if an event was stored in @p event, @c 0 if more input is required.
+
+    At any position, the longest sequence in the map is used. If the input ends with bytes which
+    may be the start of a sequence, these bytes are kept by the decoder until more input is passed
+    with ::t3_key_decoder_feed, or until ::t3_key_decoder_flush is called.
+*/
+T3_KEY_API int t3_key_decoder_next(t3_key_decoder_t *decoder, t3_key_event_t *event);
+
+/** Pass input bytes to a decoder, and retrieve the events in a single call.
+    @param decoder The decoder to pass the bytes to.
+    @param data The input bytes, or @c NULL to continue with the input passed in a previous call.
+    @param length The number of bytes in @p data.
+    @param events The array to store the events in.
+    @param max_events The number of elements of @p events.
+    @return The number of events stored in @p events, or @c 0 if more input is required.
+
+    If @p data is not @c NULL, it is passed to the decoder as with ::t3_key_decoder_feed. Events
+    are then retrieved as with ::t3_key_decoder_next, until @p max_events events are stored or more
+    input is required. The data of all stored events remains valid until the next call to a
+    function of the decoder. To guarantee this, the batch may end early after an event for bytes
+    kept from previous input. Therefore, this function must be called with @c NULL for @p data until
+    it returns @c 0, before passing new input:
+
+    @code
+    data = buffer;
+    while ((count = t3_key_decoder_decode(decoder, data, length, events, MAX_EVENTS)) > 0) {
+      handle_events(events, count);
+      data = NULL;
+    }
+    @endcode
+*/
+T3_KEY_API size_t t3_key_decoder_decode(t3_key_decoder_t *decoder, const char *data,
+                                        size_t length, t3_key_event_t *events, size_t max_events);
+
+/** Read input from a file descriptor into a buffer of the decoder, and retrieve the next event.
+    @param decoder The decoder to read the input with.
+    @param fd The file descriptor to read from.
+    @param event Location to store the event.
+    @return @c 1 if an event was stored in @p event, @c 0 if no event is available without
+        blocking, ::T3_ERR_EOF at the end of the input, ::T3_ERR_ERRNO if reading failed, or
+        ::T3_ERR_OUT_OF_MEMORY.
+
+    The input is read with @c readv directly into a ring buffer owned by the decoder, and events
+    are retrieved from the bytes read before as with ::t3_key_decoder_next. The data of text and
+    paste events points into the ring buffer, and remains valid until the next call to a function
+    of the decoder. Bytes kept at the end of the ring buffer stay in place, and the input read
+    after them continues at the start of the ring buffer. A single call reads at most once, and
+    only if all bytes read before are decoded or kept, so the program can call this function until
+    it returns @c 0 whenever @c poll reports input on @p fd. @p fd should be in non-blocking mode,
+    or this function blocks when no input is available.
+
+    After this function returned @c 0, ::t3_key_decoder_get_timeout and
+    ::t3_key_decoder_flush can be used for the kept bytes as usual. A decoder which reads with this
+    function should not be passed input with ::t3_key_decoder_feed or ::t3_key_decoder_decode.
+*/
+T3_KEY_API int t3_key_decoder_read(t3_key_decoder_t *decoder, int fd, t3_key_event_t *event);
+
+/** Retrieve the next event from the bytes kept by a decoder, without waiting for more input.
+    @param decoder The decoder to retrieve the event from.
+    @param event Location to store the event.
+    @return @c 1 if an event was stored in @p event, @c 0 if no bytes remain.
+
+    This function should be called repeatedly when no more input arrives within a short time after
+    ::t3_key_decoder_next returned @c 0, for example to report a lone escape key. The kept bytes are
+    decoded as if the input ended after them.
+*/
+T3_KEY_API int t3_key_decoder_flush(t3_key_decoder_t *decoder, t3_key_event_t *event);
+
+/** Match bytes against the sequences of a decoder.
+    @param decoder The decoder with the sequences to match against.
+    @param data The bytes to match.
+    @param length The number of bytes in @p data.
+    @return A ::t3_key_match_t describing how @p data matches.
+
+    This function does not change the state of the decoder.
+*/
+T3_KEY_API t3_key_match_t t3_key_decoder_match(const t3_key_decoder_t *decoder, const char *data,
+                                               size_t length);
+
+/** Get the state of the bytes kept by a decoder, and the time at which they must be flushed.
+    @param decoder The decoder to query.
+    @param deadline Location to store the deadline, or @c NULL.
+    @return ::T3_KEY_MATCH_NONE if no bytes are kept, or ::T3_KEY_MATCH_AMBIGUOUS or
+        ::T3_KEY_MATCH_PREFIX for the kept bytes.
+
+    The decoder only keeps bytes after ::t3_key_decoder_next returned @c 0, and only if they can be
+    extended into a (longer) sequence. Input which can not be extended is always returned
+    immediately, so the caller does not need to wait in that case. If bytes are kept, the deadline
+    is the time at which ::t3_key_decoder_flush should be called if no more input has arrived. It
+    is the time of the last call to ::t3_key_decoder_next which returned @c 0, plus the timeout set
+    with ::t3_key_decoder_set_timeout, measured with the @c CLOCK_MONOTONIC clock.
+*/
+T3_KEY_API t3_key_match_t t3_key_decoder_get_pending(const t3_key_decoder_t *decoder,
+                                                     struct timespec *deadline);
+
+/** Get the number of milliseconds until the bytes kept by a decoder must be flushed.
+    @param decoder The decoder to query.
+    @return @c -1 if no bytes are kept, or the number of milliseconds until the deadline returned
+        by ::t3_key_decoder_get_pending, rounded up. This is @c 0 if the deadline has passed.
+
+    The result can be used directly as the timeout argument of @c poll.
+*/
+T3_KEY_API int t3_key_decoder_get_timeout(const t3_key_decoder_t *decoder);
+
+/** Set the flags of a decoder.
+    @param decoder The decoder to set the flags for.
+    @param flags The new flags, a combination of @c T3_KEY_DECODER_* flags.
+*/
+T3_KEY_API void t3_key_decoder_set_flags(t3_key_decoder_t *decoder, int flags);
+
+/** Get the flags of a decoder.
+    @param decoder The decoder to get the flags of.
+    @return The @c T3_KEY_DECODER_* flags set with ::t3_key_decoder_set_flags.
+*/
+T3_KEY_API int t3_key_decoder_get_flags(const t3_key_decoder_t *decoder);
+
+/** Get the number of mouse motion reports which a decoder dropped.
+    @param decoder The decoder to query.
+    @return The number of ::T3_KEY_MOUSE_MOTION reports which were replaced by a later report.
+
+    When ::T3_KEY_DECODER_COALESCE_MOTION is set and the map has the @c _xterm_mouse node, a
+    motion report which is directly followed in the input by another motion report with the same
+    buttons and modifiers is dropped. This prevents a program which can not keep up with the
+    motion reports from handling outdated positions. Only the input which is already available is
+    considered, so coalescing never delays a report. Presses, releases and keys are never dropped,
+    and end a series of motion reports.
+*/
+T3_KEY_API unsigned long t3_key_decoder_get_coalesced(const t3_key_decoder_t *decoder);
+
+/** Set the time to wait for the rest of a sequence.
+    @param decoder The decoder to set the timeout for.
+    @param timeout The timeout in milliseconds. The default is ::T3_KEY_DEFAULT_TIMEOUT.
+*/
+T3_KEY_API void t3_key_decoder_set_timeout(t3_key_decoder_t *decoder, int timeout);
+
+/** Set the limits on the sequences recognized by a decoder.
+    @param decoder The decoder to set the limits for.
+    @param max_length The maximum length of a sequence in bytes. Values below the length of the
+        paste markers, 6, are raised to 6. The default and the maximum is the length of the
+        longest sequence in the map, or ::T3_KEY_REPLY_MAX_LENGTH if that is more. Replies are
+        always limited to ::T3_KEY_REPLY_MAX_LENGTH bytes.
+    @param max_params The maximum number of parameters of a key with modifier parameters or of a
+        reply, or @c 0 for no limit other than @p max_length. The default is @c 0.
+
+    The length limit applies to all sequences: the keys in the map, keys with modifier parameters,
+    mouse reports and replies. Mouse reports are further limited to ::T3_KEY_MOUSE_MAX_LENGTH
+    bytes. Longer sequences, or sequences with more parameters, are not recognized: the decoder
+    stops examining the input at the limit, and returns the bytes as text or shorter keys. Mouse
+    reports always have three parameters, and are not affected by @p max_params.
+
+    These limits bound the memory used by the decoder and the time spent on each byte of input,
+    regardless of the input. If @c L is the length limit, the decoder keeps at most @c L - 1
+    bytes until more input arrives, and only allocates memory while decoding for the fixed size
+    buffer of ::t3_key_decoder_read. Matching at a position of the input examines at most @c L
+    bytes for each type of sequence, and every event consumes at least one byte. Kept bytes are
+    examined again when the next block of input is passed. Decoding @c n bytes therefore takes
+    O(@c n * @c L) time in the worst case. This is linear in @c n for a fixed limit, but not
+    independent of @c L: after a failed match the decoder continues at the next byte, so a byte
+    may be examined up to @c L times. Programs which decode input from an untrusted source can
+    lower the length limit to reduce the constant.
+*/
+T3_KEY_API void t3_key_decoder_set_limits(t3_key_decoder_t *decoder, size_t max_length,
+                                          int max_params);
+
+/** Parse a mouse report.
+    @param data The bytes to parse.
+    @param length The number of bytes in @p data.
+    @param flags A combination of @c T3_KEY_DECODER_* flags. Only ::T3_KEY_DECODER_MOUSE_UTF8 is
+        used.
+    @param mouse Location to store the report.
+    @return The length of the report at the start of @p data, @c 0 if @p data is the start of a
+        report but ends before the end of the report, or @c -1 if @p data does not start with a
+        report.
+
+    The reports sent in the X10 (<tt>ESC [ M b x y</tt>), UTF-8 (mode 1005), URXVT
+    (<tt>ESC [ b ; x ; y M</tt>, mode 1015) and SGR (<tt>ESC [ < b ; x ; y M</tt> or @c m, mode
+    1006) encodings are recognized. In the X10 encoding, coordinates over 223 can not be
+    represented, and are stored as @c -1. The UTF-8 encoding allows coordinates up to 2015, and
+    the other encodings have no such limit. As the UTF-8 encoding can not be distinguished from the
+    X10 encoding, it must be selected with ::T3_KEY_DECODER_MOUSE_UTF8.
+
+    This function does not allocate memory, and a report is never longer than
+    ::T3_KEY_MOUSE_MAX_LENGTH bytes. If the first ::T3_KEY_MOUSE_MAX_LENGTH bytes of @p data do
+    not contain a complete report, for instance because of leading zeros in the parameters, @c -1
+    is returned.
+*/
+T3_KEY_API int t3_key_parse_mouse(const char *data, size_t length, int flags,
+                                  t3_key_mouse_t *mouse);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+/** @} */
+#endif
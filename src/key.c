@@ -13,12 +13,19 @@
 */
 #include <curses.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <t3config/config.h>
 #include <term.h>
+#include <unistd.h>
 
 #ifdef USE_GETTEXT
 #include <libintl.h>
@@ -34,7 +41,7 @@
 #define DB_DIRECTORY "/usr/local/share/libt3key"
 #endif
 
-#define MAX_VERSION 0
+#define MAX_VERSION 1
 
 #include "shareddefs.h"
 
@@ -53,10 +60,106 @@
     goto return_error;                   \
   } while (0)
 
+/* All maps handed out by t3_key_load_map are the nodes member of a map_block_t.
+   The nodes are stored as an array, followed by the indices used by
+   t3_key_get_named_node and t3_key_lookup and a pool holding the key names and
+   sequences, such that the complete map is a single allocation.
+
+   Each key name in the pool is preceded by the (unaligned) uint32_t index of
+   its node, such that the map_block_t can be found from any node. */
+typedef struct {
+  /* Number of references to the map. Maps from the map cache are shared, so
+     the map is only freed when the last reference is dropped. */
+  unsigned long refcount;
+  /* The compiled database the strings of the nodes point into, or NULL. */
+  void *mapping;
+  size_t mapping_size;
+  /* Hash table over the key names, with table_mask + 1 entries. Each entry
+     holds 1 + the index of the first node with a name, or 0 if unused. */
+  uint32_t count, table_mask;
+  uint32_t *table;
+  /* For each node, 1 + the index of the next node with the same name, or 0. */
+  uint32_t *next_same;
+  /* For each node, the key identifier and modifiers as returned by parse_key_name. */
+  uint32_t *ids;
+  /* Table indexed by the values in ids, with id_limit * T3_KEY_MOD_COUNT
+     entries. Each entry holds 1 + the index of the first node with that key
+     identifier and modifiers, or 0 if there is no such node. */
+  uint32_t id_limit;
+  uint32_t *id_table;
+  t3_key_node_t nodes[];
+} map_block_t;
+
+#define MAP_BLOCK(_x) ((map_block_t *)((char *)(_x) - offsetof(map_block_t, nodes)))
+/* The start of the pool of a map_block_t. */
+#define MAP_POOL(_x) ((char *)((_x)->id_table + (_x)->id_limit * T3_KEY_MOD_COUNT))
+/* Space taken by the node index in front of each key name. */
+#define KEY_PREFIX_SIZE sizeof(uint32_t)
+
+/* A node of a map_builder_t. The strings are stored as offsets into the pool,
+   because the pool may be moved while the map is being built. */
+typedef struct {
+  size_t key;
+  size_t string; /* NO_STRING if the node has no string. */
+  size_t string_length;
+  uint32_t id;
+} builder_node_t;
+
+#define NO_STRING ((size_t)-1)
+
+/* A map under construction, which is turned into a map_block_t by finish_map. */
+typedef struct {
+  builder_node_t *nodes;
+  size_t nodes_used, nodes_allocated;
+  uint32_t id_limit;
+  char *pool;
+  size_t pool_used, pool_allocated;
+} map_builder_t;
+
+/* A compiled database, mapped into memory, with the entry for a terminal. */
+typedef struct {
+  int fd;
+  void *mapping;
+  size_t size;
+  const db_info_t *info;
+} db_t;
+
+/* A map of the text database, while loading a map from it. */
+typedef struct {
+  const char *name; /* NULL for an unused slot. */
+  const t3_config_t *map;
+  t3_bool included;
+} map_entry_t;
+
+/* The maps of the text database, indexed by name with a hash table. */
+typedef struct {
+  map_entry_t *entries;
+  size_t mask;
+} map_index_t;
+
+/* A position in a map or in a _use list, while converting a map. */
+typedef struct {
+  const t3_config_t *ptr;
+  t3_bool use_list;
+} convert_frame_t;
+
+struct t3_key_db_t {
+  /* The terminal name, for loading the keys from the terminfo database. */
+  char *term;
+  /* The compiled database, if compiled.mapping is not NULL. */
+  db_t compiled;
+  /* The text database, if not NULL. If neither database is available, the
+     keys are loaded from the terminfo database. */
+  t3_config_t *map_config;
+};
+
+#define DB_PTR(_db, _offset) ((const void *)((const char *)(_db)->mapping + (_offset)))
+#define DB_STRING(_db, _offset) ((const char *)DB_PTR((_db), (_offset)))
+
 static t3_key_node_t *load_ti_keys(const char *term, int *error);
-/* FIXME: make a function specific for each type (there seems to be only one anyway). */
-static int new_node(void **result, size_t size);
-#define NEW_NODE(_x) new_node((void **)(_x), sizeof(**(_x)))
+static int is_modifier_pattern(const char *name, const char *string);
+static void substitute_pattern(char *string, int combination);
+static int add_pattern_nodes(map_builder_t *builder, const char *name, const char *string);
 
 #ifdef HAS_STRDUP
 #define _t3_key_strdup strdup
@@ -82,6 +185,120 @@ static const char map_schema[] = {
 #include "map.bytes"
 };
 
+/* The parsed version of map_schema. It is parsed only once, on first use, and
+   then shared by all callers for the lifetime of the process. */
+static pthread_once_t parsed_map_schema_once = PTHREAD_ONCE_INIT;
+static t3_config_schema_t *parsed_map_schema;
+static int parsed_map_schema_error;
+
+static void parse_map_schema(void) {
+  t3_config_error_t config_error;
+
+  if ((parsed_map_schema = t3_config_read_schema_buffer(map_schema, sizeof(map_schema),
+                                                        &config_error, NULL)) == NULL) {
+    parsed_map_schema_error = config_error.error;
+  }
+}
+
+/** Get the parsed map schema.
+    @param error Location to store the error code.
+    @return The shared schema, which must not be freed, or @c NULL on failure.
+*/
+static const t3_config_schema_t *get_map_schema(int *error) {
+  pthread_once(&parsed_map_schema_once, parse_map_schema);
+  if (parsed_map_schema == NULL && error != NULL) {
+    *error = parsed_map_schema_error;
+  }
+  return parsed_map_schema;
+}
+
+#define KEY_ID_NAME(_id, _name) _name,
+static const char *const key_id_names[] = {T3_KEY_IDS(KEY_ID_NAME)};
+#undef KEY_ID_NAME
+#define FIRST_NAMED_KEY_ID (T3_KEY_ID_F_LAST + 1)
+
+/* Indices into key_id_names, sorted by name. Sorted on first use. */
+static pthread_once_t sorted_key_ids_once = PTHREAD_ONCE_INIT;
+static unsigned char sorted_key_ids[ARRAY_LENGTH(key_id_names)];
+
+static int compare_key_ids(const void *a, const void *b) {
+  return strcmp(key_id_names[*(const unsigned char *)a], key_id_names[*(const unsigned char *)b]);
+}
+
+static void sort_key_ids(void) {
+  size_t i;
+
+  for (i = 0; i < ARRAY_LENGTH(key_id_names); i++) {
+    sorted_key_ids[i] = i;
+  }
+  qsort(sorted_key_ids, ARRAY_LENGTH(key_id_names), 1, compare_key_ids);
+}
+
+/** Determine the key identifier and modifiers from a key name.
+    @return The key identifier multiplied by ::T3_KEY_MOD_COUNT, plus the modifiers, or 0 if the
+        name does not describe a key.
+*/
+static uint32_t parse_key_name(const char *name) {
+  const char *minus = strchr(name, '-');
+  size_t name_len = minus == NULL ? strlen(name) : (size_t)(minus - name);
+  uint32_t id = T3_KEY_ID_NONE, modifiers = 0;
+
+  if (name[0] == 'f' && is_asciidigit(name[1]) && name[1] != '0' && name_len <= 3) {
+    if (name_len == 2) {
+      id = T3_KEY_ID_F(name[1] - '0');
+    } else if (name_len == 3 && is_asciidigit(name[2])) {
+      id = T3_KEY_ID_F((name[1] - '0') * 10 + name[2] - '0');
+    }
+  } else if (name[0] != '_') {
+    size_t low = 0, high = ARRAY_LENGTH(key_id_names);
+
+    pthread_once(&sorted_key_ids_once, sort_key_ids);
+    while (low < high) {
+      size_t mid = low + (high - low) / 2;
+      const char *mid_name = key_id_names[sorted_key_ids[mid]];
+      int result = strncmp(name, mid_name, name_len);
+
+      if (result == 0 && mid_name[name_len] != 0) {
+        result = -1;
+      }
+      if (result == 0) {
+        id = FIRST_NAMED_KEY_ID + sorted_key_ids[mid];
+        break;
+      } else if (result < 0) {
+        high = mid;
+      } else {
+        low = mid + 1;
+      }
+    }
+  }
+
+  if (id == T3_KEY_ID_NONE) {
+    return 0;
+  }
+
+  if (minus != NULL) {
+    if (minus[1] == 0) {
+      return 0;
+    }
+    for (minus++; *minus != 0; minus++) {
+      switch (*minus) {
+        case 'c':
+          modifiers |= T3_KEY_MOD_CTRL;
+          break;
+        case 'm':
+          modifiers |= T3_KEY_MOD_META;
+          break;
+        case 's':
+          modifiers |= T3_KEY_MOD_SHIFT;
+          break;
+        default:
+          return 0;
+      }
+    }
+  }
+  return id * T3_KEY_MOD_COUNT + modifiers;
+}
+
 /** Convert a string from the input format to an internally usable string.
         @param string A @a Token with the string to be converted.
         @return The length of the resulting string.
@@ -201,31 +418,35 @@ static size_t parse_escapes(char *string) {
   return write_position;
 }
 
+/** Get the name under which the database for a terminal is stored.
+
+    This is usually @p term itself, except in case of TERM weirdness (like
+    screen.rxvt).
+*/
+static const char *get_search_term(const char *term) {
+  /* Screen is a nasty beast. It generates its TERM setting on the fly. The main
+     variation is by terminal. So there is screen.rxvt, screen.Eterm etc.
+     Furthermore, there are all kinds of variants for colors and options, like
+     screen-256color and screen-bce. So we simply fall back to loading the
+     screen definition. */
+  if (strncmp(term, "screen", 6) == 0 && (term[6] == '.' || term[6] == '-')) {
+    return "screen";
+  }
+  return term;
+}
+
 static t3_config_t *load_map_config(const char *term, int *error) {
   const char *path[3] = {NULL, DB_DIRECTORY, NULL};
   char *xdg_path = NULL;
   t3_config_error_t config_error;
   t3_config_t *map_config = NULL;
-  t3_config_schema_t *schema = NULL;
+  const t3_config_schema_t *schema;
   FILE *input = NULL;
-  /* Variable to hold an alternate value to use for term, in case of TERM
-     weirdness (like screen.rxvt). */
-  const char *search_term = NULL;
 
   /* Setup path. */
   path[0] = xdg_path = t3_config_xdg_get_path(T3_CONFIG_XDG_DATA_HOME, "libt3key", 0);
 
-  /* Screen is a nasty beast. It generates its TERM setting on the fly. The main
-     variation is by terminal. So there is screen.rxvt, screen.Eterm etc.
-     Furthermore, there are all kinds of variants for colors and options, like
-     screen-256color and screen-bce. So we simply fall back to loading the
-     screen definition. */
-  if (strncmp(term, "screen", 6) == 0 && (term[6] == '.' || term[6] == '-')) {
-    search_term = "screen";
-  }
-
-  if ((input = t3_config_open_from_path(path[0] == NULL ? path + 1 : path,
-                                        search_term == NULL ? term : search_term,
+  if ((input = t3_config_open_from_path(path[0] == NULL ? path + 1 : path, get_search_term(term),
                                         T3_CONFIG_CLEAN_NAME)) == NULL) {
     RETURN_ERROR(T3_ERR_ERRNO);
   }
@@ -234,8 +455,7 @@ static t3_config_t *load_map_config(const char *term, int *error) {
     RETURN_ERROR(config_error.error);
   }
 
-  if ((schema = t3_config_read_schema_buffer(map_schema, sizeof(map_schema), &config_error,
-                                             NULL)) == NULL) {
+  if ((schema = get_map_schema(&config_error.error)) == NULL) {
     RETURN_ERROR(config_error.error);
   }
 
@@ -245,7 +465,6 @@ static t3_config_t *load_map_config(const char *term, int *error) {
 
   free(xdg_path);
   fclose(input);
-  t3_config_delete_schema(schema);
 
   return map_config;
 return_error:
@@ -254,220 +473,1072 @@ return_error:
   }
   free(xdg_path);
   t3_config_delete(map_config);
-  t3_config_delete_schema(schema);
   return NULL;
 }
 
-static int convert_map(t3_config_t *map_config, t3_config_t *ptr, t3_key_node_t **next,
-                       t3_bool outer) {
-  for (ptr = t3_config_get(ptr, NULL); ptr != NULL; ptr = t3_config_get_next(ptr)) {
-    const char *name = t3_config_get_name(ptr);
-    if (strcmp(name, "_use") == 0) {
-      t3_config_t *use;
-      /* Prevent infinte recursion and double inclusion by unlinking the map
-         from the list. */
-      int result;
+/** Check whether the user has a private database for a terminal.
+
+    The text databases in the user's XDG data directory take precedence over
+    the compiled database, such that users can override the system-wide
+    definitions.
+*/
+static t3_bool have_user_db(const char *search_term) {
+  const char *path[2] = {NULL, NULL};
+  char *xdg_path;
+  FILE *input;
+
+  if ((path[0] = xdg_path = t3_config_xdg_get_path(T3_CONFIG_XDG_DATA_HOME, "libt3key", 0)) ==
+      NULL) {
+    return t3_false;
+  }
+  input = t3_config_open_from_path(path, search_term, T3_CONFIG_CLEAN_NAME);
+  free(xdg_path);
+  if (input == NULL) {
+    return t3_false;
+  }
+  fclose(input);
+  return t3_true;
+}
 
-      for (use = t3_config_get(ptr, NULL); use != NULL; use = t3_config_get_next(use)) {
-        t3_config_t *use_map =
-            t3_config_unlink(t3_config_get(map_config, "maps"), t3_config_get_string(use));
+/** Check that a table lies completely within the compiled database. */
+static t3_bool db_check_table(const db_t *db, uint32_t offset, uint32_t count, size_t size) {
+  return offset % 4 == 0 && offset <= db->size && count <= (db->size - offset) / size;
+}
 
-        if (use_map == NULL) {
-          continue;
-        }
-        result = convert_map(map_config, use_map, next, t3_false);
-        t3_config_delete(use_map);
-        if (result != T3_ERR_SUCCESS) {
-          return result;
-        }
-        /* Update next pointer, because loading the sub-map will have extended
-           the list. */
-        while (*next != NULL) {
-          next = &(*next)->next;
-        }
+static void close_db(db_t *db) {
+  if (db->mapping != NULL) {
+    munmap(db->mapping, db->size);
+    db->mapping = NULL;
+  }
+  if (db->fd != -1) {
+    close(db->fd);
+    db->fd = -1;
+  }
+}
+
+/** Map the compiled database into memory and look up the entry for a terminal.
+
+    If the compiled database does not exist, or does not contain the terminal,
+    this function returns ::T3_ERR_ERRNO with @c errno set to @c ENOENT, to
+    signal that the text database should be used instead. The file remains
+    open, such that each map loaded from it can have its own mapping.
+*/
+static int open_db(const char *term, db_t *db) {
+  const char *search_term = get_search_term(term);
+  const db_header_t *header;
+  const db_terminal_t *terminals;
+  const db_info_t *info;
+  uint32_t low, high;
+  struct stat statbuf;
+  void *mapping;
+
+  db->mapping = NULL;
+  db->fd = -1;
+  if (have_user_db(search_term)) {
+    errno = ENOENT;
+    return T3_ERR_ERRNO;
+  }
+
+  if ((db->fd = open(DB_DIRECTORY "/" DB_FILE_NAME, O_RDONLY)) == -1) {
+    return T3_ERR_ERRNO;
+  }
+  if (fstat(db->fd, &statbuf) == -1) {
+    close_db(db);
+    return T3_ERR_READ_ERROR;
+  }
+  if ((size_t)statbuf.st_size < sizeof(db_header_t)) {
+    close_db(db);
+    return T3_ERR_TRUNCATED_DB;
+  }
+  if ((mapping = mmap(NULL, statbuf.st_size, PROT_READ, MAP_PRIVATE, db->fd, 0)) == MAP_FAILED) {
+    close_db(db);
+    return T3_ERR_READ_ERROR;
+  }
+  db->mapping = mapping;
+  db->size = statbuf.st_size;
+
+  header = mapping;
+  if (memcmp(header->magic, DB_MAGIC, sizeof(header->magic)) != 0) {
+    close_db(db);
+    return T3_ERR_INVALID_FORMAT;
+  }
+  if (header->byte_order != DB_BYTE_ORDER || header->version > MAX_VERSION) {
+    close_db(db);
+    return T3_ERR_WRONG_VERSION;
+  }
+  if (header->size > db->size) {
+    close_db(db);
+    return T3_ERR_TRUNCATED_DB;
+  }
+  /* Because the last byte of the file is nul, every offset within the file
+     refers to a nul-terminated string. */
+  if (header->size != db->size || DB_STRING(db, db->size - 1)[0] != 0 ||
+      !db_check_table(db, header->terminals, header->terminal_count, sizeof(db_terminal_t))) {
+    close_db(db);
+    return T3_ERR_INVALID_FORMAT;
+  }
+
+  terminals = DB_PTR(db, header->terminals);
+  low = 0;
+  high = header->terminal_count;
+  while (low < high) {
+    uint32_t mid = low + (high - low) / 2;
+    int cmp;
+
+    if (terminals[mid].name >= db->size) {
+      close_db(db);
+      return T3_ERR_INVALID_FORMAT;
+    }
+    cmp = strcmp(search_term, DB_STRING(db, terminals[mid].name));
+    if (cmp == 0) {
+      if (!db_check_table(db, terminals[mid].info, 1, sizeof(db_info_t))) {
+        close_db(db);
+        return T3_ERR_INVALID_FORMAT;
       }
-    } else if (name[0] != '_' || strcmp(name, "_enter") == 0 || strcmp(name, "_leave") == 0) {
-      if ((*next = malloc(sizeof(t3_key_node_t))) == NULL) {
-        return t3_false;
+      info = DB_PTR(db, terminals[mid].info);
+      if (!db_check_table(db, info->maps, info->map_count, sizeof(db_map_t)) ||
+          info->best >= info->map_count) {
+        close_db(db);
+        return T3_ERR_INVALID_FORMAT;
       }
-      (*next)->string = NULL;
-      (*next)->next = NULL;
+      db->info = info;
+      return T3_ERR_SUCCESS;
+    } else if (cmp < 0) {
+      high = mid;
+    } else {
+      low = mid + 1;
+    }
+  }
+  close_db(db);
+  errno = ENOENT;
+  return T3_ERR_ERRNO;
+}
 
-      if (((*next)->key = _t3_key_strdup(name)) == NULL) {
-        return T3_ERR_OUT_OF_MEMORY;
-      }
+static const db_map_t *get_db_maps(const db_t *db) { return DB_PTR(db, db->info->maps); }
 
-      /* Only for _enter and _leave, the name starts with _. */
-      if (name[0] == '_' && t3_config_get_string(ptr)[0] != '\\') {
-        /* Get terminfo string indicated by string. */
-        const char *ti_string;
+/** Allocate a map_block_t.
+    @param count The number of nodes.
+    @param id_limit One more than the highest key identifier of the nodes.
+    @param pool_size The size of the pool for the strings.
+*/
+static map_block_t *new_map_block(size_t count, uint32_t id_limit, size_t pool_size) {
+  map_block_t *block;
+  size_t table_size = 1;
 
-        if (!outer) {
-          return T3_ERR_INVALID_FORMAT;
-        }
+  /* Keep the load factor of the hash table at or below 0.5. */
+  while (table_size < 2 * count) {
+    table_size *= 2;
+  }
 
-        ti_string = tigetstr(t3_config_get_string(ptr));
-        if (ti_string == (char *)0 || ti_string == (char *)-1) {
-          free((*next)->key);
-          free(*next);
-          *next = NULL;
-          continue;
-        }
-        if (((*next)->string = _t3_key_strdup(ti_string)) == NULL) {
-          return T3_ERR_OUT_OF_MEMORY;
-        }
-        (*next)->string_length = strlen((*next)->string);
-      } else {
-        (*next)->string = t3_config_take_string(ptr);
-        (*next)->string_length = parse_escapes((*next)->string);
-        if ((*next)->string_length == 0) {
-          return T3_ERR_INVALID_FORMAT;
-        }
-      }
-      next = &(*next)->next;
+  if ((block = malloc(offsetof(map_block_t, nodes) + count * sizeof(t3_key_node_t) +
+                      (table_size + 2 * count + id_limit * T3_KEY_MOD_COUNT) * sizeof(uint32_t) +
+                      pool_size)) == NULL) {
+    return NULL;
+  }
+  block->count = count;
+  block->table_mask = table_size - 1;
+  block->table = (uint32_t *)(block->nodes + count);
+  block->next_same = block->table + table_size;
+  block->ids = block->next_same + count;
+  block->id_limit = id_limit;
+  block->id_table = block->ids + count;
+  block->refcount = 1;
+  block->mapping = NULL;
+  block->mapping_size = 0;
+  return block;
+}
+
+static uint32_t hash_key(const char *key) {
+  uint32_t hash = 2166136261u;
+
+  for (; *key != 0; key++) {
+    hash = (hash ^ (unsigned char)*key) * 16777619u;
+  }
+  return hash;
+}
+
+/** Store key name @p key for node @p index at @p dest, preceded by the node index.
+    @return The stored name.
+*/
+static char *store_key(char *dest, uint32_t index, const char *key, size_t key_length) {
+  memcpy(dest, &index, KEY_PREFIX_SIZE);
+  memcpy(dest + KEY_PREFIX_SIZE, key, key_length + 1);
+  return dest + KEY_PREFIX_SIZE;
+}
+
+/** Build the indices of a map_block_t, after all nodes and ids have been filled in. */
+static void index_map(map_block_t *block) {
+  uint32_t i;
+
+  memset(block->table, 0, (block->table_mask + 1) * sizeof(uint32_t));
+  memset(block->id_table, 0, block->id_limit * T3_KEY_MOD_COUNT * sizeof(uint32_t));
+  /* Insert the nodes in reverse, such that each chain of nodes with the same
+     name is in map order. */
+  for (i = block->count; i > 0; i--) {
+    const char *key = block->nodes[i - 1].key;
+    uint32_t slot = hash_key(key) & block->table_mask;
+
+    while (block->table[slot] != 0 && strcmp(block->nodes[block->table[slot] - 1].key, key) != 0) {
+      slot = (slot + 1) & block->table_mask;
+    }
+    block->next_same[i - 1] = block->table[slot];
+    block->table[slot] = i;
+    if (block->ids[i - 1] != 0) {
+      block->id_table[block->ids[i - 1]] = i;
+    }
+  }
+}
+
+/** Make sure the pool of @p builder has room for @p size more bytes. */
+static int builder_reserve(map_builder_t *builder, size_t size) {
+  if (builder->pool_allocated - builder->pool_used < size) {
+    size_t allocated = builder->pool_allocated == 0 ? 1024 : builder->pool_allocated;
+    char *pool;
+
+    while (allocated - builder->pool_used < size) {
+      allocated *= 2;
+    }
+    if ((pool = realloc(builder->pool, allocated)) == NULL) {
+      return T3_ERR_OUT_OF_MEMORY;
     }
+    builder->pool = pool;
+    builder->pool_allocated = allocated;
   }
   return T3_ERR_SUCCESS;
 }
 
-t3_key_node_t *t3_key_load_map(const char *term, const char *map_name, int *error) {
-  t3_config_t *map_config = NULL, *ptr;
-  t3_key_node_t *list = NULL, *node = NULL;
+/** Append @p length bytes of @p data and a nul byte to the pool of @p builder.
+    @param offset Location to store the offset of the copy in the pool.
+*/
+static int builder_add_string(map_builder_t *builder, const char *data, size_t length,
+                              size_t *offset) {
   int result;
 
-  if (term == NULL) {
-    term = getenv("TERM");
-    if (term == NULL) {
-      RETURN_ERROR(T3_ERR_NO_TERM);
+  if ((result = builder_reserve(builder, length + 1)) != T3_ERR_SUCCESS) {
+    return result;
+  }
+  memcpy(builder->pool + builder->pool_used, data, length);
+  builder->pool[builder->pool_used + length] = 0;
+  *offset = builder->pool_used;
+  builder->pool_used += length + 1;
+  return T3_ERR_SUCCESS;
+}
+
+/** Append a node to @p builder.
+    @param key The name of the key.
+    @param string The sequence of the key, or @c NULL.
+    @param string_length The length of @p string.
+*/
+static int builder_add_node(map_builder_t *builder, const char *key, const char *string,
+                            size_t string_length) {
+  builder_node_t *node;
+  size_t key_length;
+  int result;
+
+  if (builder->nodes_used == builder->nodes_allocated) {
+    size_t allocated = builder->nodes_allocated == 0 ? 64 : builder->nodes_allocated * 2;
+    builder_node_t *nodes = realloc(builder->nodes, allocated * sizeof(builder_node_t));
+    if (nodes == NULL) {
+      return T3_ERR_OUT_OF_MEMORY;
     }
+    builder->nodes = nodes;
+    builder->nodes_allocated = allocated;
+  }
+  node = &builder->nodes[builder->nodes_used];
+  key_length = strlen(key);
+  if ((result = builder_reserve(builder, KEY_PREFIX_SIZE + key_length + 1)) != T3_ERR_SUCCESS) {
+    return result;
+  }
+  node->key = store_key(builder->pool + builder->pool_used, builder->nodes_used, key, key_length) -
+              builder->pool;
+  builder->pool_used = node->key + key_length + 1;
+  node->id = parse_key_name(key);
+  if (node->id / T3_KEY_MOD_COUNT >= builder->id_limit) {
+    builder->id_limit = node->id / T3_KEY_MOD_COUNT + 1;
+  }
+
+  node->string = NO_STRING;
+  node->string_length = string_length;
+  if (string != NULL &&
+      (result = builder_add_string(builder, string, string_length, &node->string)) !=
+          T3_ERR_SUCCESS) {
+    return result;
+  }
+  builder->nodes_used++;
+  return T3_ERR_SUCCESS;
+}
+
+static void free_map_builder(map_builder_t *builder) {
+  free(builder->nodes);
+  free(builder->pool);
+}
+
+/** Convert the nodes collected in @p builder into a map_block_t.
+
+    The @p builder is freed, regardless of whether the map could be created.
+*/
+static t3_key_node_t *finish_map(map_builder_t *builder, int *error) {
+  map_block_t *block;
+  char *pool;
+  size_t i;
+
+  if (builder->nodes_used == 0) {
+    free_map_builder(builder);
+    return NULL;
   }
 
-  if ((map_config = load_map_config(term, &result)) == NULL) {
-    if (result == T3_ERR_ERRNO && errno == ENOENT) {
-      return load_ti_keys(term, error);
+  if ((block = new_map_block(builder->nodes_used, builder->id_limit, builder->pool_used)) == NULL) {
+    free_map_builder(builder);
+    if (error != NULL) {
+      *error = T3_ERR_OUT_OF_MEMORY;
     }
-    RETURN_ERROR(result);
+    return NULL;
   }
+  pool = MAP_POOL(block);
+  memcpy(pool, builder->pool, builder->pool_used);
+
+  for (i = 0; i < builder->nodes_used; i++) {
+    const builder_node_t *node = &builder->nodes[i];
+    block->nodes[i].key = pool + node->key;
+    block->nodes[i].string = node->string == NO_STRING ? NULL : pool + node->string;
+    block->nodes[i].string_length = node->string_length;
+    block->ids[i] = node->id;
+    block->nodes[i].next = i + 1 < builder->nodes_used ? &block->nodes[i + 1] : NULL;
+  }
+  free_map_builder(builder);
+  index_map(block);
+  return block->nodes;
+}
 
-  if (map_name != NULL) {
-    ptr = t3_config_unlink(t3_config_get(map_config, "maps"), map_name);
+/** Create a map from the compiled database.
+
+    The sequences of the nodes point directly into a separate mapping of the
+    database, which is unmapped when the map is freed. Only the key names (which
+    need the node index in front of them) and the sequences which have to be
+    retrieved from the terminfo database are copied.
+*/
+static t3_key_node_t *load_db_map(const db_t *db, const char *map_name, int *error) {
+  const db_map_t *maps = get_db_maps(db), *map = NULL;
+  const db_key_t *keys;
+  map_block_t *block;
+  t3_key_node_t *node;
+  size_t count = 0, extra = 0;
+  char *extra_ptr, *mapping;
+  uint32_t i, id, id_limit = 0;
+
+  if (map_name == NULL) {
+    map = &maps[db->info->best];
   } else {
-    ptr = t3_config_unlink(t3_config_get(map_config, "maps"),
-                           t3_config_get_string(t3_config_get(map_config, "best")));
+    for (i = 0; i < db->info->map_count; i++) {
+      if (maps[i].name < db->size && strcmp(DB_STRING(db, maps[i].name), map_name) == 0) {
+        map = &maps[i];
+        break;
+      }
+    }
+    if (map == NULL) {
+      RETURN_ERROR(T3_ERR_NOMAP);
+    }
   }
 
-  if (ptr == NULL) {
-    RETURN_ERROR(T3_ERR_NOMAP);
+  if (!db_check_table(db, map->keys, map->key_count, sizeof(db_key_t))) {
+    RETURN_ERROR(T3_ERR_INVALID_FORMAT);
   }
+  keys = DB_PTR(db, map->keys);
 
-  result = convert_map(map_config, ptr, &list, t3_true);
-  t3_config_delete(ptr);
-  if (result != T3_ERR_SUCCESS) {
-    RETURN_ERROR(result);
+  if (db->info->flags & DB_INFO_XTERM_MOUSE) {
+    count++;
+    extra += KEY_PREFIX_SIZE + sizeof("_xterm_mouse");
   }
-
-  if ((ptr = t3_config_get(map_config, "shiftfn")) != NULL) {
-    if ((node = malloc(sizeof(t3_key_node_t))) == NULL) {
-      RETURN_ERROR(T3_ERR_OUT_OF_MEMORY);
+  if (db->info->flags & DB_INFO_SHIFTFN) {
+    count++;
+    extra += KEY_PREFIX_SIZE + sizeof("_shiftfn") + 3;
+  }
+  for (i = 0; i < map->key_count; i++) {
+    if (keys[i].name >= db->size || keys[i].string >= db->size ||
+        keys[i].string_length >= db->size - keys[i].string) {
+      RETURN_ERROR(T3_ERR_INVALID_FORMAT);
     }
-    node->string = NULL;
-    node->next = NULL;
-    if ((node->key = _t3_key_strdup("_shiftfn")) == NULL) {
-      RETURN_ERROR(T3_ERR_OUT_OF_MEMORY);
+    if (keys[i].flags & DB_KEY_TERMINFO) {
+      const char *ti_string = tigetstr(DB_STRING(db, keys[i].string));
+      if (ti_string == (char *)0 || ti_string == (char *)-1) {
+        continue;
+      }
+      extra += strlen(ti_string) + 1;
     }
-    if ((node->string = malloc(3)) == NULL) {
-      RETURN_ERROR(T3_ERR_OUT_OF_MEMORY);
+    extra += KEY_PREFIX_SIZE + strlen(DB_STRING(db, keys[i].name)) + 1;
+    id = parse_key_name(DB_STRING(db, keys[i].name)) / T3_KEY_MOD_COUNT;
+    if (id >= id_limit) {
+      id_limit = id + 1;
     }
-    node->string_length = 3;
-    ptr = t3_config_get(ptr, NULL);
-    node->string[0] = t3_config_get_int(ptr);
-    ptr = t3_config_get_next(ptr);
-    node->string[1] = t3_config_get_int(ptr);
-    ptr = t3_config_get_next(ptr);
-    node->string[2] = t3_config_get_int(ptr);
-    node->next = list;
-    list = node;
-    node = NULL;
+    count++;
   }
 
-  if (t3_config_get_bool(t3_config_get(map_config, "xterm_mouse"))) {
-    if ((node = malloc(sizeof(t3_key_node_t))) == NULL) {
-      RETURN_ERROR(T3_ERR_OUT_OF_MEMORY);
-    }
+  if (count == 0) {
+    return NULL;
+  }
+
+  /* The file has not changed since it was validated, because t3keyc replaces
+     the database instead of overwriting it. */
+  if ((mapping = mmap(NULL, db->size, PROT_READ, MAP_PRIVATE, db->fd, 0)) == MAP_FAILED) {
+    RETURN_ERROR(T3_ERR_READ_ERROR);
+  }
+  if ((block = new_map_block(count, id_limit, extra)) == NULL) {
+    munmap(mapping, db->size);
+    RETURN_ERROR(T3_ERR_OUT_OF_MEMORY);
+  }
+  extra_ptr = MAP_POOL(block);
+  node = block->nodes;
+
+  if (db->info->flags & DB_INFO_XTERM_MOUSE) {
+    node->key = store_key(extra_ptr, 0, "_xterm_mouse", strlen("_xterm_mouse"));
+    extra_ptr = node->key + sizeof("_xterm_mouse");
+    block->ids[0] = 0;
     node->string = NULL;
     node->string_length = 0;
-    node->next = NULL;
-    if ((node->key = _t3_key_strdup("_xterm_mouse")) == NULL) {
-      RETURN_ERROR(T3_ERR_OUT_OF_MEMORY);
+    node++;
+  }
+  if (db->info->flags & DB_INFO_SHIFTFN) {
+    node->key = store_key(extra_ptr, node - block->nodes, "_shiftfn", strlen("_shiftfn"));
+    extra_ptr = node->key + sizeof("_shiftfn");
+    block->ids[node - block->nodes] = 0;
+    node->string = extra_ptr;
+    node->string_length = 3;
+    memcpy(extra_ptr, db->info->shiftfn, 3);
+    extra_ptr += 3;
+    node++;
+  }
+  for (i = 0; i < map->key_count; i++) {
+    const char *name = mapping + keys[i].name, *ti_string = NULL;
+    size_t name_length;
+
+    if (keys[i].flags & DB_KEY_TERMINFO) {
+      ti_string = tigetstr(DB_STRING(db, keys[i].string));
+      if (ti_string == (char *)0 || ti_string == (char *)-1) {
+        continue;
+      }
+    }
+    name_length = strlen(name);
+    node->key = store_key(extra_ptr, node - block->nodes, name, name_length);
+    extra_ptr = node->key + name_length + 1;
+    block->ids[node - block->nodes] = parse_key_name(name);
+
+    if (ti_string != NULL) {
+      node->string_length = strlen(ti_string);
+      node->string = extra_ptr;
+      memcpy(extra_ptr, ti_string, node->string_length + 1);
+      extra_ptr += node->string_length + 1;
+    } else {
+      node->string = mapping + keys[i].string;
+      node->string_length = keys[i].string_length;
     }
-    node->next = list;
-    list = node;
-    node = NULL;
+    node++;
   }
-  t3_config_delete(map_config);
-  return list;
+  for (i = 0; i + 1 < count; i++) {
+    block->nodes[i].next = &block->nodes[i + 1];
+  }
+  block->nodes[count - 1].next = NULL;
+  index_map(block);
+
+  block->mapping = mapping;
+  block->mapping_size = db->size;
+  return block->nodes;
 
 return_error:
-  t3_key_free_map(node);
-  t3_key_free_map(list);
-  t3_config_delete(map_config);
   return NULL;
 }
 
-void t3_key_free_map(t3_key_node_t *list) {
-  t3_key_node_t *prev;
-  while (list != NULL) {
-    prev = list;
-    list = list->next;
-    free(prev->key);
-    free(prev->string);
-    free(prev);
-  }
-}
+/** Index the maps of the text database by name.
 
-static int new_node(void **result, size_t size) {
-  if ((*result = malloc(size)) == NULL) {
+    If multiple maps have the same name, only the first is indexed, which is
+    the one @c t3_config_get returns.
+*/
+static int index_maps(const t3_config_t *map_config, map_index_t *index, size_t *count) {
+  const t3_config_t *map;
+  size_t table_size = 1;
+
+  *count = 0;
+  for (map = t3_config_get(t3_config_get(map_config, "maps"), NULL); map != NULL;
+       map = t3_config_get_next(map)) {
+    (*count)++;
+  }
+  /* Keep the load factor of the hash table at or below 0.5. */
+  while (table_size < 2 * *count) {
+    table_size *= 2;
+  }
+  if ((index->entries = calloc(table_size, sizeof(map_entry_t))) == NULL) {
     return T3_ERR_OUT_OF_MEMORY;
   }
-  /* FIXME: this causes trouble if the data in *result contains pointers */
-  memset(*result, 0, size);
+  index->mask = table_size - 1;
+
+  for (map = t3_config_get(t3_config_get(map_config, "maps"), NULL); map != NULL;
+       map = t3_config_get_next(map)) {
+    const char *name = t3_config_get_name(map);
+    size_t slot = hash_key(name) & index->mask;
+
+    while (index->entries[slot].name != NULL && strcmp(index->entries[slot].name, name) != 0) {
+      slot = (slot + 1) & index->mask;
+    }
+    if (index->entries[slot].name == NULL) {
+      index->entries[slot].name = name;
+      index->entries[slot].map = map;
+    }
+  }
   return T3_ERR_SUCCESS;
 }
 
-static int make_node_from_ti(t3_key_node_t **next_node, const char *tikey, const char *key) {
-  char *tiresult;
-  int error;
+/** Look up a map by name in @p index.
+    @return The entry for the map, or @c NULL if there is no map named @p name.
+*/
+static map_entry_t *lookup_map(const map_index_t *index, const char *name) {
+  size_t slot = hash_key(name) & index->mask;
 
-  tiresult = tigetstr(tikey);
-  if (tiresult == (char *)0 || tiresult == (char *)-1) {
-    return T3_ERR_SUCCESS;
+  for (; index->entries[slot].name != NULL; slot = (slot + 1) & index->mask) {
+    if (strcmp(index->entries[slot].name, name) == 0) {
+      return &index->entries[slot];
+    }
   }
+  return NULL;
+}
 
-  if ((error = NEW_NODE(next_node)) != T3_ERR_SUCCESS) {
-    return error;
-  }
+/** Add a node for a key from the text database to @p builder.
+    @param combination The combination of modifiers if @p string is a modifier pattern, or @c 0.
+*/
+static int add_text_node(map_builder_t *builder, const char *name, const char *string,
+                         int combination) {
+  builder_node_t *node;
+  int result;
 
-  if (((*next_node)->key = _t3_key_strdup(key)) == NULL) {
-    free(*next_node);
-    *next_node = NULL;
-    return T3_ERR_OUT_OF_MEMORY;
+  if ((result = builder_add_node(builder, name, string, strlen(string))) != T3_ERR_SUCCESS) {
+    return result;
   }
-
-  if (((*next_node)->string = _t3_key_strdup(tiresult)) == NULL) {
-    free((*next_node)->string);
-    free(*next_node);
-    *next_node = NULL;
-    return T3_ERR_OUT_OF_MEMORY;
+  /* Process the escapes in the copy in the pool. The result is never
+     longer than the original, so the pool is shrunk to fit. */
+  node = &builder->nodes[builder->nodes_used - 1];
+  if (combination != 0) {
+    substitute_pattern(builder->pool + node->string, combination);
   }
-  (*next_node)->string_length = strlen(tiresult);
-
+  node->string_length = parse_escapes(builder->pool + node->string);
+  if (node->string_length == 0) {
+    return T3_ERR_INVALID_FORMAT;
+  }
+  builder->pool_used = node->string + node->string_length + 1;
   return T3_ERR_SUCCESS;
 }
 
-/* The START/END MAPPINGS comments below are markers to allow extraction of this
-   list for t3keyc. */
+/** Convert a map from the text database, adding its nodes to @p builder.
 
-/*START MAPPINGS*/
+    The maps listed in @c _use entries are expanded in place, depth first,
+    using an explicit stack rather than recursion. Each map is included at
+    most once, which also prevents infinite inclusion. The text database is
+    not modified, such that it can be used to load multiple maps.
+*/
+static int convert_map(const t3_config_t *map_config, const t3_config_t *map,
+                       map_builder_t *builder) {
+  map_index_t index = {NULL, 0};
+  convert_frame_t *stack = NULL;
+  size_t count, depth;
+  int result;
+
+  if ((result = index_maps(map_config, &index, &count)) != T3_ERR_SUCCESS) {
+    return result;
+  }
+  /* Each map is on the stack at most once, with at most one _use list. */
+  if ((stack = malloc((2 * count + 1) * sizeof(convert_frame_t))) == NULL) {
+    result = T3_ERR_OUT_OF_MEMORY;
+    goto return_error;
+  }
+  lookup_map(&index, t3_config_get_name(map))->included = t3_true;
+  stack[0].ptr = t3_config_get(map, NULL);
+  stack[0].use_list = t3_false;
+  depth = 1;
+
+  while (depth > 0) {
+    const t3_config_t *ptr = stack[depth - 1].ptr;
+    const char *name;
+    /* Only the map itself may refer to terminfo strings. */
+    t3_bool outer = depth == 1;
+
+    if (ptr == NULL) {
+      depth--;
+      continue;
+    }
+    stack[depth - 1].ptr = t3_config_get_next(ptr);
+
+    if (stack[depth - 1].use_list) {
+      map_entry_t *entry = lookup_map(&index, t3_config_get_string(ptr));
+
+      if (entry != NULL && !entry->included) {
+        entry->included = t3_true;
+        stack[depth].ptr = t3_config_get(entry->map, NULL);
+        stack[depth].use_list = t3_false;
+        depth++;
+      }
+      continue;
+    }
+
+    name = t3_config_get_name(ptr);
+    if (strcmp(name, "_use") == 0) {
+      stack[depth].ptr = t3_config_get(ptr, NULL);
+      stack[depth].use_list = t3_true;
+      depth++;
+    } else if (name[0] != '_' || strcmp(name, "_enter") == 0 || strcmp(name, "_leave") == 0) {
+      /* Only for _enter and _leave, the name starts with _. */
+      if (name[0] == '_' && t3_config_get_string(ptr)[0] != '\\') {
+        /* Get terminfo string indicated by string. */
+        const char *ti_string;
+
+        if (!outer) {
+          result = T3_ERR_INVALID_FORMAT;
+          goto return_error;
+        }
+
+        ti_string = tigetstr(t3_config_get_string(ptr));
+        if (ti_string == (char *)0 || ti_string == (char *)-1) {
+          continue;
+        }
+        if ((result = builder_add_node(builder, name, ti_string, strlen(ti_string))) !=
+            T3_ERR_SUCCESS) {
+          goto return_error;
+        }
+      } else {
+        const char *string = t3_config_get_string(ptr);
+
+        result = name[0] != '_' && is_modifier_pattern(name, string)
+                     ? add_pattern_nodes(builder, name, string)
+                     : add_text_node(builder, name, string, 0);
+        if (result != T3_ERR_SUCCESS) {
+          goto return_error;
+        }
+      }
+    }
+  }
+  result = T3_ERR_SUCCESS;
+
+return_error:
+  free(stack);
+  free(index.entries);
+  return result;
+}
+
+/** Create a map from the text database. */
+static t3_key_node_t *load_config_map(const t3_config_t *map_config, const char *map_name,
+                                      int *error) {
+  const t3_config_t *map, *ptr;
+  map_builder_t builder = {NULL, 0, 0, 0, NULL, 0, 0};
+
+  if (map_name == NULL) {
+    map_name = t3_config_get_string(t3_config_get(map_config, "best"));
+  }
+
+  if ((map = t3_config_get(t3_config_get(map_config, "maps"), map_name)) == NULL) {
+    RETURN_ERROR(T3_ERR_NOMAP);
+  }
+
+  if (t3_config_get_bool(t3_config_get(map_config, "xterm_mouse"))) {
+    ENSURE(builder_add_node(&builder, "_xterm_mouse", NULL, 0));
+  }
+
+  if ((ptr = t3_config_get(map_config, "shiftfn")) != NULL) {
+    char shiftfn[3];
+
+    ptr = t3_config_get(ptr, NULL);
+    shiftfn[0] = t3_config_get_int(ptr);
+    ptr = t3_config_get_next(ptr);
+    shiftfn[1] = t3_config_get_int(ptr);
+    ptr = t3_config_get_next(ptr);
+    shiftfn[2] = t3_config_get_int(ptr);
+    ENSURE(builder_add_node(&builder, "_shiftfn", shiftfn, 3));
+  }
+
+  ENSURE(convert_map(map_config, map, &builder));
+  return finish_map(&builder, error);
+
+return_error:
+  free_map_builder(&builder);
+  return NULL;
+}
+
+t3_key_db_t *t3_key_db_open(const char *term, int *error) {
+  t3_key_db_t *db;
+  int result;
+
+  if ((db = malloc(sizeof(t3_key_db_t))) == NULL) {
+    if (error != NULL) {
+      *error = T3_ERR_OUT_OF_MEMORY;
+    }
+    return NULL;
+  }
+  db->term = NULL;
+  db->compiled.mapping = NULL;
+  db->compiled.fd = -1;
+  db->map_config = NULL;
+
+  if (term == NULL) {
+    term = getenv("TERM");
+    if (term == NULL) {
+      RETURN_ERROR(T3_ERR_NO_TERM);
+    }
+  }
+
+  if ((db->term = _t3_key_strdup(term)) == NULL) {
+    RETURN_ERROR(T3_ERR_OUT_OF_MEMORY);
+  }
+
+  if ((result = open_db(term, &db->compiled)) == T3_ERR_SUCCESS) {
+    return db;
+  } else if (result != T3_ERR_ERRNO || errno != ENOENT) {
+    RETURN_ERROR(result);
+  }
+
+  if ((db->map_config = load_map_config(term, &result)) == NULL &&
+      (result != T3_ERR_ERRNO || errno != ENOENT)) {
+    RETURN_ERROR(result);
+  }
+  return db;
+
+return_error:
+  t3_key_db_close(db);
+  return NULL;
+}
+
+void t3_key_db_close(t3_key_db_t *db) {
+  if (db == NULL) {
+    return;
+  }
+  close_db(&db->compiled);
+  t3_config_delete(db->map_config);
+  free(db->term);
+  free(db);
+}
+
+t3_key_node_t *t3_key_db_load_map(const t3_key_db_t *db, const char *map_name, int *error) {
+  if (db->compiled.mapping != NULL) {
+    return load_db_map(&db->compiled, map_name, error);
+  } else if (db->map_config != NULL) {
+    return load_config_map(db->map_config, map_name, error);
+  }
+  return load_ti_keys(db->term, error);
+}
+
+static t3_key_node_t *load_map(const char *term, const char *map_name, int *error) {
+  t3_key_db_t *db;
+  t3_key_node_t *map;
+
+  if ((db = t3_key_db_open(term, error)) == NULL) {
+    return NULL;
+  }
+  map = t3_key_db_load_map(db, map_name, error);
+  t3_key_db_close(db);
+  return map;
+}
+
+/* The database a map in the map cache was loaded from. */
+typedef enum { MAP_SOURCE_COMPILED, MAP_SOURCE_TEXT, MAP_SOURCE_TERMINFO } map_source_t;
+
+/** Get the name of the database entry a terminal name resolves to.
+    @param db The database opened for the terminal.
+    @param source Location to store which database the name refers to.
+
+    All names listed in aka resolve to the same entry. For the compiled
+    database, this is the first name in the terminals table which shares the
+    db_info_t. For the text database, this is the name of the file after
+    following symbolic links. If there is no entry for the terminal, the keys
+    are loaded from the terminfo database, and the name is the terminal name
+    itself.
+*/
+static char *get_resolved_name(const t3_key_db_t *db, map_source_t *source) {
+  if (db->compiled.mapping != NULL) {
+    const db_t *compiled = &db->compiled;
+    const db_header_t *header = compiled->mapping;
+    const db_terminal_t *terminals = DB_PTR(compiled, header->terminals);
+    uint32_t i;
+
+    *source = MAP_SOURCE_COMPILED;
+    for (i = 0; i < header->terminal_count; i++) {
+      if (DB_PTR(compiled, terminals[i].info) == (const void *)compiled->info) {
+        return _t3_key_strdup(DB_STRING(compiled, terminals[i].name));
+      }
+    }
+  } else if (db->map_config != NULL) {
+    const char *search_term = get_search_term(db->term);
+    const char *path[2] = {NULL, DB_DIRECTORY};
+    char *xdg_path, *name = NULL;
+    size_t i;
+
+    *source = MAP_SOURCE_TEXT;
+    /* Search the same directories, in the same order, as load_map_config. */
+    path[0] = xdg_path = t3_config_xdg_get_path(T3_CONFIG_XDG_DATA_HOME, "libt3key", 0);
+    for (i = 0; i < ARRAY_LENGTH(path) && name == NULL; i++) {
+      char *file_name, *resolved;
+
+      if (path[i] == NULL ||
+          (file_name = malloc(strlen(path[i]) + strlen(search_term) + 2)) == NULL) {
+        continue;
+      }
+      sprintf(file_name, "%s/%s", path[i], search_term);
+      if ((resolved = realpath(file_name, NULL)) != NULL) {
+        const char *base = strrchr(resolved, '/');
+        name = _t3_key_strdup(base == NULL ? resolved : base + 1);
+        free(resolved);
+      }
+      free(file_name);
+    }
+    free(xdg_path);
+    if (name != NULL) {
+      return name;
+    }
+    return _t3_key_strdup(search_term);
+  }
+  *source = MAP_SOURCE_TERMINFO;
+  return _t3_key_strdup(db->term);
+}
+
+/* Entry in the map cache. Entries are only ever added at the head of the list,
+   and are not modified after they have been published. This allows the list to
+   be searched without taking map_cache_lock.
+
+   Each entry records both the terminal name as passed to t3_key_load_map, and
+   the name of the database entry it resolves to. All terminal names resolving
+   to the same entry share a single map, and only the first lookup through a
+   new terminal name has to open the database. Each entry holds a reference to
+   its map. */
+typedef struct map_cache_entry_t {
+  char *term;
+  char *resolved_name;
+  map_source_t source;
+  char *map_name; /* NULL for the best map. */
+  t3_key_node_t *map;
+  struct map_cache_entry_t *next;
+} map_cache_entry_t;
+
+static int map_cache_enabled;
+static map_cache_entry_t *map_cache;
+/* Serialises loading of maps which are not in the cache yet, such that each
+   map is only loaded once. Also serialises t3_key_clear_map_cache. */
+static pthread_mutex_t map_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long map_cache_hits, map_cache_misses;
+/* Number of threads searching the list without holding map_cache_lock, for
+   each of two periods. Lookups register in the current period, such that
+   t3_key_clear_map_cache only has to wait for the lookups which started before
+   it detached the list. */
+static unsigned long map_cache_readers[2];
+static unsigned map_cache_period;
+
+static t3_bool same_map_name(const char *a, const char *b) {
+  return a == NULL ? b == NULL : b != NULL && strcmp(a, b) == 0;
+}
+
+static t3_key_node_t *find_cached_map(const char *term, const char *map_name) {
+  map_cache_entry_t *entry;
+
+  for (entry = __atomic_load_n(&map_cache, __ATOMIC_SEQ_CST); entry != NULL; entry = entry->next) {
+    if (strcmp(entry->term, term) == 0 && same_map_name(entry->map_name, map_name)) {
+      /* The reference held by the entry keeps the map alive until
+         t3_key_clear_map_cache has waited for this lookup to finish. */
+      __atomic_add_fetch(&MAP_BLOCK(entry->map)->refcount, 1, __ATOMIC_RELAXED);
+      return entry->map;
+    }
+  }
+  return NULL;
+}
+
+/** Search the map cache without holding map_cache_lock. */
+static t3_key_node_t *find_cached_map_unlocked(const char *term, const char *map_name) {
+  unsigned period = __atomic_load_n(&map_cache_period, __ATOMIC_SEQ_CST) & 1;
+  t3_key_node_t *map;
+
+  __atomic_add_fetch(&map_cache_readers[period], 1, __ATOMIC_SEQ_CST);
+  map = find_cached_map(term, map_name);
+  __atomic_sub_fetch(&map_cache_readers[period], 1, __ATOMIC_RELEASE);
+  return map;
+}
+
+/** Search the map cache for a map loaded through another terminal name. Must be
+    called with map_cache_lock held. */
+static t3_key_node_t *find_resolved_map(const char *resolved_name, map_source_t source,
+                                        const char *map_name) {
+  map_cache_entry_t *entry;
+
+  for (entry = map_cache; entry != NULL; entry = entry->next) {
+    if (entry->source == source && strcmp(entry->resolved_name, resolved_name) == 0 &&
+        same_map_name(entry->map_name, map_name)) {
+      __atomic_add_fetch(&MAP_BLOCK(entry->map)->refcount, 1, __ATOMIC_RELAXED);
+      return entry->map;
+    }
+  }
+  return NULL;
+}
+
+static void free_map_cache_entry(map_cache_entry_t *entry) {
+  if (entry == NULL) {
+    return;
+  }
+  free(entry->term);
+  free(entry->resolved_name);
+  free(entry->map_name);
+  free(entry);
+}
+
+static t3_key_node_t *load_cached_map(const char *term, const char *map_name, int *error) {
+  map_cache_entry_t *entry = NULL;
+  t3_key_node_t *map;
+  t3_key_db_t *db;
+
+  if ((map = find_cached_map_unlocked(term, map_name)) != NULL) {
+    __atomic_add_fetch(&map_cache_hits, 1, __ATOMIC_RELAXED);
+    return map;
+  }
+
+  pthread_mutex_lock(&map_cache_lock);
+  /* Another thread may have loaded the map while we were waiting for the lock. */
+  if ((map = find_cached_map(term, map_name)) != NULL) {
+    pthread_mutex_unlock(&map_cache_lock);
+    __atomic_add_fetch(&map_cache_hits, 1, __ATOMIC_RELAXED);
+    return map;
+  }
+
+  if ((db = t3_key_db_open(term, error)) == NULL) {
+    pthread_mutex_unlock(&map_cache_lock);
+    return NULL;
+  }
+
+  if ((entry = malloc(sizeof(map_cache_entry_t))) != NULL) {
+    entry->term = _t3_key_strdup(term);
+    entry->resolved_name = get_resolved_name(db, &entry->source);
+    entry->map_name = map_name == NULL ? NULL : _t3_key_strdup(map_name);
+    if (entry->term == NULL || entry->resolved_name == NULL ||
+        (map_name != NULL && entry->map_name == NULL)) {
+      /* The map can still be returned, it just won't be shared. */
+      free_map_cache_entry(entry);
+      entry = NULL;
+    }
+  }
+
+  if (entry != NULL &&
+      (map = find_resolved_map(entry->resolved_name, entry->source, map_name)) != NULL) {
+    __atomic_add_fetch(&map_cache_hits, 1, __ATOMIC_RELAXED);
+  } else {
+    __atomic_add_fetch(&map_cache_misses, 1, __ATOMIC_RELAXED);
+    map = t3_key_db_load_map(db, map_name, error);
+  }
+  t3_key_db_close(db);
+
+  if (map == NULL || entry == NULL) {
+    free_map_cache_entry(entry);
+    pthread_mutex_unlock(&map_cache_lock);
+    return map;
+  }
+
+  /* The reference for the entry, in addition to the one for the caller. */
+  __atomic_add_fetch(&MAP_BLOCK(map)->refcount, 1, __ATOMIC_RELAXED);
+  entry->map = map;
+  entry->next = map_cache;
+  __atomic_store_n(&map_cache, entry, __ATOMIC_SEQ_CST);
+  pthread_mutex_unlock(&map_cache_lock);
+  return map;
+}
+
+t3_key_node_t *t3_key_load_map(const char *term, const char *map_name, int *error) {
+  if (term == NULL) {
+    term = getenv("TERM");
+    if (term == NULL) {
+      if (error != NULL) {
+        *error = T3_ERR_NO_TERM;
+      }
+      return NULL;
+    }
+  }
+
+  if (__atomic_load_n(&map_cache_enabled, __ATOMIC_RELAXED)) {
+    return load_cached_map(term, map_name, error);
+  }
+  return load_map(term, map_name, error);
+}
+
+void t3_key_set_map_cache(int enable) {
+  __atomic_store_n(&map_cache_enabled, enable, __ATOMIC_RELAXED);
+}
+
+void t3_key_clear_map_cache(void) {
+  map_cache_entry_t *entry;
+  int i;
+
+  pthread_mutex_lock(&map_cache_lock);
+  entry = map_cache;
+  __atomic_store_n(&map_cache, NULL, __ATOMIC_SEQ_CST);
+
+  /* Lookups which register after this point can no longer reach the detached
+     entries, but lookups which registered before may still be using them, in
+     either period. Wait for both periods to drain, starting a new period each
+     time, such that lookups starting after the switch cannot keep the wait
+     going indefinitely. */
+  for (i = 0; i < 2; i++) {
+    unsigned period = __atomic_fetch_add(&map_cache_period, 1, __ATOMIC_SEQ_CST) & 1;
+    while (__atomic_load_n(&map_cache_readers[period], __ATOMIC_SEQ_CST) != 0) {
+      sched_yield();
+    }
+  }
+  pthread_mutex_unlock(&map_cache_lock);
+
+  while (entry != NULL) {
+    map_cache_entry_t *next = entry->next;
+    t3_key_free_map(entry->map);
+    free_map_cache_entry(entry);
+    entry = next;
+  }
+}
+
+void t3_key_get_map_cache_stats(unsigned long *hits, unsigned long *misses) {
+  if (hits != NULL) {
+    *hits = __atomic_load_n(&map_cache_hits, __ATOMIC_RELAXED);
+  }
+  if (misses != NULL) {
+    *misses = __atomic_load_n(&map_cache_misses, __ATOMIC_RELAXED);
+  }
+}
+
+void t3_key_free_map(t3_key_node_t *list) {
+  map_block_t *block;
+
+  if (list == NULL) {
+    return;
+  }
+
+  block = MAP_BLOCK(list);
+  if (__atomic_sub_fetch(&block->refcount, 1, __ATOMIC_ACQ_REL) != 0) {
+    return;
+  }
+  if (block->mapping != NULL) {
+    munmap(block->mapping, block->mapping_size);
+  }
+  free(block);
+}
+
+/** Add a node for terminfo capability @p tikey to @p builder, if the terminal has it.
+    @param added Location to store whether the node was added, or @c NULL.
+*/
+static int make_node_from_ti(map_builder_t *builder, const char *tikey, const char *key,
+                             t3_bool *added) {
+  char *tiresult;
+
+  tiresult = tigetstr(tikey);
+  if (tiresult == (char *)0 || tiresult == (char *)-1) {
+    if (added != NULL) {
+      *added = t3_false;
+    }
+    return T3_ERR_SUCCESS;
+  }
+
+  if (added != NULL) {
+    *added = t3_true;
+  }
+  return builder_add_node(builder, key, tiresult, strlen(tiresult));
+}
+
+/* The START/END MAPPINGS comments below are markers to allow extraction of this
+   list and the modifier pattern functions for t3keyc. */
+
+/*START MAPPINGS*/
 typedef struct {
   const char *tikey;
   const char *key;
@@ -560,11 +1631,95 @@ static const mapping_t keymapping[] = {{"kich1", "insert"},
                                        {"kb1", "kp_left"},
                                        {"kb3", "kp_right"},
                                        {"kc2", "kp_up"}};
+
+/* A key with modifiers whose sequence contains %m is a modifier pattern. It
+   stands for the keys with each non-empty combination of the listed
+   modifiers, with %m replaced by the xterm-style modifier parameter. The
+   combinations are numbered by the modifier parameter minus one, which is the
+   sum of 1 for shift, 2 for meta and 4 for control. */
+#define PATTERN_COMBINATIONS 8
+
+/** Find the next %m in @p string, skipping escaped characters. */
+static const char *find_pattern_marker(const char *string) {
+  for (; *string != 0; string++) {
+    if (string[0] == '\\' && string[1] != 0) {
+      string++;
+    } else if (string[0] == '%' && string[1] == 'm') {
+      return string;
+    }
+  }
+  return NULL;
+}
+
+/** Check whether the key @p name with sequence @p string is a modifier pattern. */
+static int is_modifier_pattern(const char *name, const char *string) {
+  return strchr(name, '-') != NULL && find_pattern_marker(string) != NULL;
+}
+
+/** Get the name of a key described by a modifier pattern.
+    @param name The name of the pattern.
+    @param combination The combination of modifiers, from 1 to @c PATTERN_COMBINATIONS - 1.
+    @param buffer Location to store the name, which must be at least as large as @p name.
+    @return 1 if the pattern includes @p combination, 0 otherwise.
+*/
+static int get_pattern_name(const char *name, int combination, char *buffer) {
+  static const struct {
+    char letter;
+    int bit;
+  } modifiers[] = {{'c', 4}, {'m', 2}, {'s', 1}};
+  const char *suffix = strchr(name, '-') + 1;
+  size_t i;
+
+  memcpy(buffer, name, suffix - name);
+  buffer += suffix - name;
+  for (i = 0; i < sizeof(modifiers) / sizeof(modifiers[0]); i++) {
+    if (combination & modifiers[i].bit) {
+      if (strchr(suffix, modifiers[i].letter) == NULL) {
+        return 0;
+      }
+      *buffer++ = modifiers[i].letter;
+    }
+  }
+  *buffer = 0;
+  return 1;
+}
+
+/** Replace each %m in @p string by the modifier parameter for @p combination.
+    The string is modified in place, and only becomes shorter.
+*/
+static void substitute_pattern(char *string, int combination) {
+  char *marker;
+
+  while ((marker = (char *)find_pattern_marker(string)) != NULL) {
+    *marker = '1' + combination;
+    memmove(marker + 1, marker + 2, strlen(marker + 2) + 1);
+    string = marker + 1;
+  }
+}
 /*END MAPPINGS*/
 
+/** Add the nodes for the keys described by a modifier pattern to @p builder. */
+static int add_pattern_nodes(map_builder_t *builder, const char *name, const char *string) {
+  char *buffer;
+  int combination, result = T3_ERR_SUCCESS;
+
+  if ((buffer = malloc(strlen(name) + 1)) == NULL) {
+    return T3_ERR_OUT_OF_MEMORY;
+  }
+  for (combination = 1; combination < PATTERN_COMBINATIONS && result == T3_ERR_SUCCESS;
+       combination++) {
+    if (get_pattern_name(name, combination, buffer)) {
+      result = add_text_node(builder, buffer, string, combination);
+    }
+  }
+  free(buffer);
+  return result;
+}
+
 static t3_key_node_t *load_ti_keys(const char *term, int *error) {
-  t3_key_node_t *list = NULL, **next_node = &list;
+  map_builder_t builder = {NULL, 0, 0, 0, NULL, 0, 0};
   char function_key[10];
+  t3_bool added;
   size_t i;
   int errret, j;
 
@@ -579,68 +1734,102 @@ static t3_key_node_t *load_ti_keys(const char *term, int *error) {
     RETURN_ERROR(T3_ERR_UNKNOWN);
   }
 
-  ENSURE(make_node_from_ti(next_node, "smkx", "_enter"));
-  if (*next_node != NULL) {
-    next_node = &(*next_node)->next;
-  }
-  ENSURE(make_node_from_ti(next_node, "rmkx", "_leave"));
-  if (*next_node != NULL) {
-    next_node = &(*next_node)->next;
-  }
+  ENSURE(make_node_from_ti(&builder, "smkx", "_enter", NULL));
+  ENSURE(make_node_from_ti(&builder, "rmkx", "_leave", NULL));
 
   for (i = 0; i < ARRAY_LENGTH(keymapping); i++) {
-    ENSURE(make_node_from_ti(next_node, keymapping[i].tikey, keymapping[i].key));
-    if (*next_node != NULL) {
-      next_node = &(*next_node)->next;
-    }
+    ENSURE(make_node_from_ti(&builder, keymapping[i].tikey, keymapping[i].key, NULL));
   }
 
   for (j = 1; j < 64; j++) {
     sprintf(function_key, "kf%d", j);
-    ENSURE(make_node_from_ti(next_node, function_key, function_key + 1));
-    if (*next_node == NULL) {
+    ENSURE(make_node_from_ti(&builder, function_key, function_key + 1, &added));
+    if (!added) {
       break;
     }
-    next_node = &(*next_node)->next;
   }
-  return list;
+  return finish_map(&builder, error);
 
 return_error:
-  t3_key_free_map(list);
+  free_map_builder(&builder);
   return NULL;
 }
 
-t3_key_string_list_t *t3_key_get_map_names(const char *term, int *error) {
-  t3_config_t *map_config = NULL, *ptr;
+/* Without a key database, only the terminfo keys are available, which do not
+   have named maps. */
+#define RETURN_NO_DB()          \
+  do {                          \
+    errno = ENOENT;             \
+    RETURN_ERROR(T3_ERR_ERRNO); \
+  } while (0)
+
+t3_key_string_list_t *t3_key_db_get_map_names(const t3_key_db_t *db, int *error) {
   t3_key_string_list_t *list = NULL, *item;
+  const char *name;
 
-  if ((map_config = load_map_config(term, error)) == NULL) {
-    return NULL;
-  }
+  if (db->compiled.mapping != NULL) {
+    const db_map_t *maps = get_db_maps(&db->compiled);
+    uint32_t i;
 
-  for (ptr = t3_config_get(t3_config_get(map_config, "maps"), NULL); ptr != NULL;
-       ptr = t3_config_get_next(ptr)) {
-    if (t3_config_get_name(ptr)[0] == '_') {
-      continue;
-    }
-    if ((item = malloc(sizeof(t3_key_string_list_t))) == NULL) {
-      RETURN_ERROR(T3_ERR_OUT_OF_MEMORY);
+    for (i = 0; i < db->compiled.info->map_count; i++) {
+      if (maps[i].name >= db->compiled.size) {
+        RETURN_ERROR(T3_ERR_INVALID_FORMAT);
+      }
+      name = DB_STRING(&db->compiled, maps[i].name);
+      if (name[0] == '_') {
+        continue;
+      }
+      if ((item = malloc(sizeof(t3_key_string_list_t))) == NULL) {
+        RETURN_ERROR(T3_ERR_OUT_OF_MEMORY);
+      }
+      if ((item->string = _t3_key_strdup(name)) == NULL) {
+        free(item);
+        RETURN_ERROR(T3_ERR_OUT_OF_MEMORY);
+      }
+      item->next = list;
+      list = item;
     }
-
-    if ((item->string = _t3_key_strdup(t3_config_get_name(ptr))) == NULL) {
-      free(item);
-      RETURN_ERROR(T3_ERR_OUT_OF_MEMORY);
+  } else if (db->map_config != NULL) {
+    const t3_config_t *ptr;
+
+    for (ptr = t3_config_get(t3_config_get(db->map_config, "maps"), NULL); ptr != NULL;
+         ptr = t3_config_get_next(ptr)) {
+      name = t3_config_get_name(ptr);
+      if (name[0] == '_') {
+        continue;
+      }
+      if ((item = malloc(sizeof(t3_key_string_list_t))) == NULL) {
+        RETURN_ERROR(T3_ERR_OUT_OF_MEMORY);
+      }
+      if ((item->string = _t3_key_strdup(name)) == NULL) {
+        free(item);
+        RETURN_ERROR(T3_ERR_OUT_OF_MEMORY);
+      }
+      item->next = list;
+      list = item;
     }
-    item->next = list;
-    list = item;
+  } else {
+    RETURN_NO_DB();
   }
-  t3_config_delete(map_config);
   return list;
+
 return_error:
-  t3_config_delete(map_config);
+  t3_key_free_names(list);
   return NULL;
 }
 
+t3_key_string_list_t *t3_key_get_map_names(const char *term, int *error) {
+  t3_key_db_t *db;
+  t3_key_string_list_t *list;
+
+  if ((db = t3_key_db_open(term, error)) == NULL) {
+    return NULL;
+  }
+  list = t3_key_db_get_map_names(db, error);
+  t3_key_db_close(db);
+  return list;
+}
+
 void t3_key_free_names(t3_key_string_list_t *list) {
   t3_key_string_list_t *prev;
   while (list != NULL) {
@@ -651,35 +1840,143 @@ void t3_key_free_names(t3_key_string_list_t *list) {
   }
 }
 
+char *t3_key_db_get_best_map_name(const t3_key_db_t *db, int *error) {
+  const char *best_name;
+  char *best;
+
+  if (db->compiled.mapping != NULL) {
+    const db_map_t *best_map = &get_db_maps(&db->compiled)[db->compiled.info->best];
+
+    if (best_map->name >= db->compiled.size) {
+      RETURN_ERROR(T3_ERR_INVALID_FORMAT);
+    }
+    best_name = DB_STRING(&db->compiled, best_map->name);
+  } else if (db->map_config != NULL) {
+    best_name = t3_config_get_string(t3_config_get(db->map_config, "best"));
+  } else {
+    RETURN_NO_DB();
+  }
+
+  if ((best = _t3_key_strdup(best_name)) == NULL) {
+    RETURN_ERROR(T3_ERR_OUT_OF_MEMORY);
+  }
+  return best;
+
+return_error:
+  return NULL;
+}
+
 char *t3_key_get_best_map_name(const char *term, int *error) {
-  t3_config_t *map_config = NULL;
-  char *best = NULL;
-  if ((map_config = load_map_config(term, error)) == NULL) {
+  t3_key_db_t *db;
+  char *best;
+
+  if ((db = t3_key_db_open(term, error)) == NULL) {
     return NULL;
   }
+  best = t3_key_db_get_best_map_name(db, error);
+  t3_key_db_close(db);
+  return best;
+}
 
-  if ((best = _t3_key_strdup(t3_config_get_string(t3_config_get(map_config, "best")))) == NULL) {
-    if (error != NULL) {
-      *error = T3_ERR_OUT_OF_MEMORY;
+/** Get the map_block_t containing @p node, using the node index stored in front of its key.
+
+    This is shared by all functions which use the indices of a map. Only nodes
+    of maps returned by t3_key_load_map have the node index, which is why these
+    functions document that they do not accept lists constructed by the
+    application. Such lists have separate entry points, which only use the
+    fields of the nodes.
+*/
+static map_block_t *get_node_block(const t3_key_node_t *node, uint32_t *index) {
+  memcpy(index, node->key - KEY_PREFIX_SIZE, KEY_PREFIX_SIZE);
+  return MAP_BLOCK(node - *index);
+}
+
+t3_key_id_t t3_key_get_node_id(const t3_key_node_t *node, int *modifiers) {
+  map_block_t *block;
+  uint32_t index;
+
+  if (node == NULL) {
+    if (modifiers != NULL) {
+      *modifiers = 0;
     }
+    return T3_KEY_ID_NONE;
+  }
+  block = get_node_block(node, &index);
+  if (modifiers != NULL) {
+    *modifiers = block->ids[index] % T3_KEY_MOD_COUNT;
   }
+  return block->ids[index] / T3_KEY_MOD_COUNT;
+}
 
-  t3_config_delete(map_config);
-  return best;
+t3_key_id_t t3_key_get_name_id(const char *name, int *modifiers) {
+  uint32_t id = name == NULL ? 0 : parse_key_name(name);
+
+  if (modifiers != NULL) {
+    *modifiers = id % T3_KEY_MOD_COUNT;
+  }
+  return id / T3_KEY_MOD_COUNT;
+}
+
+t3_key_node_t *t3_key_lookup(T3_KEY_CONST t3_key_node_t *map, t3_key_id_t id, int modifiers) {
+  map_block_t *block;
+  uint32_t start, next;
+
+  if (map == NULL || id <= T3_KEY_ID_NONE || (uint32_t)id >= T3_KEY_ID_COUNT || modifiers < 0 ||
+      modifiers >= T3_KEY_MOD_COUNT) {
+    return NULL;
+  }
+
+  block = get_node_block(map, &start);
+  if ((uint32_t)id >= block->id_limit) {
+    return NULL;
+  }
+  next = block->id_table[id * T3_KEY_MOD_COUNT + modifiers];
+  /* The search starts at map, which need not be the first node. */
+  while (next != 0 && next - 1 < start) {
+    next = block->next_same[next - 1];
+  }
+  return next == 0 ? NULL : &block->nodes[next - 1];
 }
 
 t3_key_node_t *t3_key_get_named_node(T3_KEY_CONST t3_key_node_t *map, const char *name) {
+  map_block_t *block;
+  uint32_t start, slot, next;
+
+  if (map == NULL) {
+    return NULL;
+  }
+
+  block = get_node_block(map, &start);
   if (name == NULL) {
-    if (map == NULL) {
-      return NULL;
+    next = block->next_same[start];
+    return next == 0 ? NULL : &block->nodes[next - 1];
+  }
+
+  slot = hash_key(name) & block->table_mask;
+  for (next = block->table[slot]; next != 0; next = block->table[slot]) {
+    if (strcmp(block->nodes[next - 1].key, name) == 0) {
+      break;
     }
-    name = map->key;
-    map = map->next;
+    slot = (slot + 1) & block->table_mask;
+  }
+  /* The search starts at map, which need not be the first node. */
+  while (next != 0 && next - 1 < start) {
+    next = block->next_same[next - 1];
   }
+  return next == 0 ? NULL : &block->nodes[next - 1];
+}
 
-  for (; map != NULL; map = map->next) {
-    if (strcmp(map->key, name) == 0) {
-      return map;
+t3_key_node_t *t3_key_find_named_node(T3_KEY_CONST t3_key_node_t *list, const char *name) {
+  if (list == NULL) {
+    return NULL;
+  }
+  if (name == NULL) {
+    name = list->key;
+    list = list->next;
+  }
+  for (; list != NULL; list = list->next) {
+    if (strcmp(list->key, name) == 0) {
+      return list;
     }
   }
   return NULL;
@@ -69,6 +69,74 @@ struct t3_key_string_list_t {
       *next; /**< Pointer to the next ::t3_key_string_list_t in the singly-linked list. */
 };
 
+/** @name Key identifiers */
+/*@{*/
+/** The names of the keys, other than the function keys, with their identifier suffix.
+
+    New keys must be added at the end of the list, to keep the identifiers of the existing keys
+    stable. The START/END KEY IDS comments are markers to allow extraction of this list for
+    t3keyc.
+*/
+/*START KEY IDS*/
+#define T3_KEY_IDS(_x)             \
+  _x(INSERT, "insert")             \
+  _x(DELETE, "delete")             \
+  _x(HOME, "home")                 \
+  _x(END, "end")                   \
+  _x(PAGE_UP, "page_up")           \
+  _x(PAGE_DOWN, "page_down")       \
+  _x(UP, "up")                     \
+  _x(LEFT, "left")                 \
+  _x(DOWN, "down")                 \
+  _x(RIGHT, "right")               \
+  _x(KP_HOME, "kp_home")           \
+  _x(KP_UP, "kp_up")               \
+  _x(KP_PAGE_UP, "kp_page_up")     \
+  _x(KP_PAGE_DOWN, "kp_page_down") \
+  _x(KP_LEFT, "kp_left")           \
+  _x(KP_CENTER, "kp_center")       \
+  _x(KP_RIGHT, "kp_right")         \
+  _x(KP_END, "kp_end")             \
+  _x(KP_DOWN, "kp_down")           \
+  _x(KP_INSERT, "kp_insert")       \
+  _x(KP_DELETE, "kp_delete")       \
+  _x(KP_ENTER, "kp_enter")         \
+  _x(KP_DIV, "kp_div")             \
+  _x(KP_MUL, "kp_mul")             \
+  _x(KP_MINUS, "kp_minus")         \
+  _x(KP_PLUS, "kp_plus")           \
+  _x(TAB, "tab")                   \
+  _x(BACKSPACE, "backspace")       \
+  _x(ENTER, "enter")
+/*END KEY IDS*/
+
+/** The highest numbered function key with a key identifier. */
+#define T3_KEY_MAX_FUNCTION_KEY 99
+
+#define _T3_KEY_ID_ENUM(_id, _name) T3_KEY_ID_##_id,
+/** Identifiers for the keys, without modifiers. See ::t3_key_lookup. */
+typedef enum {
+  T3_KEY_ID_NONE, /**< Not a key, such as @c _enter, or a key with an unknown name. */
+  T3_KEY_ID_F1,   /**< The first function key. Use ::T3_KEY_ID_F for the others. */
+  T3_KEY_ID_F_LAST = T3_KEY_ID_F1 + T3_KEY_MAX_FUNCTION_KEY - 1,
+  T3_KEY_IDS(_T3_KEY_ID_ENUM)
+  T3_KEY_ID_COUNT /**< The number of key identifiers. */
+} t3_key_id_t;
+#undef _T3_KEY_ID_ENUM
+
+/** The identifier for function key @p _n, from 1 to ::T3_KEY_MAX_FUNCTION_KEY. */
+#define T3_KEY_ID_F(_n) ((t3_key_id_t)(T3_KEY_ID_F1 + (_n)-1))
+
+/** Modifier flag for the shift key, the @c s suffix of a key name. */
+#define T3_KEY_MOD_SHIFT (1 << 0)
+/** Modifier flag for the meta key, the @c m suffix of a key name. */
+#define T3_KEY_MOD_META (1 << 1)
+/** Modifier flag for the control key, the @c c suffix of a key name. */
+#define T3_KEY_MOD_CTRL (1 << 2)
+/** The number of different modifier combinations. */
+#define T3_KEY_MOD_COUNT 8
+/*@}*/
+
 #include "key_errors.h"
 
 /** @name Error codes (libt3key specific) */
@@ -106,9 +174,46 @@ T3_KEY_API T3_KEY_CONST t3_key_node_t *t3_key_load_map(const char *term, const c
 
 /** Free a key map.
     @param list The list of keys to free.
+
+    If the map is shared through the map cache, this only drops the reference
+    to the map held by the caller.
 */
 T3_KEY_API void t3_key_free_map(T3_KEY_CONST t3_key_node_t *list);
 
+/** Enable or disable the map cache.
+    @param enable Non-zero to enable the map cache, zero to disable it.
+
+    When the map cache is enabled, ::t3_key_load_map returns a shared map if
+    the same map has been loaded before for the same terminal name. Shared maps
+    are reference counted, and must still be freed with ::t3_key_free_map by
+    each caller. Looking up a map in the cache does not require any locking.
+    The map cache is disabled by default. Disabling the map cache does not
+    remove the cached maps; use ::t3_key_clear_map_cache for that.
+
+    Maps are cached by the name of the database entry the terminal name
+    resolves to, and the map name. All names listed in the @c aka list of a
+    terminal therefore share the same maps. The database is only opened the
+    first time a map is requested through a particular terminal name. The cache
+    should only be used when the key database is not changed while the program
+    is running.
+*/
+T3_KEY_API void t3_key_set_map_cache(int enable);
+
+/** Remove all maps from the map cache.
+
+    Maps which are still in use are freed when the last reference is dropped.
+    This function may be called while other threads are calling
+    ::t3_key_load_map. It waits for lookups which may still be using the
+    removed cache entries to finish.
+*/
+T3_KEY_API void t3_key_clear_map_cache(void);
+
+/** Get the number of hits and misses of the map cache.
+    @param hits Location to store the number of maps returned from the cache, or @c NULL.
+    @param misses Location to store the number of maps loaded into the cache, or @c NULL.
+*/
+T3_KEY_API void t3_key_get_map_cache_stats(unsigned long *hits, unsigned long *misses);
+
 /** Get map names from database.
     @param term The terminal name to use to find the key database.
     @param error Location to store the error code.
@@ -134,6 +239,63 @@ T3_KEY_API void t3_key_free_names(T3_KEY_CONST t3_key_string_list_t *list);
 */
 T3_KEY_API char *t3_key_get_best_map_name(const char *term, int *error);
 
+/** An opened key database for a single terminal. */
+typedef struct t3_key_db_t t3_key_db_t;
+
+/** Open the key database for a terminal.
+    @param term The terminal name to use to find the key database.
+    @param error Location to store the error code.
+    @return NULL on failure, a handle for the key database on success.
+
+    If @p term is @c NULL, the environment variable @c TERM is used to retrieve the
+    terminal name. The database is read only once, after which any number of
+    queries can be made with ::t3_key_db_get_map_names, ::t3_key_db_get_best_map_name
+    and ::t3_key_db_load_map. The handle must be released with ::t3_key_db_close.
+
+    If no key database exists for the terminal, the handle is still returned.
+    In that case, ::t3_key_db_load_map will return the keys from the terminfo
+    database, and the other functions will fail with ::T3_ERR_ERRNO and @c errno
+    set to @c ENOENT.
+*/
+T3_KEY_API t3_key_db_t *t3_key_db_open(const char *term, int *error);
+
+/** Close a key database opened with ::t3_key_db_open.
+    @param db The key database to close.
+
+    Maps loaded from the database remain valid after closing it.
+*/
+T3_KEY_API void t3_key_db_close(t3_key_db_t *db);
+
+/** Load a key map from an opened key database.
+    @param db The key database to load the map from.
+    @param map_name Name of the map to load, or @c NULL for the best map.
+    @param error Location to store the error code.
+    @return NULL on failure, a list of ::t3_key_node_t structures on success.
+
+    See ::t3_key_load_map for details. The map must be freed with ::t3_key_free_map.
+*/
+T3_KEY_API T3_KEY_CONST t3_key_node_t *t3_key_db_load_map(const t3_key_db_t *db,
+                                                          const char *map_name, int *error);
+
+/** Get map names from an opened key database.
+    @param db The key database to retrieve the names from.
+    @param error Location to store the error code.
+    @return NULL on failure, a list of ::t3_key_string_list_t structures on success.
+
+    The list must be freed with ::t3_key_free_names.
+*/
+T3_KEY_API T3_KEY_CONST t3_key_string_list_t *t3_key_db_get_map_names(const t3_key_db_t *db,
+                                                                      int *error);
+
+/** Get name of best map from an opened key database.
+    @param db The key database to retrieve the name from.
+    @param error Location to store the error code.
+    @return NULL on failure, the name of the best map on success.
+
+    The name is allocated using @c malloc.
+*/
+T3_KEY_API char *t3_key_db_get_best_map_name(const t3_key_db_t *db, int *error);
+
 /** Get a named node from a map.
     @param map The map to search.
     @param name The name of the node to search for, or @c NULL to continue the last search.
@@ -142,10 +304,64 @@ T3_KEY_API char *t3_key_get_best_map_name(const char *term, int *error);
     Multiple nodes may exist with the same name. To retrieve all of them, ::t3_key_get_named_node
     may be called multiple times. The second and later calls @b must use the returned value
     as the @p map parameter, and pass @c NULL as @p name.
+
+    The search uses an index which is built when the map is loaded, and takes constant time.
+    Therefore, @p map must be a map returned by ::t3_key_load_map (or a node of such a map), not
+    a list constructed by the application. Such lists can be searched with
+    ::t3_key_find_named_node.
 */
 T3_KEY_API T3_KEY_CONST t3_key_node_t *t3_key_get_named_node(T3_KEY_CONST t3_key_node_t *map,
                                                              const char *name);
 
+/** Get a named node from any list of nodes.
+    @param list The list to search.
+    @param name The name of the node to search for, or @c NULL to continue the last search.
+    @return The ::t3_key_node_t with the given name, or @c NULL if no such node exists.
+
+    This is the equivalent of ::t3_key_get_named_node for lists constructed by the application.
+    The list is searched linearly, which takes time proportional to the length of the list.
+*/
+T3_KEY_API T3_KEY_CONST t3_key_node_t *t3_key_find_named_node(T3_KEY_CONST t3_key_node_t *list,
+                                                              const char *name);
+
+/** Get the key identifier and modifiers of a node.
+    @param node The node to query. This must be a node of a map returned by ::t3_key_load_map, or
+        @c NULL.
+    @param modifiers Location to store the @c T3_KEY_MOD_* flags of the node, or @c NULL.
+    @return The ::t3_key_id_t of the node, or ::T3_KEY_ID_NONE if @p node is @c NULL.
+
+    The identifier is determined from the name of the node when the map is loaded. Nodes which do
+    not describe a key, such as @c _enter, and nodes with unknown names have identifier
+    ::T3_KEY_ID_NONE. For nodes of a list constructed by the application, use
+    ::t3_key_get_name_id with the name of the node.
+*/
+T3_KEY_API t3_key_id_t t3_key_get_node_id(const t3_key_node_t *node, int *modifiers);
+
+/** Get the key identifier and modifiers described by a key name.
+    @param name The name to parse, such as @c page_up-cs, or @c NULL.
+    @param modifiers Location to store the @c T3_KEY_MOD_* flags, or @c NULL.
+    @return The ::t3_key_id_t of the name, or ::T3_KEY_ID_NONE if it does not describe a key.
+
+    This gives the same result as ::t3_key_get_node_id for a node with name @p name, but does not
+    require a map returned by ::t3_key_load_map.
+*/
+T3_KEY_API t3_key_id_t t3_key_get_name_id(const char *name, int *modifiers);
+
+/** Get a node from a map by key identifier and modifiers.
+    @param map The map to search. This must be a map returned by ::t3_key_load_map (or a node of
+        such a map), or @c NULL.
+    @param id The ::t3_key_id_t of the key.
+    @param modifiers The @c T3_KEY_MOD_* flags of the key.
+    @return The first ::t3_key_node_t for the key, or @c NULL if no such node exists.
+
+    This is the equivalent of ::t3_key_get_named_node for a name like @c page_up-cs, but uses a
+    table lookup instead of comparing names. To retrieve further nodes for the same key, use
+    ::t3_key_get_named_node with the returned value and @c NULL as name. Lists constructed by the
+    application can only be searched by name, with ::t3_key_find_named_node.
+*/
+T3_KEY_API T3_KEY_CONST t3_key_node_t *t3_key_lookup(T3_KEY_CONST t3_key_node_t *map,
+                                                     t3_key_id_t id, int modifiers);
+
 /** Get the value of ::T3_KEY_VERSION corresponding to the actual used library.
     @ingroup t3window_other
     @return The value of ::T3_KEY_VERSION.
@@ -0,0 +1,391 @@
+/* Copyright (C) 2018 G.P. Halkes
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef HAS_EVENTFD
+#include <sys/eventfd.h>
+#endif
+
+#include "reader.h"
+
+#define RETURN_ERROR(_e)            \
+  do {                              \
+    if (error != NULL) *error = _e; \
+    goto return_error;              \
+  } while (0)
+
+/* The number of events in the queue. Must be a power of two. */
+#define QUEUE_SIZE 256
+/* The maximum number of bytes read from the terminal at once. */
+#define READ_SIZE 4096
+/* The maximum number of events decoded at once. */
+#define BATCH_SIZE 64
+
+/* A file descriptor which can be made readable by another thread. This is an
+   eventfd if available, or a pipe otherwise. */
+typedef struct {
+  int read_fd, write_fd;
+} notifier_t;
+
+struct t3_key_reader_t {
+  /* The queue of events. Only the reader thread writes head, and only the
+     program writes tail. Both are only ever incremented, and are kept on
+     separate cache lines. */
+  unsigned long head __attribute__((aligned(64)));
+  unsigned long tail __attribute__((aligned(64)));
+  /* Whether the reader thread waits for the program to make room in the
+     queue. */
+  int producer_waiting __attribute__((aligned(64)));
+  /* The flags requested with t3_key_reader_set_flags. */
+  int flags;
+  /* The reason the reader thread stopped, and the errno value for
+     T3_ERR_ERRNO. */
+  int error, saved_errno;
+
+  int fd;
+  t3_key_decoder_t *decoder;
+  pthread_t thread;
+  int thread_started;
+  /* Notifiers for new events in the queue, for room in the queue, and for
+     stopping the reader thread. */
+  notifier_t events, space, stop;
+
+  t3_key_reader_event_t queue[QUEUE_SIZE];
+};
+
+static int notifier_init(notifier_t *notifier) {
+#ifdef HAS_EVENTFD
+  notifier->read_fd = notifier->write_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  return notifier->read_fd >= 0;
+#else
+  int fds[2], i;
+
+  if (pipe(fds) < 0) {
+    return 0;
+  }
+  notifier->read_fd = fds[0];
+  notifier->write_fd = fds[1];
+  for (i = 0; i < 2; i++) {
+    if (fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK) < 0 ||
+        fcntl(fds[i], F_SETFD, FD_CLOEXEC) < 0) {
+      return 0;
+    }
+  }
+  return 1;
+#endif
+}
+
+static void notifier_signal(notifier_t *notifier) {
+  uint64_t value = 1;
+  ssize_t result;
+
+  /* If the write fails because the pipe is full, it is readable already. */
+  do {
+    result = write(notifier->write_fd, &value, notifier->read_fd == notifier->write_fd ? 8 : 1);
+  } while (result < 0 && errno == EINTR);
+}
+
+static void notifier_drain(notifier_t *notifier) {
+  char buffer[64];
+  ssize_t result;
+
+  do {
+    result = read(notifier->read_fd, buffer, sizeof(buffer));
+  } while (result > 0 || (result < 0 && errno == EINTR));
+}
+
+static void notifier_close(notifier_t *notifier) {
+  if (notifier->read_fd >= 0) {
+    close(notifier->read_fd);
+  }
+  if (notifier->write_fd >= 0 && notifier->write_fd != notifier->read_fd) {
+    close(notifier->write_fd);
+  }
+}
+
+/** Wait until the queue has room for an event.
+    @return @c 1 if the queue has room, or @c 0 if the reader thread must stop.
+*/
+static int wait_for_space(t3_key_reader_t *reader) {
+  struct pollfd fds[2];
+
+  fds[0].fd = reader->space.read_fd;
+  fds[0].events = POLLIN;
+  fds[1].fd = reader->stop.read_fd;
+  fds[1].events = POLLIN;
+
+  while (reader->head - __atomic_load_n(&reader->tail, __ATOMIC_ACQUIRE) == QUEUE_SIZE) {
+    /* The program checks producer_waiting after updating tail, so either it
+       sees the flag or this thread sees the new tail. */
+    __atomic_store_n(&reader->producer_waiting, 1, __ATOMIC_SEQ_CST);
+    if (reader->head - __atomic_load_n(&reader->tail, __ATOMIC_SEQ_CST) < QUEUE_SIZE) {
+      __atomic_store_n(&reader->producer_waiting, 0, __ATOMIC_RELAXED);
+      break;
+    }
+    /* The program may not have been woken up for the events in the queue. */
+    notifier_signal(&reader->events);
+    if (poll(fds, 2, -1) < 0 && errno != EINTR) {
+      return 0;
+    }
+    if (fds[1].revents != 0) {
+      return 0;
+    }
+    notifier_drain(&reader->space);
+    __atomic_store_n(&reader->producer_waiting, 0, __ATOMIC_RELAXED);
+  }
+  return 1;
+}
+
+/** Add an event to the queue, splitting it if its data does not fit in a single entry.
+    @return @c 1 on success, or @c 0 if the reader thread must stop.
+*/
+static int push_event(t3_key_reader_t *reader, const t3_key_event_t *event,
+                      const struct timespec *time) {
+  t3_key_event_t text;
+  const char *data = event->data;
+  size_t left = event->length;
+
+  /* Only text can be split. Replies and mouse reports always fit, but a map
+     may have longer sequences, which are passed on as text. */
+  if (left > T3_KEY_READER_DATA_SIZE && event->type != T3_KEY_EVENT_TEXT &&
+      event->type != T3_KEY_EVENT_PASTE) {
+    text = *event;
+    text.type = T3_KEY_EVENT_TEXT;
+    text.node = NULL;
+    text.id = T3_KEY_ID_NONE;
+    text.modifiers = 0;
+    text.character = 0;
+    event = &text;
+  }
+
+  do {
+    t3_key_reader_event_t *entry;
+    size_t length = left;
+
+    if (length > T3_KEY_READER_DATA_SIZE) {
+      length = T3_KEY_READER_DATA_SIZE;
+      if (event->type == T3_KEY_EVENT_TEXT) {
+        /* Do not split UTF-8 characters. */
+        while (length > 0 && (data[length] & 0xc0) == 0x80) {
+          length--;
+        }
+        if (length == 0) {
+          length = T3_KEY_READER_DATA_SIZE;
+        }
+      }
+    }
+
+    if (!wait_for_space(reader)) {
+      return 0;
+    }
+    entry = &reader->queue[reader->head % QUEUE_SIZE];
+    entry->event = *event;
+    entry->event.data = entry->data;
+    entry->event.length = length;
+    if (event->type == T3_KEY_EVENT_OSC) {
+      entry->event.reply.string = entry->data + (event->reply.string - event->data);
+    }
+    entry->time = *time;
+    memcpy(entry->data, data, length);
+    __atomic_store_n(&reader->head, reader->head + 1, __ATOMIC_RELEASE);
+
+    data += length;
+    left -= length;
+  } while (left > 0);
+  return 1;
+}
+
+static void *reader_thread(void *arg) {
+  t3_key_reader_t *reader = arg;
+  t3_key_event_t events[BATCH_SIZE];
+  struct timespec time = {0, 0};
+  struct pollfd fds[2];
+  char buffer[READ_SIZE];
+  const char *data;
+  size_t count, i;
+  ssize_t length;
+  int flags, error;
+
+  fds[0].fd = reader->fd;
+  fds[0].events = POLLIN;
+  fds[1].fd = reader->stop.read_fd;
+  fds[1].events = POLLIN;
+
+  for (;;) {
+    if (poll(fds, 2, t3_key_decoder_get_timeout(reader->decoder)) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      reader->saved_errno = errno;
+      error = T3_ERR_ERRNO;
+      break;
+    }
+    if (fds[1].revents != 0) {
+      return NULL;
+    }
+
+    if ((flags = __atomic_load_n(&reader->flags, __ATOMIC_RELAXED)) !=
+        t3_key_decoder_get_flags(reader->decoder)) {
+      t3_key_decoder_set_flags(reader->decoder, flags);
+    }
+
+    if (fds[0].revents == 0) {
+      /* The time to wait for the rest of the kept bytes has passed. */
+      while (t3_key_decoder_flush(reader->decoder, &events[0])) {
+        if (!push_event(reader, &events[0], &time)) {
+          return NULL;
+        }
+      }
+      notifier_signal(&reader->events);
+      continue;
+    }
+
+    if ((length = read(reader->fd, buffer, READ_SIZE)) <= 0) {
+      if (length < 0 && (errno == EINTR || errno == EAGAIN)) {
+        continue;
+      }
+      reader->saved_errno = errno;
+      error = length == 0 ? T3_ERR_EOF : T3_ERR_ERRNO;
+      break;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &time);
+
+    for (data = buffer;
+         (count = t3_key_decoder_decode(reader->decoder, data, length, events, BATCH_SIZE)) > 0;
+         data = NULL) {
+      for (i = 0; i < count; i++) {
+        if (!push_event(reader, &events[i], &time)) {
+          return NULL;
+        }
+      }
+    }
+    notifier_signal(&reader->events);
+  }
+
+  /* No more input will arrive, so the kept bytes are complete. */
+  while (t3_key_decoder_flush(reader->decoder, &events[0])) {
+    if (!push_event(reader, &events[0], &time)) {
+      return NULL;
+    }
+  }
+  /* The error is only reported after all events have been added. */
+  __atomic_store_n(&reader->error, error, __ATOMIC_RELEASE);
+  notifier_signal(&reader->events);
+  return NULL;
+}
+
+t3_key_reader_t *t3_key_reader_new(int fd, const t3_key_node_t *map, int flags, int *error) {
+  t3_key_reader_t *reader = NULL;
+  sigset_t all_signals, old_signals;
+  int result;
+
+  if ((reader = calloc(1, sizeof(t3_key_reader_t))) == NULL) {
+    RETURN_ERROR(T3_ERR_OUT_OF_MEMORY);
+  }
+  reader->events.read_fd = reader->events.write_fd = -1;
+  reader->space.read_fd = reader->space.write_fd = -1;
+  reader->stop.read_fd = reader->stop.write_fd = -1;
+  reader->fd = fd;
+  reader->flags = flags;
+
+  if ((reader->decoder = t3_key_decoder_new(map, error)) == NULL) {
+    goto return_error;
+  }
+  t3_key_decoder_set_flags(reader->decoder, flags);
+  if (!notifier_init(&reader->events) || !notifier_init(&reader->space) ||
+      !notifier_init(&reader->stop)) {
+    RETURN_ERROR(T3_ERR_ERRNO);
+  }
+
+  /* Signals are handled by the threads of the program. */
+  sigfillset(&all_signals);
+  pthread_sigmask(SIG_SETMASK, &all_signals, &old_signals);
+  result = pthread_create(&reader->thread, NULL, reader_thread, reader);
+  pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+  if (result != 0) {
+    errno = result;
+    RETURN_ERROR(T3_ERR_ERRNO);
+  }
+  reader->thread_started = 1;
+  return reader;
+
+return_error:
+  t3_key_reader_free(reader);
+  return NULL;
+}
+
+void t3_key_reader_free(t3_key_reader_t *reader) {
+  if (reader == NULL) {
+    return;
+  }
+  if (reader->thread_started) {
+    notifier_signal(&reader->stop);
+    pthread_join(reader->thread, NULL);
+  }
+  notifier_close(&reader->events);
+  notifier_close(&reader->space);
+  notifier_close(&reader->stop);
+  t3_key_decoder_free(reader->decoder);
+  free(reader);
+}
+
+int t3_key_reader_get_fd(const t3_key_reader_t *reader) { return reader->events.read_fd; }
+
+int t3_key_reader_next(t3_key_reader_t *reader, t3_key_reader_event_t *event) {
+  unsigned long tail = reader->tail;
+  const t3_key_reader_event_t *entry;
+
+  if (__atomic_load_n(&reader->head, __ATOMIC_ACQUIRE) == tail) {
+    /* Reset the notifier before checking again, such that it is signalled
+       for events added after the check. */
+    notifier_drain(&reader->events);
+    if (__atomic_load_n(&reader->head, __ATOMIC_ACQUIRE) == tail) {
+      return 0;
+    }
+  }
+
+  entry = &reader->queue[tail % QUEUE_SIZE];
+  event->event = entry->event;
+  event->time = entry->time;
+  memcpy(event->data, entry->data, entry->event.length);
+  event->event.data = event->data;
+  if (entry->event.type == T3_KEY_EVENT_OSC) {
+    event->event.reply.string = event->data + (entry->event.reply.string - entry->data);
+  }
+  __atomic_store_n(&reader->tail, tail + 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&reader->producer_waiting, __ATOMIC_SEQ_CST)) {
+    notifier_signal(&reader->space);
+  }
+  return 1;
+}
+
+void t3_key_reader_set_flags(t3_key_reader_t *reader, int flags) {
+  __atomic_store_n(&reader->flags, flags, __ATOMIC_RELAXED);
+}
+
+int t3_key_reader_get_error(const t3_key_reader_t *reader) {
+  int error = __atomic_load_n(&reader->error, __ATOMIC_ACQUIRE);
+
+  if (error == T3_ERR_ERRNO) {
+    errno = reader->saved_errno;
+  }
+  return error;
+}
@@ -0,0 +1,115 @@
+/* Copyright (C) 2018 G.P. Halkes
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef T3_KEY_READER_H
+#define T3_KEY_READER_H
+
+/** @addtogroup t3key_other */
+/** @{ */
+
+#include <time.h>
+#include <t3key/decoder.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** An input reader, which reads and decodes the input from a terminal in a separate thread.
+
+    The reader thread reads from the terminal, decodes the input with a ::t3_key_decoder_t and
+    passes the events to the program through a lock-free queue. The program is woken up through
+    the file descriptor returned by ::t3_key_reader_get_fd, such that it never has to block on
+    reading from the terminal, or wait for the timeout of incomplete sequences.
+*/
+typedef struct t3_key_reader_t t3_key_reader_t;
+
+/** The number of bytes of the data of an event which is stored in a ::t3_key_reader_event_t. */
+#define T3_KEY_READER_DATA_SIZE T3_KEY_REPLY_MAX_LENGTH
+
+/** An event retrieved from a ::t3_key_reader_t. */
+typedef struct {
+  /** The event. The data of the event points to t3_key_reader_event_t::data. */
+  t3_key_event_t event;
+  /** The time at which the input for the event was read, measured with the @c CLOCK_MONOTONIC
+      clock. */
+  struct timespec time;
+  char data[T3_KEY_READER_DATA_SIZE]; /**< Storage for the data of the event. */
+} t3_key_reader_event_t;
+
+/** Create a reader, and start its thread.
+    @param fd The file descriptor of the terminal.
+    @param map The map to decode the input with, as returned by ::t3_key_load_map.
+    @param flags The @c T3_KEY_DECODER_* flags for the decoder.
+    @param error Location to store the error code.
+    @return A new reader, or @c NULL on failure.
+
+    From the creation of the reader until it is freed, only the reader thread may read from
+    @p fd. The file descriptor is not closed by the reader. Neither @p map nor @p fd may be closed
+    or freed before the reader.
+
+    ::T3_KEY_EVENT_TEXT and ::T3_KEY_EVENT_PASTE events longer than ::T3_KEY_READER_DATA_SIZE are
+    split into multiple events. Other events are never split: replies and mouse reports always fit,
+    and keys with longer sequences, which only occur in unusual maps, are returned as
+    ::T3_KEY_EVENT_TEXT events. The reader does not split UTF-8 characters when splitting
+    text events, but the text at the end of a read from the terminal may still end in the middle
+    of a character.
+*/
+T3_KEY_API t3_key_reader_t *t3_key_reader_new(int fd, const t3_key_node_t *map, int flags,
+                                              int *error);
+
+/** Stop the thread of a reader, and free the reader.
+    @param reader The reader to free. May be @c NULL.
+
+    Events which have not been retrieved are discarded.
+*/
+T3_KEY_API void t3_key_reader_free(t3_key_reader_t *reader);
+
+/** Get the file descriptor which becomes readable when a reader has events.
+    @param reader The reader to get the file descriptor for.
+    @return A file descriptor to wait on with @c poll, @c select or @c epoll.
+
+    The file descriptor is reset by ::t3_key_reader_next when no events remain. It also becomes
+    readable when the reader thread stops because of an error, see ::t3_key_reader_get_error.
+*/
+T3_KEY_API int t3_key_reader_get_fd(const t3_key_reader_t *reader);
+
+/** Retrieve the next event from a reader, without blocking.
+    @param reader The reader to retrieve the event from.
+    @param event Location to store the event.
+    @return @c 1 if an event was stored in @p event, @c 0 if no event is available.
+*/
+T3_KEY_API int t3_key_reader_next(t3_key_reader_t *reader, t3_key_reader_event_t *event);
+
+/** Set the flags of the decoder of a reader.
+    @param reader The reader to set the flags for.
+    @param flags The new @c T3_KEY_DECODER_* flags.
+
+    The flags are used for the input read after this call.
+*/
+T3_KEY_API void t3_key_reader_set_flags(t3_key_reader_t *reader, int flags);
+
+/** Get the reason the thread of a reader stopped.
+    @param reader The reader to query.
+    @return ::T3_ERR_SUCCESS if the thread is still reading, ::T3_ERR_EOF if the end of the input
+        was reached, or ::T3_ERR_ERRNO if reading failed. In the latter case, @c errno is set to
+        the error reported by @c read.
+
+    All events for the input read before the thread stopped can still be retrieved.
+*/
+T3_KEY_API int t3_key_reader_get_error(const t3_key_reader_t *reader);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+/** @} */
+#endif
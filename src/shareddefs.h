@@ -14,16 +14,65 @@
 #ifndef SHAREDDEFS_H
 #define SHAREDDEFS_H
 
-enum {
-  NODE_BEST,
-  NODE_MAP_START,
-  NODE_KEY_VALUE,
-  NODE_KEY_TERMINFO,
-  NODE_NAME,
-  NODE_AKA,
-  NODE_SHIFTFN,
-  NODE_XTERM_MOUSE,
-  NODE_END_OF_FILE = 65535
-};
+#include <stdint.h>
+
+/* Definitions for the compiled key database, which is written by t3keyc and
+   read by the library. The file is used by mapping it into memory, so all
+   values are stored in native byte order and all structures are aligned on
+   4 byte boundaries. All offsets are relative to the start of the file. All
+   strings are nul-terminated, and the last byte of the file is always nul. */
+
+/** Name of the compiled database file in the database directory. */
+#define DB_FILE_NAME "libt3key.db"
+#define DB_MAGIC "T3KEYDB"
+#define DB_VERSION 1
+#define DB_BYTE_ORDER 0x01020304
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint32_t size;           /* Size of the complete file. */
+  uint32_t terminal_count; /* Number of entries in the terminals table. */
+  uint32_t terminals;      /* Offset of the db_terminal_t table, sorted by name. */
+} db_header_t;
+
+/* Each terminal name, including the names listed in aka, has an entry in the
+   terminals table. Aliases share the db_info_t of the terminal. */
+typedef struct {
+  uint32_t name; /* Offset of the terminal name. */
+  uint32_t info; /* Offset of the db_info_t for the terminal. */
+} db_terminal_t;
+
+#define DB_INFO_XTERM_MOUSE (1 << 0)
+#define DB_INFO_SHIFTFN (1 << 1)
+
+typedef struct {
+  uint32_t best;       /* Index of the best map in the maps table. */
+  uint32_t map_count;  /* Number of entries in the maps table. */
+  uint32_t maps;       /* Offset of the db_map_t table, in database order. */
+  uint32_t flags;      /* DB_INFO_* flags. */
+  uint8_t shiftfn[4];  /* The shiftfn values, if DB_INFO_SHIFTFN is set. */
+} db_info_t;
+
+/* The keys of all maps included through _use are stored in the including map
+   itself, in the order in which they would be loaded from the text database.
+   Internal maps (starting with _) are stored as well, but are not reported as
+   map names. */
+typedef struct {
+  uint32_t name;      /* Offset of the map name. */
+  uint32_t key_count; /* Number of entries in the keys table. */
+  uint32_t keys;      /* Offset of the db_key_t table. */
+} db_map_t;
+
+/* The string is a terminfo capability name, instead of a literal sequence. */
+#define DB_KEY_TERMINFO (1 << 0)
+
+typedef struct {
+  uint32_t name;          /* Offset of the key name. */
+  uint32_t string;        /* Offset of the sequence or terminfo name. */
+  uint32_t string_length; /* Length of the sequence, excluding the nul terminator. */
+  uint32_t flags;         /* DB_KEY_* flags. */
+} db_key_t;
 
 #endif